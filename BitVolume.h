@@ -0,0 +1,140 @@
+#ifndef BITVOLUME_H
+#define BITVOLUME_H
+
+/**
+ * One bit per voxel of a volume, indexed as Matrix3D::coordToIdx(), packed in
+ * 64-bit words (a 1024x1024x64 volume takes 8 MB). Used as the visited set
+ * of region traversals and as the region they found.
+ */
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+class BitVolume
+{
+public:
+    typedef unsigned long long Word;
+    enum { WordBits = 64 };
+
+private:
+    unsigned int      mWidth, mHeight, mDepth;
+    std::vector<Word> mWords;
+
+    static inline unsigned int firstSetBit( Word w )
+    {
+#ifdef __GNUC__
+        return __builtin_ctzll( w );
+#else
+        unsigned int b = 0;
+        while ( (w & 1) == 0 ) { w >>= 1; b++; }
+        return b;
+#endif
+    }
+
+    // bits [b0, b1] of a word, b0 <= b1 < WordBits
+    static inline Word bitRange( unsigned int b0, unsigned int b1 )
+    {
+        const Word upTo = (b1 == WordBits - 1) ? ~Word(0) : ( (Word(1) << (b1 + 1)) - 1 );
+        return upTo & ~( (Word(1) << b0) - 1 );
+    }
+
+public:
+    BitVolume() : mWidth(0), mHeight(0), mDepth(0) { }
+
+    // resizes and clears all bits
+    void realloc( unsigned int w, unsigned int h, unsigned int d )
+    {
+        mWidth = w;
+        mHeight = h;
+        mDepth = d;
+
+        const size_t numVoxels = (size_t)w * h * d;
+        mWords.assign( (numVoxels + WordBits - 1) / WordBits, 0 );
+    }
+
+    template<typename T2>
+    inline void reallocSizeLike( const T2 &m ) { realloc( m.width(), m.height(), m.depth() ); }
+
+    template<typename T2>
+    inline bool isSizeLike( const T2 &m ) const {
+        return (m.width() == mWidth) && (m.height() == mHeight) && (m.depth() == mDepth);
+    }
+
+    void clear()
+    {
+        if ( !mWords.empty() )
+            memset( &mWords[0], 0, mWords.size() * sizeof(Word) );
+    }
+
+    inline unsigned int width() const  { return mWidth; }
+    inline unsigned int height() const { return mHeight; }
+    inline unsigned int depth() const  { return mDepth; }
+    inline size_t       bytes() const  { return mWords.size() * sizeof(Word); }
+
+    inline unsigned int coordToIdx( unsigned int x, unsigned int y, unsigned int z ) const
+    {
+        return x + y * mWidth + z * mWidth * mHeight;
+    }
+
+    inline bool test( unsigned int idx ) const
+    {
+        return ( mWords[idx / WordBits] >> (idx % WordBits) ) & 1;
+    }
+
+    inline void set( unsigned int idx )
+    {
+        mWords[idx / WordBits] |= Word(1) << (idx % WordBits);
+    }
+
+    inline void reset( unsigned int idx )
+    {
+        mWords[idx / WordBits] &= ~( Word(1) << (idx % WordBits) );
+    }
+
+    // sets the bits [i0, i1], a word at a time
+    void setRange( unsigned int i0, unsigned int i1 )
+    {
+        unsigned int w0 = i0 / WordBits, w1 = i1 / WordBits;
+
+        if (w0 == w1) {
+            mWords[w0] |= bitRange( i0 % WordBits, i1 % WordBits );
+            return;
+        }
+
+        mWords[w0] |= bitRange( i0 % WordBits, WordBits - 1 );
+        std::fill( mWords.begin() + w0 + 1, mWords.begin() + w1, ~Word(0) );
+        mWords[w1] |= bitRange( 0, i1 % WordBits );
+    }
+
+    // first set bit in [i, end), or end. Empty words are skipped whole
+    unsigned int nextSet( unsigned int i, unsigned int end ) const
+    {
+        while (i < end)
+        {
+            const Word w = mWords[i / WordBits] >> (i % WordBits);
+            if (w != 0)
+                return std::min( i + firstSetBit( w ), end );
+
+            i = (i / WordBits + 1) * WordBits;
+        }
+
+        return end;
+    }
+
+    // first clear bit in [i, end), or end
+    unsigned int nextClear( unsigned int i, unsigned int end ) const
+    {
+        while (i < end)
+        {
+            const Word w = ~mWords[i / WordBits] >> (i % WordBits);
+            if (w != 0)
+                return std::min( i + firstSetBit( w ), end );
+
+            i = (i / WordBits + 1) * WordBits;
+        }
+
+        return end;
+    }
+};
+
+#endif // BITVOLUME_H
@@ -0,0 +1,716 @@
+#ifndef BRICKEDSUPERVOXELS_H
+#define BRICKEDSUPERVOXELS_H
+
+#include "SuperVoxeler.h"
+#include "Region3D.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <algorithm>
+
+// 64-bit file offsets, raw volumes can be larger than 4 GB
+static inline bool fseek64( FILE *f, unsigned long long offset, int whence )
+{
+#ifdef _WIN32
+    return _fseeki64( f, (__int64)offset, whence ) == 0;
+#else
+    return fseeko( f, (off_t)offset, whence ) == 0;
+#endif
+}
+
+static inline unsigned long long ftell64( FILE *f )
+{
+#ifdef _WIN32
+    return (unsigned long long)_ftelli64( f );
+#else
+    return (unsigned long long)ftello( f );
+#endif
+}
+
+/**
+ ** Raw voxels for BrickedSupervoxels::generate(), read one brick at a time
+ */
+template<typename T>
+class BrickSource
+{
+public:
+    virtual ~BrickSource() { }
+
+    virtual unsigned int width() const = 0;
+    virtual unsigned int height() const = 0;
+    virtual unsigned int depth() const = 0;
+
+    // reads 'reg' into 'brick', which is reallocated to the region size
+    virtual bool read( const Region3D &reg, Matrix3D<T> &brick ) = 0;
+};
+
+// volume already in memory
+template<typename T>
+class MatrixBrickSource : public BrickSource<T>
+{
+private:
+    const Matrix3D<T> &mImg;
+
+public:
+    MatrixBrickSource( const Matrix3D<T> &img ) : mImg(img) { }
+
+    unsigned int width() const  { return mImg.width(); }
+    unsigned int height() const { return mImg.height(); }
+    unsigned int depth() const  { return mImg.depth(); }
+
+    bool read( const Region3D &reg, Matrix3D<T> &brick )
+    {
+        reg.useToCrop( mImg, &brick );
+        return true;
+    }
+};
+
+// headerless raw file (x fastest, then y, then z), which is never loaded as a whole,
+//  so it can be larger than RAM and have more than 2^32 voxels
+template<typename T>
+class RawFileBrickSource : public BrickSource<T>
+{
+private:
+    FILE *mFile;
+    unsigned int mWidth, mHeight, mDepth;
+
+    RawFileBrickSource( const RawFileBrickSource & );
+    RawFileBrickSource &operator=( const RawFileBrickSource & );
+
+public:
+    RawFileBrickSource() : mFile(0), mWidth(0), mHeight(0), mDepth(0) { }
+    ~RawFileBrickSource() { close(); }
+
+    // false if the file cannot be read or its size does not match the dimensions
+    bool open( const std::string &fileName, unsigned int w, unsigned int h, unsigned int d )
+    {
+        close();
+
+        mFile = fopen( fileName.c_str(), "rb" );
+        if (mFile == 0)
+            return false;
+
+        const unsigned long long expected = (unsigned long long)w * h * d * sizeof(T);
+        if ( !fseek64( mFile, 0, SEEK_END ) || (ftell64( mFile ) != expected) ) {
+            qWarning("%s does not have %ux%ux%u voxels", fileName.c_str(), w, h, d);
+            close();
+            return false;
+        }
+
+        mWidth = w;
+        mHeight = h;
+        mDepth = d;
+        return true;
+    }
+
+    void close()
+    {
+        if (mFile != 0)
+            fclose(mFile);
+        mFile = 0;
+    }
+
+    unsigned int width() const  { return mWidth; }
+    unsigned int height() const { return mHeight; }
+    unsigned int depth() const  { return mDepth; }
+
+    bool read( const Region3D &reg, Matrix3D<T> &brick )
+    {
+        if (mFile == 0)
+            return false;
+
+        brick.realloc( reg.size.x, reg.size.y, reg.size.z );
+
+        // one row of the brick at a time
+        T *dst = brick.data();
+        for (unsigned int z=0; z < reg.size.z; z++)
+            for (unsigned int y=0; y < reg.size.y; y++)
+            {
+                const unsigned long long idx = reg.corner.x + (unsigned long long)mWidth *
+                                               ( (reg.corner.y + y) + (unsigned long long)mHeight * (reg.corner.z + z) );
+
+                if ( !fseek64( mFile, idx * sizeof(T), SEEK_SET ) || (fread( dst, sizeof(T), reg.size.x, mFile ) != reg.size.x) )
+                    return false;
+
+                dst += reg.size.x;
+            }
+
+        return true;
+    }
+};
+
+/**
+ ** Out-of-core global supervoxels.
+ *  The volume is split into bricks, SLIC is run on each brick independently and
+ *  the resulting IDs are offset so that they are unique in the whole volume.
+ *  Each brick is stored as a raw file on disk, together with an index file, and
+ *  only the bricks that fit in the cache budget are kept in memory (LRU).
+ *
+ *  Supervoxels do not cross brick boundaries, so every supervoxel lives in
+ *  exactly one brick and its pixels can be served from that brick alone.
+ *
+ *  generate() reads the raw volume brick by brick from a BrickSource, so the
+ *  volume size is only limited by the disk (IDs are 32-bit, i.e. fewer than 2^32
+ *  supervoxels). svbatch generates them from a raw file; the annotator generates
+ *  and browses them for the volume it has loaded, which has to fit in a Matrix3D.
+ *
+ *  Bricks are loaded on demand by idAt() and voxelToPixel(), or in a background
+ *  thread by cachedIdAt(), which does not block while the brick is read.
+ */
+template<typename T>
+class BrickedSupervoxels
+{
+public:
+    typedef unsigned int    IDType;
+
+private:
+    // a brick loaded in memory: its IDs and, per local ID, the offsets of its voxels
+    //  (CSR layout: voxels of local ID i are voxOffset[idStart[i] .. idStart[i+1]) )
+    struct Brick
+    {
+        std::vector<IDType>       ids;
+        std::vector<unsigned int> idStart;
+        std::vector<unsigned int> voxOffset;
+
+        unsigned long long bytes() const
+        {
+            return sizeof(IDType) * (unsigned long long)ids.size()
+                 + sizeof(unsigned int) * ((unsigned long long)idStart.size() + voxOffset.size());
+        }
+    };
+
+    // reads the bricks requested by cachedIdAt(). They are handed back in 'loaded' and
+    //  only enter the cache in the caller's thread, so the cache itself needs no locking
+    class Loader : public QThread
+    {
+    private:
+        const BrickedSupervoxels *mOwner;
+
+    public:
+        QMutex          mutex;
+        QWaitCondition  wakeup;     // new requests or stop
+
+        std::deque<unsigned int>                        pending;    // front one is being read
+        std::vector< std::pair<unsigned int, Brick *> > loaded;     // 0 if it could not be read
+        bool stop;
+
+        Loader( const BrickedSupervoxels *owner ) : mOwner(owner), stop(false) { }
+
+    protected:
+        void run()
+        {
+            QMutexLocker lock( &mutex );
+
+            while (!stop)
+            {
+                if ( pending.empty() ) {
+                    wakeup.wait( &mutex );
+                    continue;
+                }
+
+                const unsigned int bIdx = pending.front();
+                lock.unlock();
+
+                Brick *brick = mOwner->loadBrick( bIdx );
+
+                lock.relock();
+                pending.pop_front();
+                loaded.push_back( std::make_pair( bIdx, brick ) );
+            }
+        }
+    };
+
+    std::string mDir;   // folder with index + brick files
+    bool        mIsEmpty;
+
+    unsigned int mWidth, mHeight, mDepth;
+    unsigned int mBrickSize;
+    unsigned int mNumBricks[3];     // bricks along x,y,z
+
+    std::vector<IDType> mBrickBase;     // first global ID of every brick, ascending
+    std::vector<IDType> mBrickLabels;   // number of IDs of every brick
+    IDType              mNumLabels;
+
+    // LRU cache, budgeted by the real size of every brick (remainder bricks are larger)
+    unsigned long long                          mMaxCacheBytes;
+    unsigned long long                          mCacheBytes;
+    std::list<unsigned int>                     mLRU;   // most recently used first
+    std::map<unsigned int, Brick *>             mCache;
+
+    Loader                  *mLoader;       // started by the first cachedIdAt()
+    std::set<unsigned int>  mFailedBricks;  // not requested again from the loader
+
+    BrickedSupervoxels( const BrickedSupervoxels & );
+    BrickedSupervoxels &operator=( const BrickedSupervoxels & );
+
+    static std::string indexFileName( const std::string &dir ) { return dir + "/svbricks.idx"; }
+
+    std::string brickFileName( unsigned int bIdx ) const
+    {
+        char buf[64];
+        sprintf( buf, "/brick_%06u.raw", bIdx );
+        return mDir + buf;
+    }
+
+    // start and size of brick number 'b' along a dimension of length 'dimLen',
+    //  the last brick absorbs the remainder so that no brick is thinner than mBrickSize
+    inline void brickExtent( unsigned int b, unsigned int numBricks, unsigned int dimLen, unsigned int &start, unsigned int &size ) const
+    {
+        start = b * mBrickSize;
+        if ( b + 1 == numBricks )
+            size = dimLen - start;
+        else
+            size = mBrickSize;
+    }
+
+    Region3D brickRegion( unsigned int bIdx ) const
+    {
+        const unsigned int bx = bIdx % mNumBricks[0];
+        const unsigned int by = (bIdx / mNumBricks[0]) % mNumBricks[1];
+        const unsigned int bz = bIdx / (mNumBricks[0] * mNumBricks[1]);
+
+        Region3D reg;
+        reg.valid = true;
+        brickExtent( bx, mNumBricks[0], mWidth,  reg.corner.x, reg.size.x );
+        brickExtent( by, mNumBricks[1], mHeight, reg.corner.y, reg.size.y );
+        brickExtent( bz, mNumBricks[2], mDepth,  reg.corner.z, reg.size.z );
+
+        return reg;
+    }
+
+    inline unsigned int brickAt( unsigned int x, unsigned int y, unsigned int z ) const
+    {
+        const unsigned int bx = std::min( x / mBrickSize, mNumBricks[0] - 1 );
+        const unsigned int by = std::min( y / mBrickSize, mNumBricks[1] - 1 );
+        const unsigned int bz = std::min( z / mBrickSize, mNumBricks[2] - 1 );
+
+        return bx + mNumBricks[0] * (by + mNumBricks[1] * bz);
+    }
+
+    // brick that contains global ID 'id'
+    inline unsigned int brickOfID( IDType id ) const
+    {
+        return (std::upper_bound( mBrickBase.begin(), mBrickBase.end(), id ) - mBrickBase.begin()) - 1;
+    }
+
+    inline unsigned int totalBricks() const { return mNumBricks[0] * mNumBricks[1] * mNumBricks[2]; }
+
+    void setupGrid( unsigned int w, unsigned int h, unsigned int d, unsigned int brickSize )
+    {
+        mWidth = w;
+        mHeight = h;
+        mDepth = d;
+        mBrickSize = brickSize;
+
+        mNumBricks[0] = std::max( 1U, w / brickSize );
+        mNumBricks[1] = std::max( 1U, h / brickSize );
+        mNumBricks[2] = std::max( 1U, d / brickSize );
+    }
+
+    bool writeIndex() const
+    {
+        FILE *f = fopen( indexFileName(mDir).c_str(), "w" );
+        if (f == 0)
+            return false;
+
+        fprintf( f, "SVBRICKS 1\n%u %u %u %u\n%u\n", mWidth, mHeight, mDepth, mBrickSize, totalBricks() );
+        for (unsigned int i=0; i < totalBricks(); i++)
+            fprintf( f, "%u %u\n", mBrickBase[i], mBrickLabels[i] );
+
+        fclose(f);
+        return true;
+    }
+
+    // reads brick from disk and builds its ID -> voxels table.
+    //  Only reads members that are constant while the loader runs
+    Brick *loadBrick( unsigned int bIdx ) const
+    {
+        const Region3D reg = brickRegion( bIdx );
+        const unsigned int numVox = reg.size.x * reg.size.y * reg.size.z;
+
+        FILE *f = fopen( brickFileName(bIdx).c_str(), "rb" );
+        if (f == 0) {
+            qWarning("Cannot open supervoxel brick %u", bIdx);
+            return 0;
+        }
+
+        Brick *brick = new Brick;
+        brick->ids.resize( numVox );
+
+        if ( fread( &brick->ids[0], sizeof(IDType), numVox, f ) != numVox ) {
+            qWarning("Supervoxel brick %u is truncated", bIdx);
+            fclose(f);
+            delete brick;
+            return 0;
+        }
+        fclose(f);
+
+        const IDType base = mBrickBase[bIdx];
+        const IDType numLocal = mBrickLabels[bIdx];
+
+        // IDs index the tables below, a brick that does not match the index is rejected like a truncated one
+        for (unsigned int i=0; i < numVox; i++)
+        {
+            if ( (brick->ids[i] < base) || (brick->ids[i] - base >= numLocal) ) {
+                qWarning("Supervoxel brick %u has IDs outside [%u, %u)", bIdx, base, base + numLocal);
+                delete brick;
+                return 0;
+            }
+        }
+
+        // counting sort of voxel offsets by local ID
+
+        brick->idStart.assign( numLocal + 1, 0 );
+        for (unsigned int i=0; i < numVox; i++)
+            brick->idStart[ brick->ids[i] - base + 1 ]++;
+
+        for (unsigned int i=0; i < numLocal; i++)
+            brick->idStart[i + 1] += brick->idStart[i];
+
+        std::vector<unsigned int> fillPos( brick->idStart.begin(), brick->idStart.end() - 1 );
+        brick->voxOffset.resize( numVox );
+        for (unsigned int i=0; i < numVox; i++)
+            brick->voxOffset[ fillPos[ brick->ids[i] - base ]++ ] = i;
+
+        return brick;
+    }
+
+    // returns brick from cache, loading it (and evicting the least recently used one) if needed
+    const Brick *getBrick( unsigned int bIdx )
+    {
+        typename std::map<unsigned int, Brick *>::iterator it = mCache.find( bIdx );
+        if ( it != mCache.end() )
+        {
+            if ( mLRU.front() != bIdx ) {
+                mLRU.remove( bIdx );
+                mLRU.push_front( bIdx );
+            }
+            return it->second;
+        }
+
+        Brick *brick = loadBrick( bIdx );
+        if (brick == 0)
+            return 0;
+
+        insertBrick( bIdx, brick );
+        return brick;
+    }
+
+    // adds a loaded brick, evicting the least recently used ones until it fits
+    void insertBrick( unsigned int bIdx, Brick *brick )
+    {
+        while ( !mLRU.empty() && (mCacheBytes + brick->bytes() > mMaxCacheBytes) )
+        {
+            const unsigned int evict = mLRU.back();
+            mLRU.pop_back();
+
+            mCacheBytes -= mCache[evict]->bytes();
+            delete mCache[evict];
+            mCache.erase( evict );
+        }
+
+        mCache[bIdx] = brick;
+        mCacheBytes += brick->bytes();
+        mLRU.push_front( bIdx );
+    }
+
+    // moves the bricks read by the loader to the cache
+    void adoptLoaded()
+    {
+        if (mLoader == 0)
+            return;
+
+        std::vector< std::pair<unsigned int, Brick *> > loaded;
+        {
+            QMutexLocker lock( &mLoader->mutex );
+            loaded.swap( mLoader->loaded );
+        }
+
+        for (unsigned int i=0; i < loaded.size(); i++)
+        {
+            if ( loaded[i].second == 0 )
+                mFailedBricks.insert( loaded[i].first );
+            else if ( mCache.count( loaded[i].first ) != 0 )
+                delete loaded[i].second;    // idAt() read it meanwhile
+            else
+                insertBrick( loaded[i].first, loaded[i].second );
+        }
+    }
+
+    void requestBrick( unsigned int bIdx )
+    {
+        if ( mFailedBricks.count( bIdx ) != 0 )
+            return;
+
+        if (mLoader == 0)
+            mLoader = new Loader( this );
+
+        {
+            QMutexLocker lock( &mLoader->mutex );
+
+            if ( std::find( mLoader->pending.begin(), mLoader->pending.end(), bIdx ) != mLoader->pending.end() )
+                return;
+
+            mLoader->pending.push_back( bIdx );
+            mLoader->wakeup.wakeOne();
+        }
+
+        if ( !mLoader->isRunning() )
+            mLoader->start( QThread::LowPriority );
+    }
+
+    // waits for the brick being read and drops the rest, needed before the grid or the folder change
+    void stopLoader()
+    {
+        if (mLoader != 0)
+        {
+            {
+                QMutexLocker lock( &mLoader->mutex );
+                mLoader->stop = true;
+                mLoader->pending.clear();
+                mLoader->wakeup.wakeAll();
+            }
+            mLoader->wait();
+
+            for (unsigned int i=0; i < mLoader->loaded.size(); i++)
+                delete mLoader->loaded[i].second;
+
+            delete mLoader;
+            mLoader = 0;
+        }
+
+        mFailedBricks.clear();
+    }
+
+public:
+    BrickedSupervoxels()
+    {
+        mIsEmpty = true;
+        mNumLabels = 0;
+        mMaxCacheBytes = 1024ULL * 1024 * 1024;
+        mCacheBytes = 0;
+        mLoader = 0;
+        setupGrid( 0, 0, 0, 1 );
+    }
+
+    ~BrickedSupervoxels() { stopLoader(); clearCache(); }
+
+    inline bool empty() const { return mIsEmpty; }
+
+    IDType numLabels() const { return mNumLabels; }
+
+    const std::string &folder() const { return mDir; }
+
+    // a cached brick takes about 8 bytes/voxel (IDs + voxel offsets). The brick in use
+    //  is always kept, even if it alone exceeds the budget
+    void setCacheSizeMB( unsigned int megaBytes )
+    {
+        mMaxCacheBytes = megaBytes * 1024ULL * 1024ULL;
+    }
+
+    void clearCache()
+    {
+        for (typename std::map<unsigned int, Brick *>::iterator it = mCache.begin(); it != mCache.end(); ++it)
+            delete it->second;
+
+        mCache.clear();
+        mLRU.clear();
+        mCacheBytes = 0;
+    }
+
+    bool isSizeLike( const Matrix3D<T> &img ) const
+    {
+        return (img.width() == mWidth) && (img.height() == mHeight) && (img.depth() == mDepth);
+    }
+
+    bool generate( const Matrix3D<T> &img, unsigned int brickSize, int step, unsigned int cubeness, const std::string &dir )
+    {
+        MatrixBrickSource<T> src( img );
+        return generate( src, brickSize, step, cubeness, dir );
+    }
+
+    // computes supervoxels brick by brick and writes them to 'dir'.
+    //  Only one brick of the source (plus its SLIC working memory) is in memory at a time
+    bool generate( BrickSource<T> &src, unsigned int brickSize, int step, unsigned int cubeness, const std::string &dir )
+    {
+        stopLoader();
+        clearCache();
+        mIsEmpty = true;
+
+        mDir = dir;
+        setupGrid( src.width(), src.height(), src.depth(), brickSize );
+
+        mBrickBase.resize( totalBricks() );
+        mBrickLabels.resize( totalBricks() );
+        mNumLabels = 0;
+
+        Matrix3D<T>      croppedImg;
+        Matrix3D<IDType> brickIDs;
+
+        for (unsigned int bIdx=0; bIdx < totalBricks(); bIdx++)
+        {
+            const Region3D reg = brickRegion( bIdx );
+
+            qDebug("Brick %u/%u: (%u,%u,%u) size %ux%ux%u", bIdx + 1, totalBricks(),
+                   reg.corner.x, reg.corner.y, reg.corner.z, reg.size.x, reg.size.y, reg.size.z);
+
+            if ( !src.read( reg, croppedImg ) ) {
+                qWarning("Cannot read brick %u of the volume", bIdx);
+                return false;
+            }
+
+            unsigned int numLocal = 0;
+            SuperVoxeler<T>::rawGenSupervoxels( croppedImg, step, cubeness, &brickIDs, numLocal );
+
+            // labels are not guaranteed to be dense, so take the largest one as reference
+            for (unsigned int i=0; i < brickIDs.numElem(); i++)
+                if ( brickIDs.data()[i] >= numLocal )
+                    numLocal = brickIDs.data()[i] + 1;
+
+            mBrickBase[bIdx] = mNumLabels;
+            mBrickLabels[bIdx] = numLocal;
+
+            for (unsigned int i=0; i < brickIDs.numElem(); i++)
+                brickIDs.data()[i] += mNumLabels;
+
+            mNumLabels += numLocal;
+
+            FILE *f = fopen( brickFileName(bIdx).c_str(), "wb" );
+            if (f == 0) {
+                qWarning("Cannot write %s", brickFileName(bIdx).c_str());
+                return false;
+            }
+
+            const bool ok = fwrite( brickIDs.data(), sizeof(IDType), brickIDs.numElem(), f ) == brickIDs.numElem();
+            fclose(f);
+
+            if (!ok) {
+                qWarning("Error writing %s", brickFileName(bIdx).c_str());
+                return false;
+            }
+        }
+
+        if (!writeIndex())
+            return false;
+
+        mIsEmpty = false;
+        return true;
+    }
+
+    // opens bricks previously written by generate()
+    bool load( const std::string &dir )
+    {
+        stopLoader();
+        clearCache();
+        mIsEmpty = true;
+
+        FILE *f = fopen( indexFileName(dir).c_str(), "r" );
+        if (f == 0)
+            return false;
+
+        unsigned int version = 0, w, h, d, bs, nb;
+        bool ok = (fscanf( f, "SVBRICKS %u", &version ) == 1) && (version == 1);
+        ok = ok && (fscanf( f, "%u %u %u %u %u", &w, &h, &d, &bs, &nb ) == 5) && (bs > 0);
+
+        if (ok)
+        {
+            mDir = dir;
+            setupGrid( w, h, d, bs );
+            ok = (nb == totalBricks());
+        }
+
+        if (ok)
+        {
+            mBrickBase.resize( nb );
+            mBrickLabels.resize( nb );
+            for (unsigned int i=0; ok && (i < nb); i++)
+                ok = fscanf( f, "%u %u", &mBrickBase[i], &mBrickLabels[i] ) == 2;
+        }
+
+        fclose(f);
+
+        if (!ok) {
+            qWarning("Invalid supervoxel brick index in %s", dir.c_str());
+            return false;
+        }
+
+        mNumLabels = (nb > 0) ? (mBrickBase[nb - 1] + mBrickLabels[nb - 1]) : 0;
+        mIsEmpty = false;
+        return true;
+    }
+
+    // supervoxel ID at a given voxel, false if the brick could not be read
+    bool idAt( unsigned int x, unsigned int y, unsigned int z, IDType &id )
+    {
+        const unsigned int bIdx = brickAt( x, y, z );
+        const Brick *brick = getBrick( bIdx );
+        if (brick == 0)
+            return false;
+
+        const Region3D reg = brickRegion( bIdx );
+        id = brick->ids[ (x - reg.corner.x) + reg.size.x * ((y - reg.corner.y) + reg.size.y * (z - reg.corner.z)) ];
+        return true;
+    }
+
+    // same as idAt(), but only if the brick is in memory. Otherwise it is read in the
+    //  background and false is returned until it is ready, e.g. for hovering
+    bool cachedIdAt( unsigned int x, unsigned int y, unsigned int z, IDType &id )
+    {
+        adoptLoaded();
+
+        const unsigned int bIdx = brickAt( x, y, z );
+        if ( mCache.count( bIdx ) == 0 ) {
+            requestBrick( bIdx );
+            return false;
+        }
+
+        return idAt( x, y, z, id );
+    }
+
+    // pixels of supervoxel 'id', in whole-volume coordinates. PixelInfo::index is a Matrix3D
+    //  index, so it is only valid if the volume has fewer than 2^32 voxels
+    bool voxelToPixel( IDType id, PixelInfoList &pixels )
+    {
+        pixels.clear();
+        if ( mIsEmpty || (id >= mNumLabels) )
+            return false;
+
+        const unsigned int bIdx = brickOfID( id );
+        const Brick *brick = getBrick( bIdx );
+        if (brick == 0)
+            return false;
+
+        const Region3D reg = brickRegion( bIdx );
+        const unsigned int sliceSz = reg.size.x * reg.size.y;
+
+        const IDType localID = id - mBrickBase[bIdx];
+        const unsigned int start = brick->idStart[localID];
+        const unsigned int end = brick->idStart[localID + 1];
+
+        pixels.resize( end - start );
+        for (unsigned int i=start; i < end; i++)
+        {
+            const unsigned int off = brick->voxOffset[i];
+
+            const unsigned int x = reg.corner.x + off % reg.size.x;
+            const unsigned int y = reg.corner.y + (off % sliceSz) / reg.size.x;
+            const unsigned int z = reg.corner.z + off / sliceSz;
+
+            pixels[i - start] = PixelInfo( x, y, z, (unsigned int)(x + mWidth * (y + (unsigned long long)mHeight * z)) );
+        }
+
+        return true;
+    }
+};
+
+#endif // BRICKEDSUPERVOXELS_H
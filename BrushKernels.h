@@ -0,0 +1,513 @@
+#ifndef BRUSHKERNELS_H
+#define BRUSHKERNELS_H
+
+/**
+ * Brush rasterisers shared by the brushes of the main window and the plugins.
+ * Every shape has its own kernel, templated on the write mode and the voxel type,
+ * so that the row loops are specialised at compile time: shape and mode are picked
+ * once per stamp (see BrushKernels::paint()), never per voxel. Kernels clip their
+ * box to the volume once and write one span per row.
+ * Constrained painting (BrushConstraints) is a write mode too: its masks are
+ * evaluated per row, on the voxels being written.
+ */
+#include "Matrix3D.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+enum BrushShape
+{
+    BrushPixel = 0,     // the voxel (x, y, z)
+    BrushCube,          // [x - w, x + w) x [y - h, y + h) x [z - d, z + d)
+    BrushEllipsoid      // inside the cube, (i-x)^2/w^2 + (j-y)^2/h^2 + (k-z)^2/d^2 <= 1
+};
+
+// how the voxels covered by a brush are written
+enum BrushWriteMode
+{
+    BrushWriteSet = 0,      // value
+    BrushWriteErase,        // 0
+    BrushWriteMax,          // max of the voxel and value
+    BrushWriteUnlabelled    // value, only where the voxel is 0
+};
+
+/** Restrictions on the voxels a brush writes, as for supervoxel labelling.
+ *  The volumes have to be the size of the one painted **/
+struct BrushConstraints
+{
+    const unsigned char *volume;    // if not 0, only voxels with volume in [pixMin, pixMax]
+    unsigned char        pixMin, pixMax;
+
+    const unsigned char *score;     // if not 0, only voxels with score >= scoreThr
+    unsigned char        scoreThr;
+
+    bool                 dontOverwriteLabeled;  // only voxels that are 0 (ignored when erasing)
+
+    BrushConstraints() : volume(0), pixMin(0), pixMax(255), score(0), scoreThr(0), dontOverwriteLabeled(false) { }
+
+    inline bool active() const { return (volume != 0) || (score != 0) || dontOverwriteLabeled; }
+};
+
+namespace BrushKernels
+{
+
+// write modes, applied to the n voxels of a row starting at voxel idx of the volume
+struct WriteSet
+{
+    template<typename T>
+    inline void row( T *p, unsigned int, unsigned int n, T value ) const { std::fill( p, p + n, value ); }
+};
+
+struct WriteErase
+{
+    template<typename T>
+    inline void row( T *p, unsigned int, unsigned int n, T ) const { std::fill( p, p + n, T(0) ); }
+};
+
+struct WriteMax
+{
+    template<typename T>
+    inline void row( T *p, unsigned int, unsigned int n, T value ) const
+    {
+        for (unsigned int i=0; i < n; i++)
+            p[i] = std::max( p[i], value );
+    }
+};
+
+struct WriteUnlabelled
+{
+    template<typename T>
+    inline void row( T *p, unsigned int, unsigned int n, T value ) const
+    {
+        for (unsigned int i=0; i < n; i++)
+            if ( p[i] == T(0) )
+                p[i] = value;
+    }
+};
+
+// value (or the max of the voxel and value) where all the constraints hold
+struct WriteConstrained
+{
+    BrushConstraints c;
+    bool             onlyUnlabelled;
+    bool             takeMax;
+
+    WriteConstrained() : onlyUnlabelled(false), takeMax(false) { }
+
+    WriteConstrained( const BrushConstraints &constraints, BrushWriteMode mode ) : c(constraints)
+    {
+        onlyUnlabelled = (mode == BrushWriteUnlabelled) || (constraints.dontOverwriteLabeled && (mode != BrushWriteErase));
+        takeMax = (mode == BrushWriteMax);
+    }
+
+    template<typename T>
+    inline bool keep( const T *p, unsigned int idx, unsigned int i ) const
+    {
+        if ( c.volume && ( (c.volume[idx + i] < c.pixMin) || (c.volume[idx + i] > c.pixMax) ) )
+            return false;
+        if ( c.score && (c.score[idx + i] < c.scoreThr) )
+            return false;
+        return !onlyUnlabelled || (p[i] == T(0));
+    }
+
+    template<typename T>
+    inline void row( T *p, unsigned int idx, unsigned int n, T value ) const
+    {
+        for (unsigned int i=0; i < n; i++)
+            if ( keep( p, idx, i ) )
+                p[i] = takeMax ? std::max( p[i], value ) : value;
+    }
+
+    // 8-bit voxels: the constraints are a byte mask, 16 voxels at a time
+    inline void row( unsigned char *p, unsigned int idx, unsigned int n, unsigned char value ) const
+    {
+        unsigned int i=0;
+
+#ifdef __SSE2__
+        const __m128i ones = _mm_set1_epi8( (char) 0xFF );
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i vMin = _mm_set1_epi8( (char) c.pixMin );
+        const __m128i vMax = _mm_set1_epi8( (char) c.pixMax );
+        const __m128i vThr = _mm_set1_epi8( (char) c.scoreThr );
+        const __m128i vVal = _mm_set1_epi8( (char) value );
+
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m128i cur = _mm_loadu_si128( (const __m128i *)(p + i) );
+            __m128i mask = ones;
+
+            // unsigned comparisons: v >= a  <=>  max(v, a) == v
+            if (c.volume)
+            {
+                const __m128i v = _mm_loadu_si128( (const __m128i *)(c.volume + idx + i) );
+                mask = _mm_and_si128( mask, _mm_cmpeq_epi8( _mm_max_epu8( v, vMin ), v ) );
+                mask = _mm_and_si128( mask, _mm_cmpeq_epi8( _mm_min_epu8( v, vMax ), v ) );
+            }
+            if (c.score)
+            {
+                const __m128i s = _mm_loadu_si128( (const __m128i *)(c.score + idx + i) );
+                mask = _mm_and_si128( mask, _mm_cmpeq_epi8( _mm_max_epu8( s, vThr ), s ) );
+            }
+            if (onlyUnlabelled)
+                mask = _mm_and_si128( mask, _mm_cmpeq_epi8( cur, zero ) );
+
+            const __m128i val = takeMax ? _mm_max_epu8( cur, vVal ) : vVal;
+            _mm_storeu_si128( (__m128i *)(p + i), _mm_or_si128( _mm_andnot_si128( mask, cur ), _mm_and_si128( mask, val ) ) );
+        }
+#endif
+
+        for (; i < n; i++)
+            if ( keep( p, idx, i ) )
+                p[i] = takeMax ? std::max( p[i], value ) : value;
+    }
+};
+
+// rounding of the swept spans, so that limits falling on a voxel are not lost to it
+static const double strokeEps = 1e-9;
+
+// clips the inclusive bounds [x0, x1] x [y0, y1] x [z0, z1] to the volume, returns false if nothing is left
+template<typename T>
+inline bool clipBounds( const Matrix3D<T> &data, int &x0, int &x1, int &y0, int &y1, int &z0, int &z1 )
+{
+    x0 = std::max( x0, 0 );
+    y0 = std::max( y0, 0 );
+    z0 = std::max( z0, 0 );
+
+    x1 = std::min( x1, (int)data.width() - 1 );
+    y1 = std::min( y1, (int)data.height() - 1 );
+    z1 = std::min( z1, (int)data.depth() - 1 );
+
+    return (x0 <= x1) && (y0 <= y1) && (z0 <= z1);
+}
+
+// box covering the brush [c - ext, c + ext) along a segment from c0 to c1, inclusive limits
+inline void strokeBounds( int c0, int c1, int ext, int &lo, int &hi )
+{
+    lo = std::min( c0, c1 ) - ext;
+    hi = std::max( c0, c1 ) + ext - 1;
+}
+
+// writes [x0, x1] of row y of slice z, coordinates already clipped
+template<class Mode, typename T>
+inline void writeRow( Matrix3D<T> &data, int x0, int x1, int y, int z, T value, const Mode &mode )
+{
+    mode.row( data.sliceData(z) + y * data.width() + x0, data.coordToIdx( x0, y, z ), x1 - x0 + 1, value );
+}
+
+// half width r of the row of an ellipsoid of half width 'width' whose center is dy, dz away
+//  (normalized by the extents) from the row, so that the row covers [x - r, x + r]. -1 if it misses the row.
+//  It starts from the analytic estimate and is fixed up with the exact per-voxel test, so that rounding
+//  never changes which voxels are painted
+inline int ellipsoidRowHalfWidth( int width, double dy, double dz )
+{
+    const double w2 = (double)(width*width);
+
+    const double rest = 1.0 - dy - dz;
+    int r = (rest > 0) ? std::min( (int)( width * sqrt(rest) ), width ) : 0;
+
+    while ( (r >= 0) && !( r*r / w2 + dy + dz <= 1 ) )
+        r--;
+    while ( (r < width) && ( (r+1)*(r+1) / w2 + dy + dz <= 1 ) )
+        r++;
+
+    return r;
+}
+
+// narrows [t0, t1] to the positions t of the brush center c0 + t * dc along a segment for which
+//  the brush [c - ext, c + ext) covers voxel idx, that is c in [idx - ext + 1, idx + ext]
+inline bool coveringRange( int c0, int dc, int idx, int ext, double &t0, double &t1 )
+{
+    const double lo = idx - ext + 1 - c0;
+    const double hi = idx + ext - c0;
+
+    if (dc == 0)
+        return (lo <= 0) && (0 <= hi) && (t0 <= t1);
+
+    double a = lo / dc, b = hi / dc;
+    if (dc < 0)
+        std::swap( a, b );
+
+    t0 = std::max( t0, a );
+    t1 = std::min( t1, b );
+
+    return t0 <= t1;
+}
+
+template<class Mode, typename T>
+inline void paintPixel( Matrix3D<T> &data, int x, int y, int z, T value,
+                        const Mode &mode = Mode() )
+{
+    if ( (x < 0) || (y < 0) || (z < 0) || (x >= (int)data.width()) || (y >= (int)data.height()) || (z >= (int)data.depth()) )
+        return;
+
+    mode.row( data.sliceData(z) + y * data.width() + x, data.coordToIdx( x, y, z ), 1, value );
+}
+
+// inclusive box [x0, x1] x [y0, y1] x [z0, z1]
+template<class Mode, typename T>
+void paintBox( Matrix3D<T> &data, int x0, int y0, int z0, int x1, int y1, int z1, T value,
+               const Mode &mode = Mode() )
+{
+    if ( !clipBounds( data, x0, x1, y0, y1, z0, z1 ) )
+        return;
+
+    for (int k = z0; k <= z1; k++)
+        for (int j = y0; j <= y1; j++)
+            writeRow<Mode>( data, x0, x1, j, k, value, mode );
+}
+
+template<class Mode, typename T>
+inline void paintCube( Matrix3D<T> &data, int x, int y, int z, int w, int h, int d, T value,
+                       const Mode &mode = Mode() )
+{
+    paintBox( data, x - w, y - h, z - d, x + w - 1, y + h - 1, z + d - 1, value, mode );
+}
+
+template<class Mode, typename T>
+void paintEllipsoid( Matrix3D<T> &data, int x, int y, int z, int w, int h, int d, T value,
+                     const Mode &mode = Mode() )
+{
+    // the box of the cube, of which every row is written inside the ellipsoid
+    int x0 = x - w, x1 = x + w - 1;
+    int y0 = y - h, y1 = y + h - 1;
+    int z0 = z - d, z1 = z + d - 1;
+    if ( !clipBounds( data, x0, x1, y0, y1, z0, z1 ) )
+        return;
+
+    for (int k = z0; k <= z1; k++)
+    {
+        const double dz = (k-z)*(k-z)/( (double)(d*d) );
+
+        for (int j = y0; j <= y1; j++)
+        {
+            const double dy = (j-y)*(j-y)/( (double)(h*h) );
+
+            const int r = ellipsoidRowHalfWidth( w, dy, dz );
+            if (r < 0)
+                continue;
+
+            const int i0 = std::max( x - r, x0 );
+            const int i1 = std::min( x + r, x1 );
+            if (i0 <= i1)
+                writeRow<Mode>( data, i0, i1, j, k, value, mode );
+        }
+    }
+}
+
+// voxels of the segment, one per step along its longest axis
+template<class Mode, typename T>
+void paintPixelStroke( Matrix3D<T> &data, int x0, int y0, int z0, int x1, int y1, int z1, T value,
+                       const Mode &mode = Mode() )
+{
+    const int n = std::max( std::abs(x1 - x0), std::max( std::abs(y1 - y0), std::abs(z1 - z0) ) );
+
+    for (int s = 0; s <= n; s++)
+    {
+        const double t = (n == 0) ? 0.0 : s / (double)n;
+        paintPixel( data, (int) floor( x0 + t * (x1 - x0) + 0.5 ), (int) floor( y0 + t * (y1 - y0) + 0.5 ),
+                    (int) floor( z0 + t * (z1 - z0) + 0.5 ), value, mode );
+    }
+}
+
+template<class Mode, typename T>
+void paintCubeStroke( Matrix3D<T> &data, int x0, int y0, int z0, int x1, int y1, int z1, int w, int h, int d, T value,
+                      const Mode &mode = Mode() )
+{
+    // the swept box is convex: in every row, the positions along the segment for which the box
+    //  covers the row form an interval, and the row span goes from the box at one end of it
+    //  to the box at the other end
+    int bx0, bx1, by0, by1, bz0, bz1;
+    strokeBounds( x0, x1, w, bx0, bx1 );
+    strokeBounds( y0, y1, h, by0, by1 );
+    strokeBounds( z0, z1, d, bz0, bz1 );
+    if ( !clipBounds( data, bx0, bx1, by0, by1, bz0, bz1 ) )
+        return;
+
+    const int dx = x1 - x0, dy = y1 - y0, dz = z1 - z0;
+
+    for (int k = bz0; k <= bz1; k++)
+    {
+        double tz0 = 0, tz1 = 1;
+        if ( !coveringRange( z0, dz, k, d, tz0, tz1 ) )
+            continue;
+
+        for (int j = by0; j <= by1; j++)
+        {
+            double t0 = tz0, t1 = tz1;
+            if ( !coveringRange( y0, dy, j, h, t0, t1 ) )
+                continue;
+
+            const double xa = x0 + t0 * dx, xb = x0 + t1 * dx;
+
+            const int i0 = std::max( (int) ceil( std::min( xa, xb ) - w - strokeEps ), bx0 );
+            const int i1 = std::min( (int) floor( std::max( xa, xb ) + w - 1 + strokeEps ), bx1 );
+            if (i0 <= i1)
+                writeRow<Mode>( data, i0, i1, j, k, value, mode );
+        }
+    }
+}
+
+template<class Mode, typename T>
+void paintEllipsoidStroke( Matrix3D<T> &data, int x0, int y0, int z0, int x1, int y1, int z1, int w, int h, int d, T value,
+                           const Mode &mode = Mode() )
+{
+    // scaled by the extents, the ellipsoid is the unit sphere and the swept volume is the capsule of
+    //  radius 1 around the segment a-b. It is convex, so in every row it covers the hull of the
+    //  spans of the end spheres and of the cylinder between them
+    if ( (w <= 0) || (h <= 0) || (d <= 0) )
+        return;
+
+    int bx0, bx1, by0, by1, bz0, bz1;
+    strokeBounds( x0, x1, w, bx0, bx1 );
+    strokeBounds( y0, y1, h, by0, by1 );
+    strokeBounds( z0, z1, d, bz0, bz1 );
+    if ( !clipBounds( data, bx0, bx1, by0, by1, bz0, bz1 ) )
+        return;
+
+    const double ax = x0 / (double)w, ay = y0 / (double)h, az = z0 / (double)d;
+    const double Dx = (x1 - x0) / (double)w, Dy = (y1 - y0) / (double)h, Dz = (z1 - z0) / (double)d;
+    const double L = Dx*Dx + Dy*Dy + Dz*Dz;
+
+    for (int k = bz0; k <= bz1; k++)
+    {
+        const double dz0 = (k-z0)*(k-z0)/( (double)(d*d) );
+        const double dz1 = (k-z1)*(k-z1)/( (double)(d*d) );
+        const double cz = k / (double)d - az;
+
+        for (int j = by0; j <= by1; j++)
+        {
+            const double dy0 = (j-y0)*(j-y0)/( (double)(h*h) );
+            const double dy1 = (j-y1)*(j-y1)/( (double)(h*h) );
+            const double cy = j / (double)h - ay;
+
+            double lo = bx1 + 1, hi = bx0 - 1;
+
+            // end spheres, exactly as paintEllipsoid() does
+            const int r0 = ellipsoidRowHalfWidth( w, dy0, dz0 );
+            if (r0 >= 0) {
+                lo = std::min( lo, (double)(x0 - r0) );
+                hi = std::max( hi, (double)(x0 + r0) );
+            }
+
+            const int r1 = ellipsoidRowHalfWidth( w, dy1, dz1 );
+            if (r1 >= 0) {
+                lo = std::min( lo, (double)(x1 - r1) );
+                hi = std::max( hi, (double)(x1 + r1) );
+            }
+
+            // cylinder: the points (s, j/h, k/d) of the row within distance 1 of the line,
+            //  qa*s^2 + qb*s + qc <= 0, whose projection t = (s*Dx + cd) / L on it is in [0, 1]
+            const double qa = (Dy*Dy + Dz*Dz) / L;
+            if ( (L > 0) && (qa > 0) )
+            {
+                const double cd = -ax * Dx + cy * Dy + cz * Dz;
+                const double qb = 2 * ( -ax - cd * Dx / L );
+                const double qc = ax*ax + cy*cy + cz*cz - cd * cd / L - 1 - strokeEps;   // tangent rows touch it
+
+                const double disc = qb*qb - 4*qa*qc;
+                if (disc >= 0)
+                {
+                    double s0 = ( -qb - sqrt(disc) ) / (2*qa);
+                    double s1 = ( -qb + sqrt(disc) ) / (2*qa);
+
+                    if (Dx != 0)
+                    {
+                        double sa = -cd / Dx, sb = (L - cd) / Dx;
+                        if (sa > sb)
+                            std::swap( sa, sb );
+
+                        s0 = std::max( s0, sa );
+                        s1 = std::min( s1, sb );
+                    }
+                    else if ( (cd < 0) || (cd > L) )
+                        s1 = s0 - 1;
+
+                    if (s0 <= s1) {
+                        lo = std::min( lo, s0 * w );
+                        hi = std::max( hi, s1 * w );
+                    }
+                }
+            }
+
+            const int i0 = std::max( (int) ceil( lo - strokeEps ), bx0 );
+            const int i1 = std::min( (int) floor( hi + strokeEps ), bx1 );
+            if (i0 <= i1)
+                writeRow<Mode>( data, i0, i1, j, k, value, mode );
+        }
+    }
+}
+
+template<class Mode, typename T>
+inline void paintShape( BrushShape shape, Matrix3D<T> &data, int x, int y, int z, int w, int h, int d, T value,
+                        const Mode &mode = Mode() )
+{
+    switch (shape)
+    {
+        case BrushPixel:        paintPixel( data, x, y, z, value, mode );               break;
+        case BrushCube:         paintCube( data, x, y, z, w, h, d, value, mode );       break;
+        case BrushEllipsoid:    paintEllipsoid( data, x, y, z, w, h, d, value, mode );  break;
+    }
+}
+
+template<class Mode, typename T>
+inline void paintShapeStroke( BrushShape shape, Matrix3D<T> &data, int x0, int y0, int z0, int x1, int y1, int z1,
+                              int w, int h, int d, T value, const Mode &mode = Mode() )
+{
+    switch (shape)
+    {
+        case BrushPixel:        paintPixelStroke( data, x0, y0, z0, x1, y1, z1, value, mode );                 break;
+        case BrushCube:         paintCubeStroke( data, x0, y0, z0, x1, y1, z1, w, h, d, value, mode );         break;
+        case BrushEllipsoid:    paintEllipsoidStroke( data, x0, y0, z0, x1, y1, z1, w, h, d, value, mode );    break;
+    }
+}
+
+// stamps a brush of half extents w, h, d (unused by BrushPixel) centered at (x, y, z).
+//  If constraints are given and active, only the voxels that satisfy them are written
+template<typename T>
+inline void paint( BrushShape shape, BrushWriteMode mode, Matrix3D<T> &data, int x, int y, int z, int w, int h, int d, T value,
+                   const BrushConstraints *constraints = 0 )
+{
+    if ( (constraints != 0) && constraints->active() )
+    {
+        paintShape( shape, data, x, y, z, w, h, d, (mode == BrushWriteErase) ? T(0) : value, WriteConstrained( *constraints, mode ) );
+        return;
+    }
+
+    switch (mode)
+    {
+        case BrushWriteSet:         paintShape<WriteSet>( shape, data, x, y, z, w, h, d, value );          break;
+        case BrushWriteErase:       paintShape<WriteErase>( shape, data, x, y, z, w, h, d, value );        break;
+        case BrushWriteMax:         paintShape<WriteMax>( shape, data, x, y, z, w, h, d, value );          break;
+        case BrushWriteUnlabelled:  paintShape<WriteUnlabelled>( shape, data, x, y, z, w, h, d, value );   break;
+    }
+}
+
+// paints the volume swept by the brush moved from (x0, y0, z0) to (x1, y1, z1)
+template<typename T>
+inline void paintStroke( BrushShape shape, BrushWriteMode mode, Matrix3D<T> &data, int x0, int y0, int z0, int x1, int y1, int z1,
+                         int w, int h, int d, T value, const BrushConstraints *constraints = 0 )
+{
+    if ( (constraints != 0) && constraints->active() )
+    {
+        paintShapeStroke( shape, data, x0, y0, z0, x1, y1, z1, w, h, d, (mode == BrushWriteErase) ? T(0) : value,
+                          WriteConstrained( *constraints, mode ) );
+        return;
+    }
+
+    switch (mode)
+    {
+        case BrushWriteSet:         paintShapeStroke<WriteSet>( shape, data, x0, y0, z0, x1, y1, z1, w, h, d, value );         break;
+        case BrushWriteErase:       paintShapeStroke<WriteErase>( shape, data, x0, y0, z0, x1, y1, z1, w, h, d, value );       break;
+        case BrushWriteMax:         paintShapeStroke<WriteMax>( shape, data, x0, y0, z0, x1, y1, z1, w, h, d, value );         break;
+        case BrushWriteUnlabelled:  paintShapeStroke<WriteUnlabelled>( shape, data, x0, y0, z0, x1, y1, z1, w, h, d, value );  break;
+    }
+}
+
+}
+
+#endif // BRUSHKERNELS_H
@@ -0,0 +1,155 @@
+#ifndef BRUSHSTROKE_H
+#define BRUSHSTROKE_H
+
+/**
+ * Brush stroke being dragged over the volume. The positions the mouse goes
+ * through are queued and painted in batches (e.g. once per render), as the
+ * volume swept by the brush between consecutive positions, so that fast drags
+ * leave no gaps and a batch of mouse events is painted and redrawn only once.
+ */
+#include "brush.h"
+#include <vector>
+#include <algorithm>
+
+// inclusive bounding box of the voxels painted by a batch
+struct StrokeBounds
+{
+    bool valid;
+    int  x0, y0, z0;
+    int  x1, y1, z1;
+
+    StrokeBounds() : valid(false), x0(0), y0(0), z0(0), x1(-1), y1(-1), z1(-1) { }
+
+    void unite( int bx0, int by0, int bz0, int bx1, int by1, int bz1 )
+    {
+        if (!valid) {
+            x0 = bx0;   y0 = by0;   z0 = bz0;
+            x1 = bx1;   y1 = by1;   z1 = bz1;
+            valid = true;
+            return;
+        }
+
+        x0 = std::min( x0, bx0 );   y0 = std::min( y0, by0 );   z0 = std::min( z0, bz0 );
+        x1 = std::max( x1, bx1 );   y1 = std::max( y1, by1 );   z1 = std::max( z1, bz1 );
+    }
+};
+
+class BrushStroke
+{
+private:
+    struct Point
+    {
+        int x, y, z;
+        Point( int px, int py, int pz ) : x(px), y(py), z(pz) { }
+        bool operator == ( const Point &p ) const { return (x == p.x) && (y == p.y) && (z == p.z); }
+    };
+
+    Matrix3D<LabelType> *mData;
+    SizedBrush          *mBrush;
+    LabelType            mLabel;
+
+    std::vector<Point>   mPoints;   // mPoints[0] is the last painted position if mStarted, queued ones follow
+    bool                 mStarted;  // something was painted already
+
+public:
+    BrushStroke() : mData(0), mBrush(0), mLabel(0), mStarted(false) { }
+
+    inline bool active() const { return mData != 0; }
+
+    // true if the stroke paints label on data with brush
+    inline bool paints( const Matrix3D<LabelType> *data, const SizedBrush *brush, LabelType label ) const
+    {
+        return (mData == data) && (mBrush == brush) && (mLabel == label);
+    }
+
+    // starts a new stroke, anything queued of the previous one is dropped (paint it first)
+    void begin( Matrix3D<LabelType> *data, SizedBrush *brush, LabelType label )
+    {
+        mData = data;
+        mBrush = brush;
+        mLabel = label;
+
+        mPoints.clear();
+        mStarted = false;
+    }
+
+    void end()
+    {
+        mData = 0;
+        mBrush = 0;
+        mPoints.clear();
+        mStarted = false;
+    }
+
+    // queues the next position of the brush center
+    void moveTo( int x, int y, int z )
+    {
+        if ( !active() )
+            return;
+
+        const Point p( x, y, z );
+        if ( !mPoints.empty() && (mPoints.back() == p) )
+            return;
+
+        mPoints.push_back( p );
+    }
+
+    inline bool hasPending() const { return mPoints.size() > (mStarted ? 1 : 0); }
+
+    // volume painted
+    inline Matrix3D<LabelType> *data() const { return mData; }
+
+    // box that paintPending() may change (not clipped to the volume)
+    StrokeBounds pendingBounds() const
+    {
+        StrokeBounds bounds;
+        if ( !hasPending() )
+            return bounds;
+
+        if (!mStarted)
+            addBounds( bounds, mPoints[0], mPoints[0] );
+
+        for (unsigned int i=1; i < mPoints.size(); i++)
+            addBounds( bounds, mPoints[i-1], mPoints[i] );
+
+        return bounds;
+    }
+
+    // paints the queued positions, returns the box that may have changed (not clipped to the volume)
+    StrokeBounds paintPending()
+    {
+        const StrokeBounds bounds = pendingBounds();
+        if ( !bounds.valid )
+            return bounds;
+
+        if (!mStarted)
+        {
+            const Point &p = mPoints[0];
+            mBrush->paint( *mData, p.x, p.y, p.z, mLabel );
+            mStarted = true;
+        }
+
+        for (unsigned int i=1; i < mPoints.size(); i++)
+        {
+            const Point &a = mPoints[i-1];
+            const Point &b = mPoints[i];
+
+            mBrush->paintStroke( *mData, a.x, a.y, a.z, b.x, b.y, b.z, mLabel );
+        }
+
+        // the next batch goes on from the last position
+        mPoints.erase( mPoints.begin(), mPoints.end() - 1 );
+
+        return bounds;
+    }
+
+private:
+    // brushes cover [c - width, c + width) x [c - height, c + height) x [c - depth, c + depth)
+    void addBounds( StrokeBounds &bounds, const Point &a, const Point &b ) const
+    {
+        bounds.unite( std::min( a.x, b.x ) - mBrush->width,  std::min( a.y, b.y ) - mBrush->height, std::min( a.z, b.z ) - mBrush->depth,
+                      std::max( a.x, b.x ) + mBrush->width - 1, std::max( a.y, b.y ) + mBrush->height - 1, std::max( a.z, b.z ) + mBrush->depth - 1 );
+    }
+};
+
+#endif // BRUSHSTROKE_H
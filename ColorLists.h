@@ -13,6 +13,9 @@ private:
     std::vector<QIcon> iconList;
     const int iconSize;
 
+    mutable QRgb paletteLUT[256];
+    mutable bool paletteValid;
+
     inline QPixmap createIcon( const QColor &c ) {
         QPixmap icon( iconSize, iconSize );
         icon.fill( c );
@@ -25,17 +28,19 @@ private:
     }
 
 public:
-    ColorListBase() : iconSize(32) { }
+    ColorListBase() : iconSize(32), paletteValid(false) { }
 
     inline void addColor( const QColor &c ) {
         colorList.push_back( c );
         iconList.push_back( createIcon(c) );
+        paletteValid = false;
     }
 
     inline void replaceColor( unsigned int idx, const QColor &c )
     {
         colorList.at(idx) = c;
         updateIcon(idx);
+        paletteValid = false;
     }
 
     inline const QColor& getColor(unsigned int idx) const {
@@ -47,6 +52,22 @@ public:
     }
 
     inline unsigned int count() const { return colorList.size(); }
+
+    // 256 colors indexed by label: label i has color i-1, unlabeled (0) and labels
+    //  without a color are transparent. Rebuilt only when the colors change
+    inline const QRgb *palette() const
+    {
+        if (!paletteValid)
+        {
+            paletteLUT[0] = qRgba( 0, 0, 0, 0 );
+            for (unsigned int i=1; i < 256; i++)
+                paletteLUT[i] = (i <= count()) ? colorList[i-1].rgb() : qRgba( 0, 0, 0, 0 );
+
+            paletteValid = true;
+        }
+
+        return paletteLUT;
+    }
 };
 
 struct LabelColorList : public ColorListBase
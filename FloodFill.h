@@ -0,0 +1,216 @@
+#ifndef FLOODFILL_H
+#define FLOODFILL_H
+
+/**
+ * 3D scanline flood fill: the connected region of voxels whose value is in
+ * [minVal, maxVal], from a seed voxel. The region is grown as maximal runs
+ * along x, kept on a stack; every run popped scans the rows next to it
+ * (y +- 1 and z +- 1, and the diagonal rows with 26-connectivity) for new runs.
+ * Visited voxels are bits of a BitVolume, which holds the region when done,
+ * so no per-voxel lists or maps are built. fillRegion() then writes it.
+ */
+#include "Matrix3D.h"
+#include "BitVolume.h"
+
+#include <vector>
+#include <algorithm>
+
+struct FloodFillResult
+{
+    unsigned int count;         // voxels in the region
+    bool         truncated;     // stopped at maxVoxels, the region may be larger
+    bool         canceled;      // the progress callback stopped it
+
+    int x0, y0, z0;             // inclusive bounding box of the region, if count > 0
+    int x1, y1, z1;
+
+    FloodFillResult() : count(0), truncated(false), canceled(false), x0(0), y0(0), z0(0), x1(-1), y1(-1), z1(-1) { }
+};
+
+// progress callback that never cancels
+struct FloodFillNoProgress
+{
+    inline bool operator()( unsigned int /*count*/ ) { return true; }
+};
+
+// run of the flood fill, maximal along x
+struct FloodFillRun
+{
+    int x0, x1, y, z;
+    FloodFillRun( int rx0, int rx1, int ry, int rz ) : x0(rx0), x1(rx1), y(ry), z(rz) { }
+};
+
+// extends the run from voxel x of row (y, z) (in the window, not visited) as far as the window goes,
+//  marks it in region, pushes it and returns its last voxel
+template<typename T>
+inline int floodFillAddRun( const Matrix3D<T> &img, int x, int y, int z, T minVal, T maxVal, BitVolume &region,
+                            std::vector<FloodFillRun> &stack, FloodFillResult &res )
+{
+    const int w = img.width();
+    const unsigned int rowIdx = img.coordToIdx( 0, y, z );
+    const T *row = img.data() + rowIdx;
+
+    int x0 = x;
+    while ( (x0 > 0) && (row[x0 - 1] >= minVal) && (row[x0 - 1] <= maxVal) && !region.test( rowIdx + x0 - 1 ) )
+        x0--;
+
+    int x1 = x;
+    while ( (x1 + 1 < w) && (row[x1 + 1] >= minVal) && (row[x1 + 1] <= maxVal) && !region.test( rowIdx + x1 + 1 ) )
+        x1++;
+
+    region.setRange( rowIdx + x0, rowIdx + x1 );
+    stack.push_back( FloodFillRun( x0, x1, y, z ) );
+
+    if (res.count == 0) {
+        res.x0 = x0;    res.y0 = res.y1 = y;    res.z0 = res.z1 = z;
+        res.x1 = x1;
+    } else {
+        res.x0 = std::min( res.x0, x0 );    res.x1 = std::max( res.x1, x1 );
+        res.y0 = std::min( res.y0, y );     res.y1 = std::max( res.y1, y );
+        res.z0 = std::min( res.z0, z );     res.z1 = std::max( res.z1, z );
+    }
+    res.count += x1 - x0 + 1;
+
+    return x1;
+}
+
+// region of voxels of img with values in [minVal, maxVal] connected to (x, y, z), set in 'region'
+//  (cleared first). It stops once at least maxVoxels are found. progress( count ) is called every
+//  progressStep voxels, and the fill is canceled if it returns false
+template<typename T, class Progress>
+FloodFillResult floodFill( const Matrix3D<T> &img, int x, int y, int z, T minVal, T maxVal, bool connect26,
+                           unsigned int maxVoxels, BitVolume &region, Progress &progress,
+                           unsigned int progressStep = 1 << 20 )
+{
+    FloodFillResult res;
+
+    if ( !region.isSizeLike( img ) )
+        region.reallocSizeLike( img );
+    else
+        region.clear();
+
+    const int w = img.width(), h = img.height(), d = img.depth();
+    if ( (x < 0) || (y < 0) || (z < 0) || (x >= w) || (y >= h) || (z >= d) )
+        return res;
+
+    const T seedVal = img.data()[ img.coordToIdx( x, y, z ) ];
+    if ( (seedVal < minVal) || (seedVal > maxVal) )
+        return res;
+
+    // rows (dy, dz) next to a run, and how far past its ends they touch it along x
+    int numNeighbors = 0;
+    int nbDy[8], nbDz[8];
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            if ( (dy == 0) && (dz == 0) )
+                continue;
+            if ( !connect26 && (dy != 0) && (dz != 0) )
+                continue;
+
+            nbDy[numNeighbors] = dy;
+            nbDz[numNeighbors] = dz;
+            numNeighbors++;
+        }
+    const int reach = connect26 ? 1 : 0;
+
+    std::vector<FloodFillRun> stack;
+    floodFillAddRun( img, x, y, z, minVal, maxVal, region, stack, res );
+
+    unsigned int nextProgress = progressStep;
+
+    while ( !stack.empty() )
+    {
+        const FloodFillRun cur = stack.back();
+        stack.pop_back();
+
+        for (int n=0; n < numNeighbors; n++)
+        {
+            const int ny = cur.y + nbDy[n];
+            const int nz = cur.z + nbDz[n];
+            if ( (ny < 0) || (nz < 0) || (ny >= h) || (nz >= d) )
+                continue;
+
+            // visited voxels are skipped a word at a time, most of the rows are by the time they are scanned
+            const unsigned int rowIdx = img.coordToIdx( 0, ny, nz );
+            const T *data = img.data();
+            const unsigned int scanEnd = rowIdx + std::min( cur.x1 + reach, w - 1 ) + 1;
+
+            for (unsigned int i = region.nextClear( rowIdx + std::max( cur.x0 - reach, 0 ), scanEnd ); i < scanEnd;
+                 i = region.nextClear( i, scanEnd ))
+            {
+                if ( (data[i] < minVal) || (data[i] > maxVal) ) {
+                    i++;
+                    continue;
+                }
+
+                // the voxel after the run is outside the window or visited
+                i = rowIdx + floodFillAddRun( img, i - rowIdx, ny, nz, minVal, maxVal, region, stack, res ) + 2;
+
+                if ( res.count >= maxVoxels ) {
+                    res.truncated = true;
+                    return res;
+                }
+            }
+        }
+
+        if ( res.count >= nextProgress )
+        {
+            nextProgress = res.count + progressStep;
+            if ( !progress( res.count ) ) {
+                res.canceled = true;
+                return res;
+            }
+        }
+    }
+
+    return res;
+}
+
+template<typename T>
+inline FloodFillResult floodFill( const Matrix3D<T> &img, int x, int y, int z, T minVal, T maxVal, bool connect26,
+                                  unsigned int maxVoxels, BitVolume &region )
+{
+    FloodFillNoProgress progress;
+    return floodFill( img, x, y, z, minVal, maxVal, connect26, maxVoxels, region, progress );
+}
+
+// write mode that sets every voxel of a span, same interface as the BrushKernels write modes
+struct FloodFillWrite
+{
+    template<typename T>
+    inline void row( T *p, unsigned int, unsigned int n, T value ) const { std::fill( p, p + n, value ); }
+};
+
+// writes value to the voxels of data set in region, inside the bounding box of res. Runs of set bits
+//  are found a word at a time and written as spans with mode.row( ptr, index, length, value ), so a
+//  BrushKernels::WriteConstrained applies the brush constraints to the fill
+template<typename T, class Mode>
+void fillRegion( Matrix3D<T> &data, const BitVolume &region, const FloodFillResult &res, T value, const Mode &mode )
+{
+    if ( (res.count == 0) || !region.isSizeLike( data ) )
+        return;
+
+    for (int z = res.z0; z <= res.z1; z++)
+        for (int y = res.y0; y <= res.y1; y++)
+        {
+            const unsigned int rowIdx = data.coordToIdx( 0, y, z );
+            const unsigned int end = rowIdx + res.x1 + 1;
+
+            unsigned int i = region.nextSet( rowIdx + res.x0, end );
+            while (i < end)
+            {
+                const unsigned int runEnd = region.nextClear( i, end );
+                mode.row( data.data() + i, i, runEnd - i, value );
+                i = region.nextSet( runEnd, end );
+            }
+        }
+}
+
+template<typename T>
+inline void fillRegion( Matrix3D<T> &data, const BitVolume &region, const FloodFillResult &res, T value )
+{
+    fillRegion( data, region, res, value, FloodFillWrite() );
+}
+
+#endif // FLOODFILL_H
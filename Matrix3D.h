@@ -12,6 +12,8 @@
 #include <itkLabelImageToShapeLabelMapFilter.h>
 #include "ShapeStatistics.h"
 #include <vector>
+#include <algorithm>
+#include <cstring>
 
 #ifdef QT_VERSION_STR
     #include <QImage>
@@ -216,6 +218,19 @@ public:
         memcpy( mData, other.data(), sizeof(T) * numElem() );
     }
 
+    // exchanges data and size with other, nothing is copied
+    void swap( Matrix3D<T> &other )
+    {
+        std::swap( mData, other.mData );
+        std::swap( mWidth, other.mWidth );
+        std::swap( mHeight, other.mHeight );
+        std::swap( mDepth, other.mDepth );
+        std::swap( mKeepOnDestr, other.mKeepOnDestr );
+
+        updateCache();
+        other.updateCache();
+    }
+
     // sets every element to have value 'val'
     inline void fill( T val ) {
         for (unsigned int i=0; i < mNumElem; i++)
@@ -484,6 +499,49 @@ public:
         return mData + z*mWidth*mHeight;
     }
 
+    // slice of any orientation: axes are 0 = x, 1 = y, 2 = z. The slice at 'pos' along the
+    //  remaining axis is copied to dest, whose rows go along vAxis and hold destStride elements along uAxis.
+    //  Only the region [u0, u0+uw) x [v0, v0+vh) is copied.
+    //  If u is not x the volume is read with a stride, so it is copied in tiles that fit in cache
+    void extractSlice( unsigned int uAxis, unsigned int vAxis, unsigned int pos, T *dest, unsigned int destStride,
+                       unsigned int u0, unsigned int v0, unsigned int uw, unsigned int vh ) const
+    {
+        const size_t stride[3] = { 1, mWidth, (size_t)mWidth * mHeight };
+        const unsigned int nAxis = 3 - uAxis - vAxis;
+
+        const size_t su = stride[uAxis];
+        const size_t sv = stride[vAxis];
+        const T *src = mData + pos * stride[nAxis];
+
+        if (su == 1)
+        {
+            for (unsigned int v = v0; v < v0 + vh; v++)
+                memcpy( dest + v * destStride + u0, src + v * sv + u0, uw * sizeof(T) );
+            return;
+        }
+
+        const unsigned int tile = 64;
+        for (unsigned int vb = v0; vb < v0 + vh; vb += tile)
+        {
+            const unsigned int vEnd = std::min( vb + tile, v0 + vh );
+
+            for (unsigned int ub = u0; ub < u0 + uw; ub += tile)
+            {
+                const unsigned int uEnd = std::min( ub + tile, u0 + uw );
+
+                // columns of the tile: reads go along v, which is the smaller stride for YZ
+                for (unsigned int u = ub; u < uEnd; u++)
+                {
+                    const T *s = src + u * su + vb * sv;
+                    T *d = dest + vb * destStride + u;
+
+                    for (unsigned int v = vb; v < vEnd; v++, s += sv, d += destStride)
+                        *d = *s;
+                }
+            }
+        }
+    }
+
 #ifdef QT_VERSION_STR
     // sliceCoord 0..2
     inline void QImageSlice( unsigned int z, QImage &qimg ) const
@@ -3,78 +3,54 @@
 
 #include <QColor>
 
-// takes a slice of total size numElem in contiguous memory
-//  and creates a mask with an overlay, according to the given color
-// destImg can be equal to baseImg
-static inline void overlayRGB( const unsigned int *baseImg, const unsigned char *overlayImg, unsigned int *destImg, unsigned int numElem, const QColor &color, float alpha = 0.5 )
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+// blends a contiguous run of RGB32 pixels with a constant color:
+//  dest = dest * (0.99 - opacity) + color * opacity
+// (same as the former per-pixel QColor highlight), in 8-bit fixed point
+static inline void blendSpanRGB( unsigned int *pix, unsigned int numElem, const QColor &color, float opacity = 0.6 )
 {
-    qreal sR, sG, sB;
-    color.getRgbF( &sR, &sG,&sB );
-    sR *= 255;
-    sG *= 255;
-    sB *= 255;
+    const unsigned int wColor = (unsigned int)(opacity * 256 + 0.5);
+    const unsigned int wBase  = (unsigned int)((0.99 - opacity) * 256 + 0.5);
 
-    const qreal div255 = 1.0 / 255.0;
+    // color contribution, already weighted (+128 for rounding)
+    const unsigned int cR = color.red() * wColor + 128;
+    const unsigned int cG = color.green() * wColor + 128;
+    const unsigned int cB = color.blue() * wColor + 128;
 
-    for (unsigned int i=0; i < numElem; i++)
-    {
-        qreal r = (baseImg[i] >> 16) & 0xFF;
-        qreal g = (baseImg[i] >> 8)  & 0xFF;
-        qreal b = (baseImg[i] >> 0)  & 0xFF;
-
-        qreal sc = overlayImg[i] * div255;
-        qreal scInv = 1.0 - sc;
-
-        g = g*(1-alpha) + (scInv*g + sc*sG)*alpha;
-        b = b*(1-alpha) + (scInv*b + sc*sB)*alpha;
-        r = r*(1-alpha) + (scInv*r + sc*sR)*alpha;
-
-        unsigned int iR = r;
-        unsigned int iG = g;
-        unsigned int iB = b;
-
-        //pixPtr[i] = (pixPtr[i] & 0xFF00FFFF) | (((unsigned int) scorePtr[i]) << 16);
-        destImg[i] = 0xFF000000 | (iR<<16) | (iG<<8) | iB;
-    }
-}
-
-static inline void overlayRGBThresholded( const unsigned int *baseImg, const unsigned char *overlayImg, unsigned int *destImg, unsigned int numElem, const QColor &color,
-                                          unsigned char minThr, unsigned char maxThr, bool hardThreshold)
-{
-    qreal sR, sG, sB;
-    color.getRgbF( &sR, &sG,&sB );
-    sR *= 255;
-    sG *= 255;
-    sB *= 255;
+    unsigned int i=0;
 
-    const qreal div255 = 1.0 / 255.0;
+#ifdef __SSE2__
+    // 4 pixels per iteration, channels as 16-bit lanes: 255*254 fits in 16 bits
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wB = _mm_set1_epi16( wBase );
+    const __m128i cW = _mm_set_epi16( 0, cR, cG, cB, 0, cR, cG, cB );
+    const __m128i alpha = _mm_set1_epi32( 0xFF000000 );
 
-    for (unsigned int i=0; i < numElem; i++)
+    for (; i + 4 <= numElem; i += 4)
     {
-        qreal r = (baseImg[i] >> 16) & 0xFF;
-        qreal g = (baseImg[i] >> 8) & 0xFF;
-        qreal b = (baseImg[i] >> 0) & 0xFF;
+        __m128i p = _mm_loadu_si128( (const __m128i *)(pix + i) );
 
-        unsigned char overlayVal = overlayImg[i];
-        if (overlayVal < minThr || overlayVal > maxThr)
-            overlayVal = 0;
+        __m128i lo = _mm_unpacklo_epi8( p, zero );
+        __m128i hi = _mm_unpackhi_epi8( p, zero );
 
-        if (hardThreshold && (overlayVal > 0))
-            overlayVal = 255;
+        lo = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( lo, wB ), cW ), 8 );
+        hi = _mm_srli_epi16( _mm_add_epi16( _mm_mullo_epi16( hi, wB ), cW ), 8 );
 
-        qreal sc = overlayVal * div255;
-        qreal scInv = 1.0 - sc;
-
-        g = scInv*g + sc*sG;
-        b = scInv*b + sc*sB;
-        r = r * scInv +  sc*sR;
+        _mm_storeu_si128( (__m128i *)(pix + i), _mm_or_si128( _mm_packus_epi16( lo, hi ), alpha ) );
+    }
+#endif
 
-        unsigned int iR = r;
-        unsigned int iG = g;
-        unsigned int iB = b;
+    for (; i < numElem; i++)
+    {
+        const unsigned int p = pix[i];
+        const unsigned int r = (((p >> 16) & 0xFF) * wBase + cR) >> 8;
+        const unsigned int g = (((p >> 8)  & 0xFF) * wBase + cG) >> 8;
+        const unsigned int b = (((p >> 0)  & 0xFF) * wBase + cB) >> 8;
 
-        //pixPtr[i] = (pixPtr[i] & 0xFF00FFFF) | (((unsigned int) scorePtr[i]) << 16);
-        destImg[i] = 0xFF000000 | (iR<<16) | (iG<<8) | iB;
+        pix[i] = 0xFF000000 | (r<<16) | (g<<8) | b;
     }
 }
 
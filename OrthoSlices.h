@@ -0,0 +1,146 @@
+#ifndef ORTHOSLICES_H
+#define ORTHOSLICES_H
+
+#include <vector>
+#include <map>
+
+#include <QRect>
+
+#include "Matrix3D.h"
+
+enum SliceOrientation { SliceXY = 0, SliceXZ = 1, SliceYZ = 2 };
+
+/**
+ ** Axes of a displayed slice: (u, v) are the horizontal and vertical axes of the slice,
+ *  n is the axis the slice position goes along. Axes are 0 = x, 1 = y, 2 = z.
+ *   XY: u = x, v = y, n = z
+ *   XZ: u = x, v = z, n = y
+ *   YZ: u = z, v = y, n = x    (y stays vertical, as in the XY view)
+ */
+struct SliceAxes
+{
+    SliceOrientation orientation;
+    unsigned int uAxis, vAxis, nAxis;
+
+    SliceAxes( SliceOrientation o = SliceXY )
+    {
+        orientation = o;
+        switch (o)
+        {
+            case SliceXZ:   uAxis = 0; vAxis = 2; nAxis = 1; break;
+            case SliceYZ:   uAxis = 2; vAxis = 1; nAxis = 0; break;
+            default:        uAxis = 0; vAxis = 1; nAxis = 2; break;
+        }
+    }
+
+    // slice coordinates (u,v) of the slice at position n -> volume coordinates
+    inline void toVolume( int u, int v, int n, int &x, int &y, int &z ) const
+    {
+        int c[3];
+        c[uAxis] = u;
+        c[vAxis] = v;
+        c[nAxis] = n;
+
+        x = c[0]; y = c[1]; z = c[2];
+    }
+
+    inline void toSlice( int x, int y, int z, int &u, int &v, int &n ) const
+    {
+        const int c[3] = { x, y, z };
+
+        u = c[uAxis];
+        v = c[vAxis];
+        n = c[nAxis];
+    }
+
+    // sizes of the slice / number of slices for a volume of w x h x d
+    inline unsigned int sliceWidth( unsigned int w, unsigned int h, unsigned int d ) const
+    {
+        const unsigned int s[3] = { w, h, d };
+        return s[uAxis];
+    }
+
+    inline unsigned int sliceHeight( unsigned int w, unsigned int h, unsigned int d ) const
+    {
+        const unsigned int s[3] = { w, h, d };
+        return s[vAxis];
+    }
+
+    inline unsigned int numSlices( unsigned int w, unsigned int h, unsigned int d ) const
+    {
+        const unsigned int s[3] = { w, h, d };
+        return s[nAxis];
+    }
+};
+
+/**
+ ** Slices of other orientations than XY, which are not contiguous in memory, extracted
+ *  from any number of volumes. Every volume keeps the last slice extracted from it,
+ *  which is reused until the position changes or it is invalidated.
+ */
+template<typename T>
+class OrthoSliceCache
+{
+private:
+    struct Entry
+    {
+        SliceOrientation orientation;
+        unsigned int     pos;
+        bool             valid;
+        QRect            dirty;     // area to extract again, if valid
+        std::vector<T>   data;
+
+        Entry() : orientation(SliceXY), pos(0), valid(false) { }
+    };
+
+    std::map<const Matrix3D<T> *, Entry> mEntries;
+
+public:
+    // slice of 'vol' at position pos, as sliceWidth x sliceHeight elements
+    const T *slice( const Matrix3D<T> &vol, const SliceAxes &axes, unsigned int pos )
+    {
+        const unsigned int sw = axes.sliceWidth( vol.width(), vol.height(), vol.depth() );
+        const unsigned int sh = axes.sliceHeight( vol.width(), vol.height(), vol.depth() );
+
+        Entry &e = mEntries[ &vol ];
+
+        if ( !e.valid || (e.orientation != axes.orientation) || (e.pos != pos) || (e.data.size() != sw * sh) )
+        {
+            e.data.resize( sw * sh );
+            vol.extractSlice( axes.uAxis, axes.vAxis, pos, &e.data[0], sw, 0, 0, sw, sh );
+
+            e.orientation = axes.orientation;
+            e.pos = pos;
+            e.valid = true;
+            e.dirty = QRect();
+        }
+        else if ( !e.dirty.isEmpty() )
+        {
+            const QRect r = e.dirty.intersected( QRect(0, 0, sw, sh) );
+            if ( !r.isEmpty() )
+                vol.extractSlice( axes.uAxis, axes.vAxis, pos, &e.data[0], sw, r.left(), r.top(), r.width(), r.height() );
+
+            e.dirty = QRect();
+        }
+
+        return &e.data[0];
+    }
+
+    // the volumes changed
+    void invalidate()
+    {
+        typename std::map<const Matrix3D<T> *, Entry>::iterator it;
+        for (it = mEntries.begin(); it != mEntries.end(); ++it)
+            it->second.valid = false;
+    }
+
+    // the volumes changed only inside rect (in slice coordinates)
+    void invalidate( const QRect &rect )
+    {
+        typename std::map<const Matrix3D<T> *, Entry>::iterator it;
+        for (it = mEntries.begin(); it != mEntries.end(); ++it)
+            it->second.dirty |= rect;
+    }
+};
+
+#endif // ORTHOSLICES_H
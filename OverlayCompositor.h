@@ -0,0 +1,216 @@
+#ifndef OVERLAYCOMPOSITOR_H
+#define OVERLAYCOMPOSITOR_H
+
+#include <vector>
+#include <algorithm>
+
+#include <QRgb>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+/**
+ ** Blends any number of 8-bit overlays onto an RGB32 slice in a single pass.
+ *  Every layer has a 256-entry weight table built from its alpha and threshold
+ *  settings and a 256-entry table of colors premultiplied by those weights,
+ *  so per pixel and layer the blend is
+ *      dest = (dest * (256 - w) + premul + 128) >> 8,
+ *      w = weightLUT[overlay value], premul = color[overlay value] * w
+ *  Overlays have a single color, label slices a color per value (palette layers).
+ *  Layers are applied in the order they were added, as if they were blended
+ *  one after the other, but the slice is only read and written once.
+ */
+class OverlayCompositor
+{
+private:
+    struct Layer
+    {
+        const unsigned char *data;
+        unsigned short       rgb[3];            // color of single-color layers
+        unsigned short       weightLUT[256];    // 0..256
+        unsigned short       premulLUT[256][4]; // color * weight as b,g,r,0, laid out as an unpacked RGB32 pixel
+    };
+
+    // fills premulLUT from the weights and the color of every value
+    static void premultiply( Layer &layer, const QRgb *colors, unsigned int colorStep )
+    {
+        for (unsigned int v=0; v < 256; v++)
+        {
+            const QRgb c = colors[v * colorStep];
+            const unsigned short w = layer.weightLUT[v];
+
+            layer.premulLUT[v][0] = qBlue(c) * w;
+            layer.premulLUT[v][1] = qGreen(c) * w;
+            layer.premulLUT[v][2] = qRed(c) * w;
+            layer.premulLUT[v][3] = 0;
+        }
+    }
+
+    std::vector<Layer> mLayers;
+
+    // blends one pixel with all layers
+    inline unsigned int compositePixel( unsigned int pix, unsigned int i ) const
+    {
+        unsigned int r = (pix >> 16) & 0xFF;
+        unsigned int g = (pix >> 8)  & 0xFF;
+        unsigned int b = (pix >> 0)  & 0xFF;
+
+        for (unsigned int l=0; l < mLayers.size(); l++)
+        {
+            const Layer &layer = mLayers[l];
+            const unsigned char v = layer.data[i];
+            const unsigned int w = layer.weightLUT[v];
+            if (w == 0)
+                continue;
+
+            const unsigned int wInv = 256 - w;
+            r = (r * wInv + layer.premulLUT[v][2] + 128) >> 8;
+            g = (g * wInv + layer.premulLUT[v][1] + 128) >> 8;
+            b = (b * wInv + layer.premulLUT[v][0] + 128) >> 8;
+        }
+
+        return 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+
+public:
+    OverlayCompositor() { }
+
+    void clear() { mLayers.clear(); }
+
+    unsigned int numLayers() const { return mLayers.size(); }
+
+    // layer parameters, to blend the same layers elsewhere (e.g. in GLSliceView).
+    //  layerColor() is only meaningful for single-color layers
+    const unsigned char  *layerData( unsigned int l ) const    { return mLayers[l].data; }
+    const unsigned short *layerColor( unsigned int l ) const   { return mLayers[l].rgb; }
+    const unsigned short *layerWeights( unsigned int l ) const { return mLayers[l].weightLUT; }
+
+    // data: overlay slice, same size as the slice to composite
+    // alpha: opacity of the layer (0..1), applied on top of the overlay value
+    // values outside [minThr, maxThr] are transparent, if hardThreshold is true the others are fully opaque
+    void addLayer( const unsigned char *data, unsigned char r, unsigned char g, unsigned char b, float alpha = 0.5,
+                   unsigned char minThr = 0, unsigned char maxThr = 255, bool hardThreshold = false )
+    {
+        Layer layer;
+        layer.data = data;
+        layer.rgb[0] = r;
+        layer.rgb[1] = g;
+        layer.rgb[2] = b;
+
+        bool visible = false;
+        for (unsigned int v=0; v < 256; v++)
+        {
+            unsigned int val = v;
+            if ( (val < minThr) || (val > maxThr) )
+                val = 0;
+
+            if ( hardThreshold && (val > 0) )
+                val = 255;
+
+            layer.weightLUT[v] = (unsigned short)( alpha * val * (256.0f / 255.0f) + 0.5f );
+            if (layer.weightLUT[v] > 256)
+                layer.weightLUT[v] = 256;
+
+            visible = visible || (layer.weightLUT[v] != 0);
+        }
+
+        if (!visible)
+            return;
+
+        const QRgb color = qRgb( r, g, b );
+        premultiply( layer, &color, 0 );
+
+        mLayers.push_back( layer );
+    }
+
+    // data: label slice, same size as the slice to composite
+    // palette: 256 colors indexed by value, their alpha channel times alpha is the opacity
+    void addPaletteLayer( const unsigned char *data, const QRgb *palette, float alpha = 0.5 )
+    {
+        Layer layer;
+        layer.data = data;
+        layer.rgb[0] = layer.rgb[1] = layer.rgb[2] = 0;
+
+        bool visible = false;
+        for (unsigned int v=0; v < 256; v++)
+        {
+            layer.weightLUT[v] = (unsigned short)( alpha * qAlpha(palette[v]) * (256.0f / 255.0f) + 0.5f );
+            if (layer.weightLUT[v] > 256)
+                layer.weightLUT[v] = 256;
+
+            visible = visible || (layer.weightLUT[v] != 0);
+        }
+
+        if (!visible)
+            return;
+
+        premultiply( layer, palette, 1 );
+
+        mLayers.push_back( layer );
+    }
+
+    // base and dest may be the same. dataOffset is the position of base[0] in the layers,
+    //  to composite only part of a slice (e.g. a row segment)
+    void composite( const unsigned int *base, unsigned int *dest, unsigned int numElem, unsigned int dataOffset = 0 ) const
+    {
+        if ( mLayers.empty() )
+        {
+            if (base != dest)
+                std::copy( base, base + numElem, dest );
+            return;
+        }
+
+        unsigned int i=0;
+
+#ifdef __SSE2__
+        // 4 pixels per iteration: two registers with 2 pixels each, channels as 16-bit lanes.
+        //  Weights are at most 256, so channel * weight sums stay within 16 bits
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i w256 = _mm_set1_epi16( 256 );
+        const __m128i round = _mm_set1_epi16( 128 );
+        const __m128i alpha = _mm_set1_epi32( 0xFF000000 );
+
+        for (; i + 4 <= numElem; i += 4)
+        {
+            const __m128i p = _mm_loadu_si128( (const __m128i *)(base + i) );
+
+            __m128i lo = _mm_unpacklo_epi8( p, zero );
+            __m128i hi = _mm_unpackhi_epi8( p, zero );
+
+            for (unsigned int l=0; l < mLayers.size(); l++)
+            {
+                const Layer &layer = mLayers[l];
+                const unsigned short *lut = layer.weightLUT;
+                const unsigned char *ov = layer.data + dataOffset + i;
+
+                const unsigned short w0 = lut[ov[0]], w1 = lut[ov[1]], w2 = lut[ov[2]], w3 = lut[ov[3]];
+                if ( (w0 | w1 | w2 | w3) == 0 )
+                    continue;   // overlays are mostly empty
+
+                const __m128i wLo = _mm_set_epi16( w1, w1, w1, w1, w0, w0, w0, w0 );
+                const __m128i wHi = _mm_set_epi16( w3, w3, w3, w3, w2, w2, w2, w2 );
+
+                // gather the premultiplied colors, one unpacked pixel (64 bits) per overlay value
+                const __m128i cLo = _mm_unpacklo_epi64( _mm_loadl_epi64( (const __m128i *) layer.premulLUT[ov[0]] ),
+                                                        _mm_loadl_epi64( (const __m128i *) layer.premulLUT[ov[1]] ) );
+                const __m128i cHi = _mm_unpacklo_epi64( _mm_loadl_epi64( (const __m128i *) layer.premulLUT[ov[2]] ),
+                                                        _mm_loadl_epi64( (const __m128i *) layer.premulLUT[ov[3]] ) );
+
+                lo = _mm_mullo_epi16( lo, _mm_sub_epi16( w256, wLo ) );
+                hi = _mm_mullo_epi16( hi, _mm_sub_epi16( w256, wHi ) );
+
+                lo = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( lo, cLo ), round ), 8 );
+                hi = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( hi, cHi ), round ), 8 );
+            }
+
+            _mm_storeu_si128( (__m128i *)(dest + i), _mm_or_si128( _mm_packus_epi16( lo, hi ), alpha ) );
+        }
+#endif
+
+        for (; i < numElem; i++)
+            dest[i] = compositePixel( base[i], dataOffset + i );
+    }
+};
+
+#endif // OVERLAYCOMPOSITOR_H
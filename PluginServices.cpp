@@ -25,6 +25,11 @@ Q_DECL_EXPORT void  PluginServices::updateDisplay() const
     mAnnWnd->pluginUpdateDisplay();
 }
 
+Q_DECL_EXPORT void  PluginServices::updateDisplay( int x0, int y0, int z0, int x1, int y1, int z1 ) const
+{
+    mAnnWnd->pluginUpdateDisplay( x0, y0, z0, x1, y1, z1 );
+}
+
 // menu to which plugins can add items and submenus
 //  and connect signals/slots to
 Q_DECL_EXPORT QMenu * PluginServices::getPluginMenu() const
@@ -66,6 +71,41 @@ Q_DECL_EXPORT void PluginServices::setOverlayVisible( unsigned int num, bool vis
     mAnnWnd->setOverlayVisible(num, visible);
 }
 
+Q_DECL_EXPORT void PluginServices::beginUndoStep( const QString &name ) const
+{
+    mAnnWnd->beginUndoStep( name );
+}
+
+Q_DECL_EXPORT void PluginServices::aboutToModifyLabels() const
+{
+    mAnnWnd->getUndoJournal().touch( &mAnnWnd->getLabelVoxelData() );
+}
+
+Q_DECL_EXPORT void PluginServices::aboutToModifyLabels( int x0, int y0, int z0, int x1, int y1, int z1 ) const
+{
+    mAnnWnd->getUndoJournal().touch( &mAnnWnd->getLabelVoxelData(), x0, y0, z0, x1, y1, z1 );
+}
+
+Q_DECL_EXPORT void PluginServices::aboutToModifyOverlay( unsigned int num ) const
+{
+    mAnnWnd->getUndoJournal().touch( &getOverlayVolumeData(num) );
+}
+
+Q_DECL_EXPORT void PluginServices::aboutToModifyOverlay( unsigned int num, int x0, int y0, int z0, int x1, int y1, int z1 ) const
+{
+    mAnnWnd->getUndoJournal().touch( &getOverlayVolumeData(num), x0, y0, z0, x1, y1, z1 );
+}
+
+Q_DECL_EXPORT void PluginServices::endUndoStep() const
+{
+    mAnnWnd->endUndoStep();
+}
+
+Q_DECL_EXPORT const Matrix3D<unsigned int> * PluginServices::getSupervoxelMap( unsigned int *numSupervoxels ) const
+{
+    return mAnnWnd->getGlobalSupervoxelMap( numSupervoxels );
+}
+
 // this is not exported because we call it inside the app
 PluginServices::PluginServices( const QString &pluginName, AnnotatorWnd *annWnd )
 {
@@ -23,9 +23,12 @@ public:
     Matrix3D<ScoreType> &  getScoreVoxelData() const;
     Matrix3D<LabelType> &  getLabelVoxelData() const;
 
-    // updates image display
+    // updates image display. Cheap to call often: redraws are coalesced to one per display refresh
     void  updateDisplay() const;
 
+    // same, when only labels/overlays inside the (inclusive) box were modified: only that part is composited again
+    void  updateDisplay( int x0, int y0, int z0, int x1, int y1, int z1 ) const;
+
     // menu to which plugins can add items and submenus
     //  and connect signals/slots to
     QMenu * getPluginMenu() const;
@@ -39,9 +42,23 @@ public:
     // returns a reference to a given overlay volume data
     Matrix3D<ScoreType> & getOverlayVolumeData( unsigned int num ) const;
 
-    // enables/disables the visualization of a given overlay
+    // enables/disables the visualization of a given overlay, no redraw if it does not change
     void setOverlayVisible( unsigned int num, bool visible ) const;
 
+    // undo: the changes a command makes to the label/overlay volumes between beginUndoStep()
+    //  and endUndoStep() are undone at once. Call the aboutToModify functions before writing
+    //  to a volume, with the (inclusive) box that will be written or nothing for the whole volume
+    void beginUndoStep( const QString &name ) const;
+    void aboutToModifyLabels() const;
+    void aboutToModifyLabels( int x0, int y0, int z0, int x1, int y1, int z1 ) const;
+    void aboutToModifyOverlay( unsigned int num ) const;
+    void aboutToModifyOverlay( unsigned int num, int x0, int y0, int z0, int x1, int y1, int z1 ) const;
+    void endUndoStep() const;
+
+    // returns the global supervoxel map (pixel -> supervoxel ID), or 0 if
+    //  no supervoxels covering the whole volume were computed/loaded
+    const Matrix3D<unsigned int> * getSupervoxelMap( unsigned int *numSupervoxels = 0 ) const;
+
     /** constructor only called by the main app **/
     PluginServices( const QString &pluginName, AnnotatorWnd *annWnd );
 };
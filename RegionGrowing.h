@@ -6,126 +6,80 @@
  */
 #include "Matrix3D.h"
 #include "SuperVoxeler.h"
-#include <map>
-#include <queue>
+#include "BitVolume.h"
 
-#include <QTime>
+#include <vector>
+#include <algorithm>
 
+// grows startPixels (6-connectivity) with the voxels of img in [minVal, maxVal], up to maxRegionSize
+//  voxels. pixListResult gets startPixels followed by the voxels added, in breadth-first order.
+//  Voxels are marked in 'visited' when they are added, so each is queued once. pixListResult itself
+//  is the queue, read from the front as it grows. 'visited' has to be clear (or empty) on entry,
+//  and it is left clear: only the bits that were set are reset, so it costs nothing per call.
 template<typename T>
-void RegionGrow( Matrix3D<T> &img, const PixelInfoList &startPixels, T minVal, T maxVal, unsigned int maxRegionSize, PixelInfoList *pixListResult )
+void RegionGrow( const Matrix3D<T> &img, const PixelInfoList &startPixels, T minVal, T maxVal, unsigned int maxRegionSize,
+                 PixelInfoList *pixListResult, BitVolume &visited )
 {
-    QTime Tm; Tm.start();
+    if ( !visited.isSizeLike( img ) )
+        visited.reallocSizeLike( img );
 
-    typedef std::map< unsigned int, PixelInfo >   MapType;
-    MapType  pixList;
+    PixelInfoList &region = *pixListResult;
+    region.clear();
+    region.reserve( std::max( std::min( (size_t)maxRegionSize, (size_t)img.numElem() ), startPixels.size() ) );
 
     for (unsigned int i=0; i < startPixels.size(); i++)
-        pixList[ startPixels[i].index ] = startPixels[i];
+    {
+        if ( visited.test( startPixels[i].index ) )
+            continue;
+
+        visited.set( startPixels[i].index );
+        region.push_back( startPixels[i] );
+    }
 
     const int iWidth  = img.width();
     const int iHeight = img.height();
     const int iDepth  = img.depth();
+    const T *data = img.data();
 
-#define ADD_NEIGHBOR( K, dx, dy, dz ) \
-    do {    \
-            int nx = (int)((K).x) + (int)(dx); \
-            int ny = (int)((K).y) + (int)(dy); \
-            int nz = (int)((K).z) + (int)(dz); \
-            if ( nx >= iWidth ) break; \
-            if ( ny >= iHeight ) break; \
-            if ( nz >= iDepth ) break; \
-            if ( nx < 0 ) break; \
-            if ( ny < 0 ) break; \
-            if ( nz < 0 ) break; \
-            unsigned int _idx = img.coordToIdx(nx,ny,nz); \
-            T _pixVal = img.data()[_idx];   \
-            if ( (_pixVal < minVal) || (_pixVal > maxVal) ) \
-                break; \
-            if ( pixList.count( _idx ) > 0 ) break; \
-            pixStack.push( PixelInfo( nx, ny, nz, _idx ) ); \
-    } while(0)
-
-#define ADD_6_NEIGHBORS( K )   \
-    ADD_NEIGHBOR(K, 1, 0, 0); \
-    ADD_NEIGHBOR(K,-1, 0, 0); \
-    ADD_NEIGHBOR(K, 0, 1, 0); \
-    ADD_NEIGHBOR(K, 0,-1, 0); \
-    ADD_NEIGHBOR(K, 0, 0, 1); \
-    ADD_NEIGHBOR(K, 0, 0,-1);
-
-#define ADD_12_NEIGHBORS( K )   \
-    ADD_6_NEIGHBORS(K); \
-    ADD_NEIGHBOR(K, 1, 1, 0); \
-    ADD_NEIGHBOR(K,-1, 1, 0); \
-    ADD_NEIGHBOR(K, 1,-1, 0); \
-    ADD_NEIGHBOR(K,-1,-1, 0); \
-    ADD_NEIGHBOR(K, 1, 0, 1); \
-    ADD_NEIGHBOR(K,-1, 0, 1); \
-    ADD_NEIGHBOR(K, 1, 0,-1); \
-    ADD_NEIGHBOR(K,-1, 0,-1); \
-    ADD_NEIGHBOR(K, 0, 1, 1); \
-    ADD_NEIGHBOR(K, 0,-1, 1); \
-    ADD_NEIGHBOR(K, 0, 1,-1); \
-    ADD_NEIGHBOR(K, 0,-1,-1); \
-    ADD_NEIGHBOR(K, 1, 1, 1); \
-    ADD_NEIGHBOR(K, 1,-1, 1); \
-    ADD_NEIGHBOR(K, 1, 1,-1); \
-    ADD_NEIGHBOR(K, 1,-1,-1); \
-    ADD_NEIGHBOR(K,-1, 1, 1); \
-    ADD_NEIGHBOR(K,-1,-1, 1); \
-    ADD_NEIGHBOR(K,-1, 1,-1); \
-    ADD_NEIGHBOR(K,-1,-1,-1);
-
-    // begin pixel stack with neighbors
-    std::queue< PixelInfo >  pixStack;
-    for (unsigned int i=0; i < startPixels.size(); i++)
-    {
-        ADD_6_NEIGHBORS( startPixels[i].coords );
-    }
-
-
-    qDebug() << "Elapsed: " << Tm.elapsed();
+    const int dx[6] = { 1, -1, 0,  0, 0,  0 };
+    const int dy[6] = { 0,  0, 1, -1, 0,  0 };
+    const int dz[6] = { 0,  0, 0,  0, 1, -1 };
 
-    // now begin, until the stack is empty
-    unsigned int Nn = 0;
-    while( !pixStack.empty() )
+    for (size_t head = 0; (head < region.size()) && (region.size() < maxRegionSize); head++)
     {
-        Nn++;
-
-        if ( (Nn % 5000) == 0 )
-            qDebug() << "Nn: " << Nn << " / " << pixList.size();
-
-        // copy and delete from stack
-        PixelInfo pix = pixStack.front();
-        pixStack.pop();
-
-        // check if it meets the constraints
-        //T pixVal = img.data()[pix.index];
-
-        //if ( (pixVal < minVal) || (pixVal > maxVal))
-            //continue;
-
-        // then add to list
-        pixList[ pix.index ] = pix;
-
-        if ( pixList.size() >= maxRegionSize )
-            break;
-
-        ADD_6_NEIGHBORS( pix.coords );
+        const int x = region[head].coords.x;
+        const int y = region[head].coords.y;
+        const int z = region[head].coords.z;
+
+        for (unsigned int n=0; n < 6; n++)
+        {
+            const int nx = x + dx[n], ny = y + dy[n], nz = z + dz[n];
+            if ( (nx < 0) || (ny < 0) || (nz < 0) || (nx >= iWidth) || (ny >= iHeight) || (nz >= iDepth) )
+                continue;
+
+            const unsigned int idx = img.coordToIdx( nx, ny, nz );
+            if ( (data[idx] < minVal) || (data[idx] > maxVal) || visited.test( idx ) )
+                continue;
+
+            visited.set( idx );
+            region.push_back( PixelInfo( nx, ny, nz, idx ) );
+
+            if ( region.size() >= maxRegionSize )
+                break;
+        }
     }
 
-    qDebug() << "Elapsed2: " << Tm.elapsed();
-    qDebug() << "N: " << Nn;
-
-    // put  back in pixListResult
-    MapType::const_iterator iter;
-    pixListResult->clear();
-    for (iter = pixList.begin(); iter != pixList.end(); ++iter)
-        pixListResult->push_back( iter->second );
+    for (size_t i=0; i < region.size(); i++)
+        visited.reset( region[i].index );
+}
 
-#undef ADD_NEIGHBOR
-#undef ADD_6_NEIGHBORS
-#undef ADD_12_NEIGHBORS
+// same as above, with a visited volume of its own
+template<typename T>
+void RegionGrow( const Matrix3D<T> &img, const PixelInfoList &startPixels, T minVal, T maxVal, unsigned int maxRegionSize,
+                 PixelInfoList *pixListResult )
+{
+    BitVolume visited;
+    RegionGrow( img, startPixels, minVal, maxVal, maxRegionSize, pixListResult, visited );
 }
 
 #endif // REGIONGROWING_H
@@ -0,0 +1,226 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <vector>
+#include <algorithm>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QString>
+
+/**
+ ** Time spent in every stage of the rendered frames, to tell where a slow render goes.
+ *  A frame is one render of the slice; stages it does not go through take 0.
+ *  The view is painted later in the event loop, so its paint time is added to the
+ *  last frame, which is only committed when the next one begins.
+ *  The last frames are kept to report percentiles, and every frame can be logged
+ *  as a CSV row. Times are in microseconds.
+ */
+class RenderStats
+{
+public:
+    enum Stage { Fetch = 0, Gray, Blend, Selection, Cursor, Upload, Paint, NumStages };
+
+    static const char *stageName( unsigned int stage )
+    {
+        static const char *names[] = { "fetch", "gray", "blend", "selection", "cursor", "upload", "paint", "total" };
+        return names[stage];
+    }
+
+private:
+    enum { numSamples = 512 };
+
+    bool         mEnabled;
+
+    // ring buffers of the last numSamples frames, one per stage plus the total
+    std::vector<float> mSamples[NumStages + 1];
+    unsigned int mNext;
+    unsigned int mCount;
+
+    double       mPending[NumStages];   // frame being timed
+    bool         mPendingValid;
+    unsigned int mFrameNumber;
+
+    QFile        mLogFile;
+    QTextStream  mLog;
+
+    void commitPending()
+    {
+        if (!mPendingValid)
+            return;
+
+        double total = 0;
+        for (unsigned int s=0; s < NumStages; s++) {
+            mSamples[s][mNext] = mPending[s];
+            total += mPending[s];
+        }
+        mSamples[NumStages][mNext] = total;
+
+        mNext = (mNext + 1) % numSamples;
+        mCount = std::min( mCount + 1, (unsigned int)numSamples );
+
+        if ( mLogFile.isOpen() )
+        {
+            mLog << mFrameNumber;
+            for (unsigned int s=0; s < NumStages; s++)
+                mLog << "," << (qint64)mPending[s];
+            mLog << "," << (qint64)total << "\n";
+        }
+
+        mFrameNumber++;
+        mPendingValid = false;
+    }
+
+public:
+    RenderStats() : mEnabled(false), mNext(0), mCount(0), mPendingValid(false), mFrameNumber(0)
+    {
+        for (unsigned int s=0; s <= NumStages; s++)
+            mSamples[s].resize( numSamples, 0 );
+    }
+
+    ~RenderStats() { closeLog(); }
+
+    // nothing is timed while disabled
+    void setEnabled( bool enabled )
+    {
+        if (!enabled)
+            commitPending();
+        mEnabled = enabled;
+    }
+    bool enabled() const { return mEnabled; }
+
+    void clear()
+    {
+        mNext = mCount = 0;
+        mFrameNumber = 0;
+        mPendingValid = false;
+    }
+
+    // logs every frame from now on to fileName, replacing it
+    bool openLog( const QString &fileName )
+    {
+        closeLog();
+
+        mLogFile.setFileName( fileName );
+        if ( !mLogFile.open( QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate ) )
+            return false;
+
+        mLog.setDevice( &mLogFile );
+        mLog << "frame";
+        for (unsigned int s=0; s <= NumStages; s++)
+            mLog << "," << stageName(s) << "_us";
+        mLog << "\n";
+
+        return true;
+    }
+
+    void closeLog()
+    {
+        if ( !mLogFile.isOpen() )
+            return;
+
+        commitPending();
+
+        mLog.flush();
+        mLog.setDevice( 0 );
+        mLogFile.close();
+    }
+
+    // starts timing a frame, the previous one is committed
+    void beginFrame()
+    {
+        if (!mEnabled)
+            return;
+
+        commitPending();
+
+        std::fill( mPending, mPending + NumStages, 0.0 );
+        mPendingValid = true;
+    }
+
+    // adds time to a stage of the current frame
+    void add( Stage stage, qint64 nsecs )
+    {
+        if (mPendingValid)
+            mPending[stage] += nsecs / 1000.0;
+    }
+
+    unsigned int numFrames() const { return mCount; }
+
+    // p-th percentile (0..100) of the stage times of the last frames, stage == NumStages is the total
+    double percentile( unsigned int stage, double p ) const
+    {
+        if (mCount == 0)
+            return 0;
+
+        std::vector<float> v( mSamples[stage].begin(), mSamples[stage].begin() + mCount );
+
+        const unsigned int k = std::min( (unsigned int)( p / 100.0 * mCount ), mCount - 1 );
+        std::nth_element( v.begin(), v.begin() + k, v.end() );
+
+        return v[k];
+    }
+
+    // total p50/p95/p99 in ms and the stage with the highest p95, for the status bar
+    QString summary() const
+    {
+        if (mCount == 0)
+            return QString("Render: no frames");
+
+        unsigned int worst = 0;
+        double worstP95 = -1;
+        for (unsigned int s=0; s < NumStages; s++)
+        {
+            const double p95 = percentile( s, 95 );
+            if (p95 > worstP95) {
+                worst = s;
+                worstP95 = p95;
+            }
+        }
+
+        return QString().sprintf( "Render p50/p95/p99: %.2f/%.2f/%.2f ms (%s %.2f ms at p95)",
+                                  percentile( NumStages, 50 ) / 1000.0, percentile( NumStages, 95 ) / 1000.0,
+                                  percentile( NumStages, 99 ) / 1000.0, stageName(worst), worstP95 / 1000.0 );
+    }
+
+    // p50/p95/p99 in ms of every stage, one per line
+    QString details() const
+    {
+        QString str = QString("Last %1 frames, p50/p95/p99 in ms").arg(mCount);
+
+        for (unsigned int s=0; s <= NumStages; s++)
+            str += QString().sprintf( "\n%-10s %7.2f %7.2f %7.2f", stageName(s),
+                                      percentile( s, 50 ) / 1000.0, percentile( s, 95 ) / 1000.0, percentile( s, 99 ) / 1000.0 );
+
+        return str;
+    }
+};
+
+/**
+ ** Adds the time from its construction to its destruction to a stage of the current frame.
+ */
+class RenderStageTimer
+{
+private:
+    RenderStats          &mStats;
+    RenderStats::Stage   mStage;
+    bool                 mActive;   // the stats were enabled when it was constructed
+    QElapsedTimer        mTimer;
+
+public:
+    RenderStageTimer( RenderStats &stats, RenderStats::Stage stage ) : mStats(stats), mStage(stage)
+    {
+        mActive = mStats.enabled();
+        if (mActive)
+            mTimer.start();
+    }
+
+    ~RenderStageTimer()
+    {
+        if (mActive)
+            mStats.add( mStage, mTimer.nsecsElapsed() );
+    }
+};
+
+#endif // RENDERSTATS_H
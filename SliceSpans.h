@@ -0,0 +1,152 @@
+#ifndef SLICESPANS_H
+#define SLICESPANS_H
+
+/**
+ * Index of a pixel list (e.g. a supervoxel) bucketed per Z slice
+ * as run-length rows, so that drawing or hit-testing a slice only
+ * touches the runs of that slice instead of the whole list.
+ */
+#include "SuperVoxeler.h"
+#include <vector>
+#include <algorithm>
+
+// horizontal run of pixels [x0, x1] in row y
+struct SliceSpan
+{
+    unsigned int y;
+    unsigned int x0, x1;    // both inclusive
+};
+
+class SliceSpanIndex
+{
+private:
+    std::vector<SliceSpan>    mSpans;       // sorted by (z,y,x0)
+    std::vector<unsigned int> mSliceStart;  // mSpans[mSliceStart[z] .. mSliceStart[z+1]) belong to slice z
+
+public:
+    SliceSpanIndex() { }
+
+    void clear()
+    {
+        mSpans.clear();
+        mSliceStart.clear();
+    }
+
+    inline bool empty() const { return mSpans.empty(); }
+
+    // builds the index from a pixel list, width/height/depth are those of the whole volume
+    void build( const PixelInfoList &pixels, unsigned int width, unsigned int height, unsigned int depth )
+    {
+        mSpans.clear();
+        mSliceStart.assign( depth + 1, 0 );
+
+        // linear indices are ordered by (z,y,x), which is what run-lengths need
+        std::vector<unsigned int> idx( pixels.size() );
+        bool sorted = true;
+        for (unsigned int i=0; i < pixels.size(); i++) {
+            idx[i] = pixels[i].index;
+            if ( (i > 0) && (idx[i] < idx[i-1]) )
+                sorted = false;
+        }
+
+        if (!sorted)
+            std::sort( idx.begin(), idx.end() );
+
+        const unsigned int sz = width * height;
+
+        unsigned int curZ = 0;
+        for (unsigned int i=0; i < idx.size(); )
+        {
+            const unsigned int z = idx[i] / sz;
+            const unsigned int y = (idx[i] % sz) / width;
+
+            // extend run while indices are consecutive and in the same row
+            unsigned int j = i + 1;
+            while ( (j < idx.size()) && (idx[j] <= idx[j-1] + 1) && (idx[j] / width == idx[i] / width) )
+                j++;
+
+            if (z >= depth)
+                break;
+
+            // slices without spans start where the next one does
+            for (; curZ < z; curZ++)
+                mSliceStart[curZ + 1] = mSpans.size();
+
+            SliceSpan span;
+            span.y = y;
+            span.x0 = idx[i] % width;
+            span.x1 = idx[j-1] % width;
+            mSpans.push_back( span );
+
+            i = j;
+        }
+
+        for (; curZ < depth; curZ++)
+            mSliceStart[curZ + 1] = mSpans.size();
+    }
+
+    // iterators over the spans of slice z
+    inline const SliceSpan *sliceBegin( unsigned int z ) const
+    {
+        if ( mSpans.empty() || (z + 1 >= mSliceStart.size()) )
+            return 0;
+        return &mSpans[0] + mSliceStart[z];
+    }
+
+    inline const SliceSpan *sliceEnd( unsigned int z ) const
+    {
+        if ( mSpans.empty() || (z + 1 >= mSliceStart.size()) )
+            return 0;
+        return &mSpans[0] + mSliceStart[z + 1];
+    }
+
+    // returns true if (x,y,z) is one of the indexed pixels
+    bool contains( int x, int y, unsigned int z ) const
+    {
+        if ( (x < 0) || (y < 0) )
+            return false;
+
+        const SliceSpan *begin = sliceBegin(z);
+        const SliceSpan *end = sliceEnd(z);
+        if (begin == end)
+            return false;
+
+        // first span with (span.y, span.x1) >= (y, x)
+        unsigned int count = end - begin;
+        while (count > 0)
+        {
+            unsigned int step = count / 2;
+            const SliceSpan *mid = begin + step;
+
+            if ( (mid->y < (unsigned)y) || ((mid->y == (unsigned)y) && (mid->x1 < (unsigned)x)) ) {
+                begin = mid + 1;
+                count -= step + 1;
+            } else
+                count = step;
+        }
+
+        return (begin != end) && (begin->y == (unsigned)y) && (begin->x0 <= (unsigned)x);
+    }
+
+    // bounding box of slice z, returns false if the slice has no pixels
+    bool sliceBounds( unsigned int z, unsigned int &xMin, unsigned int &yMin, unsigned int &xMax, unsigned int &yMax ) const
+    {
+        const SliceSpan *begin = sliceBegin(z);
+        const SliceSpan *end = sliceEnd(z);
+        if (begin == end)
+            return false;
+
+        yMin = begin->y;
+        yMax = (end - 1)->y;
+        xMin = begin->x0;
+        xMax = begin->x1;
+        for (const SliceSpan *s = begin; s != end; ++s) {
+            if (s->x0 < xMin)   xMin = s->x0;
+            if (s->x1 > xMax)   xMax = s->x1;
+        }
+
+        return true;
+    }
+};
+
+#endif // SLICESPANS_H
@@ -0,0 +1,28 @@
+#ifndef SLICEVIEWER_H
+#define SLICEVIEWER_H
+
+#include <QPoint>
+#include <QRect>
+
+/**
+ ** Navigation interface shared by the widgets that can display the slice
+ *  (MyGraphicsView, GLSliceView), so that the annotator can switch between them.
+ */
+class SliceViewer
+{
+public:
+    virtual ~SliceViewer() { }
+
+    // widget coordinates -> slice coordinates
+    virtual QPoint screenToImage( const QPoint &ev ) = 0;
+
+    // returns 'viewable rect' in image coordinates
+    virtual QRect getViewableRect() const = 0;
+
+    // pan / scale
+    virtual void scale( double factor ) = 0;
+    virtual void pan( double x, double y ) = 0;
+    virtual double scaleFactor() const = 0;
+};
+
+#endif // SLICEVIEWER_H
@@ -2,6 +2,8 @@
 #define SUPERVOXELER_H
 
 #include "Matrix3D.h"
+#include <cstdio>
+#include <algorithm>
 
 #define fatalMsg(x) qFatal(x)
 #include <slic/LKM.h>
@@ -80,17 +82,37 @@ public:
         _numLabels = numLabels;
     }
 
-    void apply( const Matrix3D<T> &img, int step, unsigned int cubeness )
+    void apply( const Matrix3D<T> &img, int step, unsigned int cubeness, int numThreads = 1 )
     {
-        rawGenSupervoxels( img, step, cubeness, &mPixelToVoxel, mNumLabels );
+        genLabels( img, step, cubeness, numThreads );
+        computeSlicMap();
+    }
+
+    // first half of apply(): only computes the pixel to voxel map
+    //  if numThreads > 1, the volume is split in tiles that are processed in parallel
+    void genLabels( const Matrix3D<T> &img, int step, unsigned int cubeness, int numThreads = 1 )
+    {
+        mHistograms.clear();
+        mMean.clear();
+        mVoxelToPixel.clear();
+
+    #ifdef _OPENMP
+        if (numThreads > 1)
+            rawGenSupervoxelsMultithread( img, step, cubeness, &mPixelToVoxel, mNumLabels, numThreads );
+        else
+    #endif
+            rawGenSupervoxels( img, step, cubeness, &mPixelToVoxel, mNumLabels );
 
         qDebug("Num labels: %d", (int)mNumLabels);
 
-        /** Compute the inverse map **/
+        mIsEmpty = false;
+    }
+
+    // second half of apply(): computes the inverse map
+    void computeSlicMap()
+    {
         qDebug("Computing slic map");
         createSlicMap( mPixelToVoxel, mNumLabels, mVoxelToPixel );
-
-        mIsEmpty = false;
     }
 
     // just saves volume, no other info
@@ -123,6 +145,26 @@ public:
         return true;
     }
 
+    // writes one line per supervoxel: mean followed by its histogram bins
+    //  computeSingleHistogramAndMean() must be called first
+    bool saveHistograms( const std::string &fName ) const
+    {
+        FILE *f = fopen( fName.c_str(), "w" );
+        if (f == 0)
+            return false;
+
+        for (unsigned int sIdx=0; sIdx < mHistograms.size(); sIdx++)
+        {
+            fprintf( f, "%g", mMean[sIdx] );
+            for (unsigned int b=0; b < mHistograms[sIdx].size(); b++)
+                fprintf( f, " %g", (double) mHistograms[sIdx][b] );
+            fprintf( f, "\n" );
+        }
+
+        fclose(f);
+        return true;
+    }
+
     // computes the histogram and mean of every supervoxel
     void computeSingleHistogramAndMean( const Matrix3D<T> &rawImg, HistogramOpts<T> hOpts )
     {
@@ -150,24 +192,97 @@ public:
     }
 
     #ifdef _OPENMP
-    static void rawGenSupervoxelsMultithread( const Matrix3D<T> &img, int step, unsigned int cubeness, Matrix3D<IDType> *destination, unsigned int &_numLabels )
+    // splits the volume in up to dimSplit^3 tiles and runs SLIC on each of them in parallel.
+    //  Tiles are not overlapped, so supervoxels do not cross tile boundaries.
+    //  IDs are offset so that they are unique in the whole volume
+    static void rawGenSupervoxelsMultithread( const Matrix3D<T> &img, int step, unsigned int cubeness, Matrix3D<IDType> *destination, unsigned int &_numLabels, int numThreads = 0 )
     {
-        const int numThreads = omp_get_num_threads();
+        if (numThreads <= 0)
+            numThreads = omp_get_max_threads();
 
         qDebug("Using %d threads.", numThreads);
 
-        // splitting per dimension
-        const int dimSplit = 4;
-        const int numSubVol = dimSplit*dimSplit*dimSplit;
-        const int dimOverlap = step * 3;
+        // splitting per dimension, tiles must stay large enough for the given step
+        const unsigned int dimSplit = 4;
+        const unsigned int minTileSide = 2 * step;
+
+        const unsigned int dims[3] = { img.width(), img.height(), img.depth() };
+        unsigned int numSplit[3];
+        for (int d=0; d < 3; d++)
+            numSplit[d] = std::max( 1U, std::min( dimSplit, dims[d] / minTileSide ) );
+
+        const unsigned int numSubVol = numSplit[0] * numSplit[1] * numSplit[2];
+
+        qDebug("Dividing in %d subvolumes.", (int)numSubVol);
+
+        destination->realloc( img.width(), img.height(), img.depth() );
+
+        // corner and size of every tile, the last one along each dimension takes the remainder
+        std::vector<UIntPoint3D> tileCorner( numSubVol ), tileSize( numSubVol );
+        for (unsigned int t=0; t < numSubVol; t++)
+        {
+            const unsigned int b[3] = { t % numSplit[0], (t / numSplit[0]) % numSplit[1], t / (numSplit[0] * numSplit[1]) };
+            unsigned int c[3], sz[3];
+            for (int d=0; d < 3; d++)
+            {
+                const unsigned int tileLen = dims[d] / numSplit[d];
+                c[d] = b[d] * tileLen;
+                sz[d] = (b[d] + 1 == numSplit[d]) ? (dims[d] - c[d]) : tileLen;
+            }
+
+            tileCorner[t] = UIntPoint3D( c[0], c[1], c[2] );
+            tileSize[t] = UIntPoint3D( sz[0], sz[1], sz[2] );
+        }
+
+        std::vector<unsigned int> tileLabels( numSubVol, 0 );
+
+        // 1) supervoxels per tile, written with local IDs (tiles are disjoint)
+        #pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+        for (int t=0; t < (int)numSubVol; t++)
+        {
+            Matrix3D<T>      cropped;
+            Matrix3D<IDType> tileIDs;
+
+            img.cropRegion( tileCorner[t].x, tileCorner[t].y, tileCorner[t].z,
+                            tileSize[t].x, tileSize[t].y, tileSize[t].z, &cropped );
+
+            unsigned int numLocal = 0;
+            rawGenSupervoxels( cropped, step, cubeness, &tileIDs, numLocal );
 
-        qDebug("Dividing in %d subvolumes.", numSubVol);
+            for (unsigned int z=0; z < tileSize[t].z; z++)
+                for (unsigned int y=0; y < tileSize[t].y; y++)
+                {
+                    const IDType *src = tileIDs.data() + tileIDs.coordToIdx( 0, y, z );
+                    IDType *dst = destination->data() + destination->coordToIdx( tileCorner[t].x, tileCorner[t].y + y, tileCorner[t].z + z );
 
-        unsigned int stepX = img.width() / dimSplit;
-        unsigned int stepY = img.height() / dimSplit;
-        unsigned int stepZ = img.depth() / dimSplit;
+                    for (unsigned int x=0; x < tileSize[t].x; x++) {
+                        dst[x] = src[x];
+                        if ( src[x] >= numLocal )
+                            numLocal = src[x] + 1;
+                    }
+                }
 
+            tileLabels[t] = numLocal;
+        }
+
+        // 2) offset IDs to make them unique
+        std::vector<unsigned int> tileBase( numSubVol, 0 );
+        for (unsigned int t=1; t < numSubVol; t++)
+            tileBase[t] = tileBase[t - 1] + tileLabels[t - 1];
+
+        _numLabels = tileBase[numSubVol - 1] + tileLabels[numSubVol - 1];
 
+        #pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+        for (int t=1; t < (int)numSubVol; t++)
+        {
+            for (unsigned int z=0; z < tileSize[t].z; z++)
+                for (unsigned int y=0; y < tileSize[t].y; y++)
+                {
+                    IDType *dst = destination->data() + destination->coordToIdx( tileCorner[t].x, tileCorner[t].y + y, tileCorner[t].z + z );
+                    for (unsigned int x=0; x < tileSize[t].x; x++)
+                        dst[x] += tileBase[t];
+                }
+        }
     }
     #endif
 
@@ -0,0 +1,513 @@
+#ifndef UNDOJOURNAL_H
+#define UNDOJOURNAL_H
+
+/**
+ * Undo/redo of the edits of label and overlay volumes.
+ * Every edit is recorded as a step: before a box of a volume is written, touch()
+ * saves a compressed copy of the bricks (brickSide^3 voxels) of the box that the step
+ * did not save yet (copy on write). When the step ends, every saved brick is XORed
+ * with its new contents and compressed again. Unchanged voxels XOR to 0, so a brick
+ * costs little more than the voxels that changed in it, and unchanged bricks are dropped.
+ * The same diff undoes and redoes the step. Steps can be nested (e.g. a command
+ * calling another one), only the outermost one is recorded.
+ *
+ * A hash of every brick before and after the step is kept, so that a brick written
+ * outside of the journal (e.g. an overlay loaded from file) is detected instead
+ * of being corrupted by the XOR: the journal is cleared then.
+ * Steps are dropped from the oldest when the journal goes over its memory budget,
+ * the last one is always kept. The copies saved by the open step count against the
+ * budget too: a step that needs more is not recorded and the journal is cleared.
+ */
+#include "Matrix3D.h"
+#include "CommonTypes.h"
+
+#include <QByteArray>
+#include <QString>
+
+#include <vector>
+#include <deque>
+#include <set>
+#include <algorithm>
+
+class UndoJournal
+{
+public:
+    typedef Matrix3D<LabelType> Volume;
+
+    // box of a volume changed by undo()/redo(), inclusive
+    struct Change
+    {
+        Volume *volume;
+        int x0, y0, z0;
+        int x1, y1, z1;
+    };
+
+private:
+    enum { brickSide = 32 };
+
+    struct BrickDiff
+    {
+        Volume       *volume;
+        unsigned int bx, by, bz;    // brick coordinates
+        QByteArray   diff;          // compressed XOR of the contents before and after the step
+        unsigned int hashBefore;
+        unsigned int hashAfter;
+    };
+
+    // size of a volume after the step, which the diffs are for
+    struct VolumeSize
+    {
+        Volume       *volume;
+        unsigned int w, h, d;
+    };
+
+    struct Step
+    {
+        QString                 name;
+        std::vector<BrickDiff>  bricks;
+        std::vector<VolumeSize> sizes;
+        size_t                  bytes;
+    };
+
+    // brick saved by the open step, with its contents before it
+    struct SavedBrick
+    {
+        Volume       *volume;
+        unsigned int bx, by, bz;
+        QByteArray   before;        // compressed
+        unsigned int numVoxels;
+        unsigned int hashBefore;
+    };
+
+    std::deque<Step>    mUndo;      // last step at the back
+    std::deque<Step>    mRedo;      // next step at the back
+    size_t              mBytes;     // of the steps in mUndo and mRedo
+    size_t              mBudget;
+
+    unsigned int        mDepth;     // of the open steps, 0 if none
+    QString             mOpenName;
+    std::vector<SavedBrick>     mSaved;
+    std::set<std::pair<Volume *, unsigned int> > mSavedKeys;    // (volume, brick index) in mSaved
+    std::vector<Volume *>       mEmptyVolumes;  // touched while empty: their bricks were all 0 before
+    size_t                      mSavedBytes;    // of mSaved
+    bool                        mOverflow;      // the open step went over the budget and is not recorded
+
+    // copies brick (bx, by, bz) of vol to buf, bricks at the border are smaller
+    static void readBrick( const Volume &vol, unsigned int bx, unsigned int by, unsigned int bz, std::vector<LabelType> &buf )
+    {
+        const unsigned int x0 = bx * brickSide, y0 = by * brickSide, z0 = bz * brickSide;
+        const unsigned int w = std::min( (unsigned int)brickSide, vol.width() - x0 );
+        const unsigned int h = std::min( (unsigned int)brickSide, vol.height() - y0 );
+        const unsigned int d = std::min( (unsigned int)brickSide, vol.depth() - z0 );
+
+        buf.resize( w * h * d );
+
+        LabelType *dst = buf.empty() ? 0 : &buf[0];
+        for (unsigned int z = z0; z < z0 + d; z++)
+            for (unsigned int y = y0; y < y0 + h; y++, dst += w)
+                memcpy( dst, vol.sliceData(z) + y * vol.width() + x0, w * sizeof(LabelType) );
+    }
+
+    // XORs buf into brick (bx, by, bz) of vol
+    static void xorBrick( Volume &vol, unsigned int bx, unsigned int by, unsigned int bz, const std::vector<LabelType> &buf )
+    {
+        const unsigned int x0 = bx * brickSide, y0 = by * brickSide, z0 = bz * brickSide;
+        const unsigned int w = std::min( (unsigned int)brickSide, vol.width() - x0 );
+        const unsigned int h = std::min( (unsigned int)brickSide, vol.height() - y0 );
+        const unsigned int d = std::min( (unsigned int)brickSide, vol.depth() - z0 );
+
+        const LabelType *src = &buf[0];
+        for (unsigned int z = z0; z < z0 + d; z++)
+            for (unsigned int y = y0; y < y0 + h; y++, src += w)
+            {
+                LabelType *row = vol.sliceData(z) + y * vol.width() + x0;
+                for (unsigned int x=0; x < w; x++)
+                    row[x] ^= src[x];
+            }
+    }
+
+    // FNV-1a
+    static unsigned int hashOf( const std::vector<LabelType> &buf )
+    {
+        unsigned int hash = 2166136261u;
+        for (unsigned int i=0; i < buf.size(); i++)
+            hash = (hash ^ buf[i]) * 16777619u;
+        return hash;
+    }
+
+    static bool sameSize( const Volume &vol, const VolumeSize &s )
+    {
+        return (vol.width() == s.w) && (vol.height() == s.h) && (vol.depth() == s.d);
+    }
+
+    // numbers of bricks along every axis
+    static void brickCounts( const Volume &vol, unsigned int &nx, unsigned int &ny, unsigned int &nz )
+    {
+        nx = (vol.width() + brickSide - 1) / brickSide;
+        ny = (vol.height() + brickSide - 1) / brickSide;
+        nz = (vol.depth() + brickSide - 1) / brickSide;
+    }
+
+    void dropRedo()
+    {
+        for (unsigned int i=0; i < mRedo.size(); i++)
+            mBytes -= mRedo[i].bytes;
+        mRedo.clear();
+    }
+
+    // drops what the open step saved, it will not be recorded
+    void dropOpenStep()
+    {
+        mSaved.clear();
+        mSavedKeys.clear();
+        mEmptyVolumes.clear();
+        mSavedBytes = 0;
+        mOverflow = true;
+    }
+
+    // drops the oldest steps until the budget is met
+    void enforceBudget()
+    {
+        while ( (mBytes > mBudget) && !mRedo.empty() ) {
+            mBytes -= mRedo.front().bytes;
+            mRedo.pop_front();
+        }
+
+        while ( (mBytes > mBudget) && (mUndo.size() > 1) ) {
+            mBytes -= mUndo.front().bytes;
+            mUndo.pop_front();
+        }
+    }
+
+    // XORs the diffs of step into the volumes, checking first that they are what the step
+    //  left (forward == false, undo) or found (forward == true, redo)
+    bool apply( const Step &step, bool forward, std::vector<Change> &changes )
+    {
+        for (unsigned int i=0; i < step.sizes.size(); i++)
+            if ( !sameSize( *step.sizes[i].volume, step.sizes[i] ) )
+                return false;
+
+        std::vector<LabelType> buf;
+        for (unsigned int i=0; i < step.bricks.size(); i++)
+        {
+            const BrickDiff &b = step.bricks[i];
+            readBrick( *b.volume, b.bx, b.by, b.bz, buf );
+            if ( hashOf( buf ) != (forward ? b.hashBefore : b.hashAfter) )
+                return false;
+        }
+
+        changes.clear();
+        for (unsigned int i=0; i < step.bricks.size(); i++)
+        {
+            const BrickDiff &b = step.bricks[i];
+
+            const QByteArray diff = qUncompress( b.diff );
+            buf.assign( (const LabelType *) diff.constData(), (const LabelType *) diff.constData() + diff.size() );
+            xorBrick( *b.volume, b.bx, b.by, b.bz, buf );
+
+            Change c;
+            c.volume = b.volume;
+            c.x0 = b.bx * brickSide;
+            c.y0 = b.by * brickSide;
+            c.z0 = b.bz * brickSide;
+            c.x1 = std::min( c.x0 + brickSide, (int)b.volume->width() ) - 1;
+            c.y1 = std::min( c.y0 + brickSide, (int)b.volume->height() ) - 1;
+            c.z1 = std::min( c.z0 + brickSide, (int)b.volume->depth() ) - 1;
+
+            // one box per volume
+            unsigned int j = 0;
+            while ( (j < changes.size()) && (changes[j].volume != c.volume) )
+                j++;
+
+            if ( j == changes.size() )
+                changes.push_back( c );
+            else {
+                Change &u = changes[j];
+                u.x0 = std::min( u.x0, c.x0 );  u.y0 = std::min( u.y0, c.y0 );  u.z0 = std::min( u.z0, c.z0 );
+                u.x1 = std::max( u.x1, c.x1 );  u.y1 = std::max( u.y1, c.y1 );  u.z1 = std::max( u.z1, c.z1 );
+            }
+        }
+
+        return true;
+    }
+
+public:
+    UndoJournal() : mBytes(0), mBudget( 256 * 1024 * 1024 ), mDepth(0), mSavedBytes(0), mOverflow(false) { }
+
+    void setBudgetMB( unsigned int mb )
+    {
+        mBudget = (size_t)mb * 1024 * 1024;
+        enforceBudget();
+    }
+
+    // memory taken by the recorded steps
+    size_t bytes() const { return mBytes; }
+
+    void clear()
+    {
+        mUndo.clear();
+        mRedo.clear();
+        mBytes = 0;
+
+        mDepth = 0;
+        mSaved.clear();
+        mSavedKeys.clear();
+        mEmptyVolumes.clear();
+        mSavedBytes = 0;
+        mOverflow = false;
+    }
+
+    bool canUndo() const { return !mUndo.empty(); }
+    bool canRedo() const { return !mRedo.empty(); }
+
+    QString undoName() const { return mUndo.empty() ? QString() : mUndo.back().name; }
+    QString redoName() const { return mRedo.empty() ? QString() : mRedo.back().name; }
+
+    // starts recording a step, or a nested one which is part of the open step
+    void beginStep( const QString &name )
+    {
+        if (mDepth++ == 0)
+            mOpenName = name;
+    }
+
+    bool stepOpen() const { return mDepth > 0; }
+
+    // has to be called before writing to the (inclusive) box of vol, only inside a step
+    void touch( Volume *vol, int x0, int y0, int z0, int x1, int y1, int z1 )
+    {
+        if ( (mDepth == 0) || mOverflow )
+            return;
+
+        if ( vol->isEmpty() )
+        {
+            if ( std::find( mEmptyVolumes.begin(), mEmptyVolumes.end(), vol ) == mEmptyVolumes.end() )
+                mEmptyVolumes.push_back( vol );
+            return;
+        }
+
+        x0 = std::max( x0, 0 );     x1 = std::min( x1, (int)vol->width() - 1 );
+        y0 = std::max( y0, 0 );     y1 = std::min( y1, (int)vol->height() - 1 );
+        z0 = std::max( z0, 0 );     z1 = std::min( z1, (int)vol->depth() - 1 );
+        if ( (x0 > x1) || (y0 > y1) || (z0 > z1) )
+            return;
+
+        unsigned int nx, ny, nz;
+        brickCounts( *vol, nx, ny, nz );
+
+        std::vector<LabelType> buf;
+        for (int bz = z0 / brickSide; bz <= z1 / brickSide; bz++)
+            for (int by = y0 / brickSide; by <= y1 / brickSide; by++)
+                for (int bx = x0 / brickSide; bx <= x1 / brickSide; bx++)
+                {
+                    const std::pair<Volume *, unsigned int> key( vol, bx + nx * (by + ny * bz) );
+                    if ( !mSavedKeys.insert( key ).second )
+                        continue;
+
+                    mSaved.push_back( SavedBrick() );
+                    SavedBrick &s = mSaved.back();
+                    s.volume = vol;
+                    s.bx = bx;
+                    s.by = by;
+                    s.bz = bz;
+
+                    // fast compression, whole volumes are touched at once
+                    readBrick( *vol, bx, by, bz, buf );
+                    s.before = qCompress( (const uchar *) &buf[0], buf.size(), 1 );
+                    s.numVoxels = buf.size();
+                    s.hashBefore = hashOf( buf );
+
+                    mSavedBytes += s.before.size() + sizeof(SavedBrick);
+                    if ( mSavedBytes > mBudget ) {
+                        dropOpenStep();
+                        return;
+                    }
+                }
+    }
+
+    // whole volume
+    void touch( Volume *vol )
+    {
+        touch( vol, 0, 0, 0, (int)vol->width() - 1, (int)vol->height() - 1, (int)vol->depth() - 1 );
+    }
+
+    // ends the open step. The outermost one diffs the saved bricks against the volumes and is recorded
+    //  if anything changed. Returns false if a volume touched was reallocated with another size, or if
+    //  the step went over the budget, which cannot be undone: the whole journal is cleared then
+    bool endStep()
+    {
+        if (mDepth == 0)
+            return true;
+
+        if (--mDepth > 0)
+            return true;
+
+        if (mOverflow) {
+            clear();
+            return false;
+        }
+
+        Step step;
+        step.name = mOpenName;
+        step.bytes = sizeof(Step);
+
+        bool valid = true;
+        std::vector<LabelType> buf;
+
+        for (unsigned int i=0; i < mSaved.size(); i++)
+        {
+            SavedBrick &s = mSaved[i];
+
+            readBrick( *s.volume, s.bx, s.by, s.bz, buf );
+            if ( buf.size() != s.numVoxels ) {
+                valid = false;
+                break;
+            }
+
+            BrickDiff b;
+            b.volume = s.volume;
+            b.bx = s.bx;
+            b.by = s.by;
+            b.bz = s.bz;
+            b.hashBefore = s.hashBefore;
+            b.hashAfter = hashOf( buf );
+
+            const QByteArray before = qUncompress( s.before );
+            const LabelType *beforePtr = (const LabelType *) before.constData();
+
+            if ( b.hashBefore == b.hashAfter && std::equal( buf.begin(), buf.end(), beforePtr ) )
+                continue;
+
+            for (unsigned int k=0; k < buf.size(); k++)
+                buf[k] ^= beforePtr[k];
+
+            b.diff = qCompress( (const uchar *) &buf[0], buf.size() );
+            step.bytes += b.diff.size() + sizeof(BrickDiff);
+            step.bricks.push_back( b );
+        }
+
+        // volumes that were empty: their bricks are diffed against 0
+        for (unsigned int i=0; valid && (i < mEmptyVolumes.size()); i++)
+        {
+            Volume *vol = mEmptyVolumes[i];
+            if ( vol->isEmpty() )
+                continue;
+
+            unsigned int nx, ny, nz;
+            brickCounts( *vol, nx, ny, nz );
+
+            std::vector<LabelType> zeros;
+            for (unsigned int bz=0; bz < nz; bz++)
+                for (unsigned int by=0; by < ny; by++)
+                    for (unsigned int bx=0; bx < nx; bx++)
+                    {
+                        // touched again once allocated, already diffed above
+                        if ( mSavedKeys.count( std::make_pair( vol, bx + nx * (by + ny * bz) ) ) )
+                            continue;
+
+                        readBrick( *vol, bx, by, bz, buf );
+                        zeros.assign( buf.size(), 0 );
+
+                        BrickDiff b;
+                        b.volume = vol;
+                        b.bx = bx;
+                        b.by = by;
+                        b.bz = bz;
+                        b.hashBefore = hashOf( zeros );
+                        b.hashAfter = hashOf( buf );
+
+                        if ( buf == zeros )
+                            continue;
+
+                        b.diff = qCompress( (const uchar *) &buf[0], buf.size() );
+                        step.bytes += b.diff.size() + sizeof(BrickDiff);
+                        step.bricks.push_back( b );
+                    }
+        }
+
+        for (unsigned int i=0; valid && (i < step.bricks.size()); i++)
+        {
+            Volume *vol = step.bricks[i].volume;
+
+            unsigned int j = 0;
+            while ( (j < step.sizes.size()) && (step.sizes[j].volume != vol) )
+                j++;
+
+            if ( j == step.sizes.size() ) {
+                VolumeSize s;
+                s.volume = vol;
+                s.w = vol->width();
+                s.h = vol->height();
+                s.d = vol->depth();
+                step.sizes.push_back( s );
+            }
+        }
+
+        mSaved.clear();
+        mSavedKeys.clear();
+        mEmptyVolumes.clear();
+        mSavedBytes = 0;
+
+        if (!valid) {
+            clear();
+            return false;
+        }
+
+        if ( step.bricks.empty() )
+            return true;
+
+        dropRedo();
+
+        mUndo.push_back( step );
+        mBytes += step.bytes;
+        enforceBudget();
+
+        return true;
+    }
+
+    // undoes the last step, returning the boxes it changed. Returns false if there is none,
+    //  or if its volumes were modified outside of the journal, which is cleared then
+    bool undo( std::vector<Change> &changes )
+    {
+        if (mDepth > 0) {
+            mDepth = 1;
+            endStep();
+        }
+
+        if ( mUndo.empty() )
+            return false;
+
+        if ( !apply( mUndo.back(), false, changes ) ) {
+            clear();
+            return false;
+        }
+
+        mRedo.push_back( mUndo.back() );
+        mUndo.pop_back();
+
+        return true;
+    }
+
+    // same as undo(), the other way
+    bool redo( std::vector<Change> &changes )
+    {
+        if (mDepth > 0) {
+            mDepth = 1;
+            endStep();
+        }
+
+        if ( mRedo.empty() )
+            return false;
+
+        if ( !apply( mRedo.back(), true, changes ) ) {
+            clear();
+            return false;
+        }
+
+        mUndo.push_back( mRedo.back() );
+        mRedo.pop_back();
+
+        return true;
+    }
+};
+
+#endif // UNDOJOURNAL_H
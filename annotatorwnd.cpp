@@ -13,35 +13,81 @@
 #include "textinfodialog.h"
 
 #include "MiscUtils.h"
+#include "OverlayCompositor.h"
+#include "RenderStats.h"
 
 #include "FijiHelper.h"
 
 #include "SuperVoxeler.h"
+#include "BrickedSupervoxels.h"
+#include "SliceSpans.h"
 #include "regionlistframe.h"
 
 #include "RegionGrowing.h"
+#include "FloodFill.h"
 
 #include "PluginBase.h"
 #include <QColorDialog>
 #include <QInputDialog>
+#include <QActionGroup>
+#include <QLabel>
+#include <QMenuBar>
+#include <QProgressDialog>
+#include <QElapsedTimer>
 
 #include <QThread>
 #include "extras/waitform.h"
 
 #include "preferencesdialog.h"
+#include "glsliceview.h"
+#include "sliceprefetcher.h"
+#include "redrawscheduler.h"
 /** ---- these variables here are a bit dirty, but it is to avoid putting them in the .h file
  ** even though it prevents multiple instances
  */
 static SuperVoxeler<unsigned char> mSVoxel;
 
+// out-of-core global supervoxels, used instead of mSVoxel if mSVUseBricked is true
+static BrickedSupervoxels<unsigned char> mSVBricked;
+static bool mSVUseBricked = false;
+static PixelInfoList mSVBrickedPixels;  // pixels of the selected out-of-core supervoxel
+
+/** Restrictions applied to the pixels of a selected supervoxel **/
+struct SupervoxelFilter
+{
+    bool          restrictPixels;    // keep only pixels in [pixMin, pixMax]
+    unsigned char pixMin, pixMax;
+    bool          dontOverwriteLabeled;
+
+    bool          restrictScore;     // keep only pixels with score >= scoreThr
+    unsigned char scoreThr;
+
+    bool operator ==( const SupervoxelFilter &o ) const
+    {
+        return (restrictPixels == o.restrictPixels) && (pixMin == o.pixMin) && (pixMax == o.pixMax) &&
+               (dontOverwriteLabeled == o.dontOverwriteLabeled) &&
+               (restrictScore == o.restrictScore) && (scoreThr == o.scoreThr);
+    }
+};
+
 /** Supervoxel selection **/
 struct SupervoxelSelection
 {
     bool  valid;    // if it contains valid selection information
 
+    // if true, only svIdx is recorded while hovering and pixelList is built lazily
+    //  (see updateSVSelectionPixels()), otherwise pixelList was set explicitly
+    bool  isSupervoxel;
+    bool  pixelListValid;   // pixelList is up to date with svIdx and filter
+    SupervoxelFilter         filter;    // restrictions pixelList was built with
+
     unsigned int             svIdx;     // supervoxel ID
     SlicMapType::value_type  pixelList; // pixels that are inside the selected supervoxel
 
+    // pixelList bucketed per slice as row runs, for drawing/hit-testing the current slice
+    bool            spansValid;
+    SliceSpanIndex  spans;
+
 } static mSelectedSV ;
 
 static Region3D mSVRegion;
@@ -69,6 +115,12 @@ std::vector< Matrix3D<OverlayType> * >  mOverlayVolumeList;
 std::vector<QAction *>                mOverlayMenuActions;
 std::vector<QMenu *>                  mOverlayMenus; // choose color menu action
 
+// blends score image + overlays + labels onto the slice, kept to reuse its layer table
+static OverlayCompositor mOverlayCompositor;
+
+// time spent in every stage of renderSlice()
+static RenderStats mRenderStats;
+
 /** -------- Class begin ------------ **/
 
 AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
@@ -77,6 +129,17 @@ AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
 {
     ui->setupUi(this);
 
+    mViewer = ui->labelImg;
+    mGLView = 0;
+    mGLSliceKey = -1;
+    mPrefetcher = 0;
+    mUndoAction = mRedoAction = 0;
+    mPluginStrokeOpen = false;
+
+    // at most one render per display refresh (~60 Hz)
+    mRedrawScheduler = new RedrawScheduler( 16, this );
+    connect( mRedrawScheduler, SIGNAL(redraw()), this, SLOT(renderSlice()) );
+
     mLabelListData.pFrame = 0;
     mSaveLabelsOnExit = false;
 
@@ -101,6 +164,9 @@ AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
     mScoreImageEnabled = false;
 
     mSelectedSV.valid = false;  // no valid selection so far
+    mSelectedSV.isSupervoxel = false;
+    mSelectedSV.pixelListValid = false;
+    mSelectedSV.spansValid = false;
 
     ui->centralWidget->setLayout( ui->horizontalLayout );
 
@@ -141,6 +207,10 @@ AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
     mVolumeLabels.reallocSizeLike( mVolumeData );
     mVolumeLabels.fill(0);
 
+    // slices on both sides are kept, so that reversing the scroll direction reuses them
+    mPrefetcher = new SlicePrefetcher( mVolumeData, this );
+    mPrefetcher->setCapacity( 2 * mSettingsData.prefetchSlices + 1 );
+
     /** Parse remaining possible args **/
     if (qApp->arguments().size() >= 3)
     {
@@ -163,6 +233,10 @@ AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
             mCurZSlice = z;
     }
 
+    // XZ/YZ views start in the middle of the volume
+    mCurXSlice = mVolumeData.width() / 2;
+    mCurYSlice = mVolumeData.height() / 2;
+
     //Brushes
     cubeBrush.setSize(ui->cubeBrushSizeX->value(),ui->cubeBrushSizeY->value(),ui->cubeBrushSizeZ->value());
     sphereBrush.setSize(ui->cubeBrushSizeX->value(),ui->cubeBrushSizeY->value(),ui->cubeBrushSizeZ->value());
@@ -188,6 +262,10 @@ AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
     connect(ui->labelImg,SIGNAL(mouseMoveEventSignal(QMouseEvent*)),this,SLOT(labelImageMouseMoveEvent(QMouseEvent*)));
     connect(ui->labelImg,SIGNAL(mouseReleaseEventSignal(QMouseEvent*)),this,SLOT(labelImageMouseReleaseEvent(QMouseEvent*)));
 
+    // only the visible part of the slice is rendered, the rest when it scrolls into view.
+    //  Renders are coalesced, so zooming (which also scrolls) renders once it is done
+    connect(ui->labelImg,SIGNAL(viewableRectChanged()),this,SLOT(updateCursorLayer()));
+
     ui->labelImg->setMouseTracking(true);
 
     connect(ui->zSlider,SIGNAL(sliderMoved(int)),this,SLOT(zSliderMoved(int)));
@@ -217,6 +295,12 @@ AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
     connect( testMenu->addAction("Global"), SIGNAL(triggered()), this, SLOT(genSuperVoxelWholeVolumeClicked()) );
     connect( testMenu->addAction("Save global to file..."), SIGNAL(triggered()), this, SLOT(saveSuperVoxelWholeVolumeClicked()) );
     connect( testMenu->addAction("Load global from file..."), SIGNAL(triggered()), this, SLOT(loadSuperVoxelWholeVolumeClicked()) );
+    testMenu->addSeparator();
+    connect( testMenu->addAction("Global, out-of-core..."), SIGNAL(triggered()), this, SLOT(genSuperVoxelBrickedClicked()) );
+    connect( testMenu->addAction("Load global out-of-core..."), SIGNAL(triggered()), this, SLOT(loadSuperVoxelBrickedClicked()) );
+    testMenu->addSeparator();
+    mSVGrowAction = testMenu->addAction("Grow selection to similar voxels");
+    mSVGrowAction->setCheckable( true );
 
 
     ui->butGenSV->setMenu(testMenu);
@@ -232,6 +316,92 @@ AnnotatorWnd::AnnotatorWnd(QWidget *parent) :
 
     connect( ui->actionHide_volume, SIGNAL(changed()), this, SLOT(updateImageSlice()) );
 
+    // alternative viewer that blends the slices on the GPU
+    mGLViewerAction = ui->menuView->addAction("OpenGL viewer");
+    mGLViewerAction->setCheckable(true);
+    mGLViewerAction->setChecked(false);
+    connect( mGLViewerAction, SIGNAL(toggled(bool)), this, SLOT(useGLViewer(bool)) );
+
+    // frame time breakdown
+    {
+        mRenderStatsAction = ui->menuView->addAction("Show render timings");
+        mRenderStatsAction->setCheckable(true);
+        connect( mRenderStatsAction, SIGNAL(toggled(bool)), this, SLOT(showRenderStats(bool)) );
+
+        mRenderStatsLogAction = ui->menuView->addAction("Log render timings...");
+        mRenderStatsLogAction->setCheckable(true);
+        connect( mRenderStatsLogAction, SIGNAL(toggled(bool)), this, SLOT(logRenderStats(bool)) );
+
+        mRenderStatsLabel = new QLabel(this);
+        mRenderStatsLabel->hide();
+        statusBar()->addPermanentWidget( mRenderStatsLabel );
+
+        mRenderStatsTimer = new QTimer(this);
+        mRenderStatsTimer->setInterval( 500 );
+        connect( mRenderStatsTimer, SIGNAL(timeout()), this, SLOT(updateRenderStatsLabel()) );
+
+        connect( ui->labelImg, SIGNAL(viewportPainted(qint64)), this, SLOT(viewportPainted(qint64)) );
+    }
+
+    // ---- Edit menu, undo/redo of the label and overlay edits
+    {
+        QMenu *editMenu = new QMenu("Edit", this);
+        menuBar()->insertMenu( ui->menuView->menuAction(), editMenu );
+
+        mUndoAction = editMenu->addAction("Undo");
+        mUndoAction->setShortcut( QKeySequence( QString("Ctrl+Z") ) );
+        connect( mUndoAction, SIGNAL(triggered()), this, SLOT(undoTriggered()) );
+
+        mRedoAction = editMenu->addAction("Redo");
+        mRedoAction->setShortcut( QKeySequence( QString("Ctrl+Shift+Z") ) );
+        connect( mRedoAction, SIGNAL(triggered()), this, SLOT(redoTriggered()) );
+
+        mUndoJournal.setBudgetMB( mSettingsData.undoMemoryMB );
+        updateUndoActions();
+
+        // fill tool options
+        editMenu->addSeparator();
+
+        QAction *fillTolAction = editMenu->addAction("Fill tolerance...");
+        connect( fillTolAction, SIGNAL(triggered()), this, SLOT(fillToleranceTriggered()) );
+
+        QAction *fill26Action = editMenu->addAction("Fill diagonally connected voxels (26-connectivity)");
+        fill26Action->setCheckable( true );
+        fill26Action->setChecked( mSettingsData.fill26Connected );
+        connect( fill26Action, SIGNAL(toggled(bool)), this, SLOT(fill26ConnectedToggled(bool)) );
+    }
+
+    // label overlay opacity, right after "Overlay labels"
+    {
+        QAction *opacityAction = new QAction( "Label overlay opacity...", this );
+        const QList<QAction *> viewActions = ui->menuView->actions();
+        const int next = viewActions.indexOf( ui->actionOverlay_labels ) + 1;
+
+        ui->menuView->insertAction( (next > 0) && (next < viewActions.size()) ? viewActions[next] : 0, opacityAction );
+        connect( opacityAction, SIGNAL(triggered()), this, SLOT(labelOverlayOpacityTriggered()) );
+    }
+
+    // slice orientation
+    {
+        ui->menuView->addSeparator();
+
+        QActionGroup *group = new QActionGroup(this);
+        const char *names[] = { "View XY", "View XZ", "View YZ" };
+        const char *keys[] = { "Alt+1", "Alt+2", "Alt+3" };     // Ctrl+N selects overlays
+
+        for (int i=0; i < 3; i++)
+        {
+            QAction *action = ui->menuView->addAction( names[i] );
+            action->setCheckable(true);
+            action->setChecked( i == SliceXY );
+            action->setShortcut( QKeySequence( QString(keys[i]) ) );
+            action->setData( i );
+            action->setActionGroup( group );
+
+            connect( action, SIGNAL(triggered()), this, SLOT(sliceOrientationTriggered()) );
+        }
+    }
+
     ui->chkLabelOverlay->setChecked(true);
 
     //TODO the row is changed before triggering the slot so this does not work
@@ -418,6 +588,7 @@ void AnnotatorWnd::overlayLoadTriggered()
 
     std::string stdFName = fileName.toLocal8Bit().constData();
 
+    mPrefetcher->invalidate( true );
     if (!mOverlayVolumeList[idx]->load( stdFName ))
         QMessageBox::critical(this, "Cannot open file", QString("%1 could not be read.").arg(fileName));
 
@@ -462,6 +633,7 @@ void AnnotatorWnd::overlayReloadTriggered()
 
     std::string stdFName = fileName.toLocal8Bit().constData();
 
+    mPrefetcher->invalidate( true );
     if (!mOverlayVolumeList[idx]->load( stdFName )){
         QMessageBox::critical(this, "Cannot open file", QString("%1 could not be read.").arg(fileName));
         return;
@@ -602,9 +774,36 @@ void AnnotatorWnd::overlayRescaleTriggered()
 
 Matrix3D<OverlayType> &  AnnotatorWnd::getOverlayVoxelData( unsigned int num )
 {
+    // the caller may reallocate it
+    mPrefetcher->invalidate( true );
+
     return *mOverlayVolumeList.at(num);  // note the assert on num!
 }
 
+Matrix3D<PixelType> &  AnnotatorWnd::getVolumeVoxelData()
+{
+    // the caller may reallocate it
+    mPrefetcher->invalidate( true );
+
+    return mVolumeData;
+}
+
+Matrix3D<LabelType> &  AnnotatorWnd::getLabelVoxelData()
+{
+    // the caller may reallocate it
+    mPrefetcher->invalidate( true );
+
+    return mVolumeLabels;
+}
+
+Matrix3D<ScoreType> &  AnnotatorWnd::getScoreVoxelData()
+{
+    // the caller may reallocate it
+    mPrefetcher->invalidate( true );
+
+    return mScoreImage;
+}
+
 Matrix3D<OverlayType> * AnnotatorWnd::getSelectedOverlayData( )
 {
     int overlayindex = ui->layersDisplay->currentIndex().row();
@@ -637,6 +836,10 @@ void AnnotatorWnd::setOverlayVisible( unsigned int num, bool visible )
         return;
     }
 
+    // nothing to redraw if it does not change, plugins call this on every edit
+    if ( (mOverlayMenuActions.at(num)->isEnabled() == visible) && (mOverlayMenuActions.at(num)->isChecked() == visible) )
+        return;
+
     mOverlayMenuActions.at(num)->setEnabled(visible);
     mOverlayMenuActions.at(num)->setChecked(visible);
 
@@ -707,6 +910,14 @@ void AnnotatorWnd::loadSettings()
     mSettingsData.loadPathVolume = settings.value("loadPathVolume", ".").toString();
     mSettingsData.fijiExePath = settings.value("fijiExePath", "Not set").toString();
     mSettingsData.maxVoxForSVox = settings.value("maxVoxForSVox", 28000000).toUInt();
+    mSettingsData.svBrickSize = settings.value("svBrickSize", 256).toUInt();
+    mSettingsData.svBrickCacheMB = settings.value("svBrickCacheMB", 1024).toUInt();
+    mSettingsData.prefetchSlices = settings.value("prefetchSlices", 4).toUInt();
+    mSettingsData.undoMemoryMB = settings.value("undoMemoryMB", 256).toUInt();
+    mSettingsData.fillTolerance = settings.value("fillTolerance", 16).toUInt();
+    mSettingsData.fillMaxVoxels = settings.value("fillMaxVoxels", 200000000).toUInt();
+    mSettingsData.fill26Connected = settings.value("fill26Connected", false).toBool();
+    mSettingsData.labelOverlayOpacity = settings.value("labelOverlayOpacity", 50).toUInt();
 
     ui->spinSVCubeness->setValue( settings.value("spinSVCubeness", 40).toInt() );
     ui->spinSVSeed->setValue( settings.value("spinSVSeed", 20).toInt() );
@@ -726,6 +937,14 @@ void AnnotatorWnd::saveSettings()
     settings.setValue( "spinSVZ", ui->spinSVZ->value() );
     settings.setValue( "fijiExePath", mSettingsData.fijiExePath );
     settings.setValue( "maxVoxForSVox", mSettingsData.maxVoxForSVox );
+    settings.setValue( "svBrickSize", mSettingsData.svBrickSize );
+    settings.setValue( "svBrickCacheMB", mSettingsData.svBrickCacheMB );
+    settings.setValue( "prefetchSlices", mSettingsData.prefetchSlices );
+    settings.setValue( "undoMemoryMB", mSettingsData.undoMemoryMB );
+    settings.setValue( "fillTolerance", mSettingsData.fillTolerance );
+    settings.setValue( "fillMaxVoxels", mSettingsData.fillMaxVoxels );
+    settings.setValue( "fill26Connected", mSettingsData.fill26Connected );
+    settings.setValue( "labelOverlayOpacity", mSettingsData.labelOverlayOpacity );
     settings.setValue( "sliceJump", mSettingsData.sliceJump );
 
 
@@ -743,6 +962,7 @@ void AnnotatorWnd::actionLoadScoreImageTriggered()
 
     std::string stdFName = fileName.toLocal8Bit().constData();
 
+    mPrefetcher->invalidate( true );
     if (!mScoreImage.load( stdFName ))
         QMessageBox::critical(this, "Cannot open file", QString("%1 could not be read.").arg(fileName));
 
@@ -830,35 +1050,42 @@ bool AnnotatorWnd:: loadAnnotation(const QString& fileName, int importAsLabel, L
 
     std::string stdFName = fileName.toLocal8Bit().constData();
 
-    if (!mVolumeLabels.load( stdFName )) {
+    // read to a volume of its own, the labels and their undo history are kept if it fails
+    Matrix3D<LabelType> loadedLabels;
+
+    if (!loadedLabels.load( stdFName )) {
         QMessageBox::critical(this, "Cannot open file", QString("%1 could not be read.").arg(fileName));
         return false;
     }
 
-    if ( (mVolumeLabels.width() != mVolumeData.width()) || (mVolumeLabels.height() != mVolumeData.height()) || (mVolumeLabels.depth() != mVolumeData.depth()) )
+    if ( !loadedLabels.isSizeLike( mVolumeData ) )
     {
-        QMessageBox::critical(this, "Dimensions do not match", "Annotation volume does not match original volume dimensions. Re-setting labels.");
-        mVolumeLabels.reallocSizeLike( mVolumeData );
-        mVolumeLabels.fill(0);
-        updateImageSlice();
+        QMessageBox::critical(this, "Dimensions do not match", "Annotation volume does not match original volume dimensions. The labels were not changed.");
         return false;
     }
 
     // check if we have to import it
     if ( importAsLabel >= 0 )
     {
-        const unsigned numEl = mVolumeLabels.numElem();
+        const unsigned numEl = loadedLabels.numElem();
         const LabelType label = (unsigned char) importAsLabel;
 
         for (unsigned i=0; i < numEl; i++)
         {
-            if ( mVolumeLabels.data()[i] >= threshold )
-                mVolumeLabels.data()[i] = label;
+            if ( loadedLabels.data()[i] >= threshold )
+                loadedLabels.data()[i] = label;
             else
-                mVolumeLabels.data()[i] = 0;
+                loadedLabels.data()[i] = 0;
         }
     }
 
+    // the labels are replaced, the previous ones are freed with loadedLabels.
+    //  The prefetcher renders the label layer too, so it has to be idle first
+    mPrefetcher->invalidate( true );
+    mVolumeLabels.swap( loadedLabels );
+    mUndoJournal.clear();
+    updateUndoActions();
+
     updateImageSlice();
     statusBarMsg("Annotation loaded successfully.");
 
@@ -914,15 +1141,25 @@ void AnnotatorWnd::actionLoadAnnotTriggered()
 
 Region3D AnnotatorWnd::getViewportRegion3D()
 {
-    // prepare Z range
-    int zMin = mCurZSlice - ui->spinSVZ->value();
-    int zMax = mCurZSlice + ui->spinSVZ->value();
+    // prepare range along the slice normal (Z for the XY view)
+    const int numSlices = mSliceAxes.numSlices( mVolumeData.width(), mVolumeData.height(), mVolumeData.depth() );
+    int nMin = curSlicePos() - ui->spinSVZ->value();
+    int nMax = curSlicePos() + ui->spinSVZ->value();
 
-    if (zMin < 0)   zMin = 0;
-    if (zMax >= mVolumeData.depth())    zMax = mVolumeData.depth() - 1;
+    if (nMin < 0)   nMin = 0;
+    if (nMax >= numSlices)    nMax = numSlices - 1;
 
-    // selected x,y region + whole z range
-    return Region3D( ui->labelImg->getViewableRect(), zMin, zMax - zMin + 1 );
+    const QRect r = mViewer->getViewableRect();
+
+    if ( mSliceAxes.orientation == SliceXY )    // selected x,y region + whole z range
+        return Region3D( r, nMin, nMax - nMin + 1 );
+
+    // selected u,v region + range along the normal, in volume coordinates
+    int x1, y1, z1, x2, y2, z2;
+    mSliceAxes.toVolume( r.left(), r.top(), nMin, x1, y1, z1 );
+    mSliceAxes.toVolume( r.right(), r.bottom(), nMax, x2, y2, z2 );
+
+    return Region3D( UIntPoint3D(x1, y1, z1), UIntPoint3D(x2, y2, z2) );
 }
 
 // this is a helper for genSupervoxelClicked()
@@ -972,6 +1209,8 @@ void AnnotatorWnd::loadSuperVoxelWholeVolumeClicked()
         return;
     }
 
+    mSVUseBricked = false;
+
     if ( (mSVoxel.pixelToVoxel().width() != mVolumeData.width()) || (mSVoxel.pixelToVoxel().height() != mVolumeData.height()) || (mSVoxel.pixelToVoxel().depth() != mVolumeData.depth()) )
     {
         QMessageBox::critical(this, "Dimensions do not match", "Supervoxel volume does not match original volume dimensions. Re-setting supervoxels.");
@@ -991,22 +1230,44 @@ void AnnotatorWnd::loadSuperVoxelWholeVolumeClicked()
     statusBarMsg("Supervoxel data loaded successfully.");
 }
 
-void AnnotatorWnd::saveSuperVoxelWholeVolumeClicked()
+bool AnnotatorWnd::globalSupervoxelsValid() const
+{
+    if (!mSVRegion.valid)   return false;
+    if ( (mSVRegion.corner.x != 0) || (mSVRegion.corner.y != 0) || (mSVRegion.corner.z != 0) ) return false;
+    if ( mSVRegion.size.x != mVolumeData.width() )  return false;
+    if ( mSVRegion.size.y != mVolumeData.height() )  return false;
+    if ( mSVRegion.size.z != mVolumeData.depth() )  return false;
+
+    return true;
+}
+
+const Matrix3D<unsigned int> * AnnotatorWnd::getGlobalSupervoxelMap( unsigned int *numSupervoxels )
 {
-    bool isOk = true;
+    // out-of-core supervoxels have no in-memory map
+    if ( mSVUseBricked || !globalSupervoxelsValid() || !mSVoxel.pixelToVoxel().isSizeLike( mVolumeData ) )
+        return 0;
 
-    if (!mSVRegion.valid)   isOk = false;
-    if ( (mSVRegion.corner.x != 0) || (mSVRegion.corner.y != 0) || (mSVRegion.corner.z != 0) ) isOk = false;
-    if ( mSVRegion.size.x != mVolumeData.width() )  isOk = false;
-    if ( mSVRegion.size.y != mVolumeData.height() )  isOk = false;
-    if ( mSVRegion.size.z != mVolumeData.depth() )  isOk = false;
+    if (numSupervoxels != 0)
+        *numSupervoxels = mSVoxel.numLabels();
 
-    if (!isOk)
+    return &mSVoxel.pixelToVoxel();
+}
+
+void AnnotatorWnd::saveSuperVoxelWholeVolumeClicked()
+{
+    if (!globalSupervoxelsValid())
     {
         QMessageBox::critical(this, "Error", "Global supervoxels must be computed before saving them.");
         return;
     }
 
+    if (mSVUseBricked)
+    {
+        QMessageBox::information(this, "Out-of-core supervoxels",
+                                 QString("Out-of-core supervoxels are already stored in %1").arg( QString::fromLocal8Bit( mSVBricked.folder().c_str() ) ));
+        return;
+    }
+
 
     QString fileName = QFileDialog::getSaveFileName( this, "Save supervoxel data", mSettingsData.savePath, "nrrd (*.nrrd)" );
 
@@ -1038,6 +1299,7 @@ void AnnotatorWnd::genSuperVoxelWholeVolumeClicked()
 
 
     mSelectedSV.valid = false;
+    mSVUseBricked = false;
 
     SupervoxelThread *thread = new SupervoxelThread( this, mSVoxel, mVolumeData, ui->spinSVSeed->value(), ui->spinSVCubeness->value() );
 
@@ -1046,6 +1308,120 @@ void AnnotatorWnd::genSuperVoxelWholeVolumeClicked()
     runThreadWithProgress<SupervoxelThread>( this, thread );
 }
 
+// helper for genSuperVoxelBrickedClicked()
+class BrickedSupervoxelThread : public QThread
+{
+ public:
+    typedef BrickedSupervoxels<PixelType>  SupervoxelerType;
+    typedef Matrix3D<PixelType>            VolumeType;
+
+protected:
+    SupervoxelerType  &mSVox;
+    const VolumeType  &mRawVolume;
+    unsigned int mBrickSize;
+    int mSeed;
+    unsigned int mCubeness;
+    std::string mFolder;
+    AnnotatorWnd *mParent;
+
+public:
+    BrickedSupervoxelThread(AnnotatorWnd *parent, SupervoxelerType &svox, const VolumeType &raw, unsigned int brickSize,
+             int seed, unsigned int cubeness, const std::string &folder) : QThread(parent), mSVox(svox), mRawVolume(raw),
+                                                mBrickSize(brickSize), mSeed(seed), mCubeness(cubeness), mFolder(folder), mParent(parent)
+    {
+    }
+
+    void run()
+    {
+        QString msg;
+        if ( mSVox.generate( mRawVolume, mBrickSize, mSeed, mCubeness, mFolder ) )
+            msg = QString("Done: %1 supervoxels generated.").arg( mSVox.numLabels() );
+        else
+            msg = QString("Error writing supervoxel bricks to %1").arg( QString::fromLocal8Bit( mFolder.c_str() ) );
+
+        QMetaObject::invokeMethod( mParent, "statusBarMsg", Qt::QueuedConnection, Q_ARG( QString, msg ) );
+    }
+};
+
+void AnnotatorWnd::useBrickedSupervoxels()
+{
+    if ( mSVBricked.empty() || !mSVBricked.isSizeLike( mVolumeData ) )
+    {
+        mSVUseBricked = false;
+        mSVRegion.valid = false;
+        updateImageSlice();
+        return;
+    }
+
+    mSVBricked.setCacheSizeMB( mSettingsData.svBrickCacheMB );
+
+    mSVUseBricked = true;
+    mSVRegion.valid = true;
+    mSVRegion.corner.x = mSVRegion.corner.y = mSVRegion.corner.z = 0;
+
+    mSVRegion.size.x = mVolumeData.width();
+    mSVRegion.size.y = mVolumeData.height();
+    mSVRegion.size.z = mVolumeData.depth();
+
+    updateImageSlice();
+}
+
+void AnnotatorWnd::genSuperVoxelBrickedClicked()
+{
+    QString folder = QFileDialog::getExistingDirectory( this, "Folder to store supervoxel bricks", mSettingsData.savePath );
+
+    if (folder.isEmpty())
+        return;
+
+    // the smallest brick side is the brick size (or the volume side, if smaller)
+    const unsigned minLength = std::min( mSettingsData.svBrickSize,
+                                         std::min( (unsigned)mVolumeData.width(), std::min( (unsigned)mVolumeData.height(), (unsigned)mVolumeData.depth() ) ) );
+    const unsigned maxSeed = ceil( minLength / 1.5 );
+
+    if ( ui->spinSVSeed->value() > maxSeed )
+    {
+         QMessageBox::critical( this, "Seed too large", QString("Selected seed size is too large. For this brick size it has to be at most %1.").arg(maxSeed) );
+         return;
+    }
+
+    mSelectedSV.valid = false;
+    mSVUseBricked = false;
+    mSVRegion.valid = false;
+
+    saveSettings();
+
+    BrickedSupervoxelThread *thread = new BrickedSupervoxelThread( this, mSVBricked, mVolumeData, mSettingsData.svBrickSize,
+                                                                   ui->spinSVSeed->value(), ui->spinSVCubeness->value(),
+                                                                   folder.toLocal8Bit().constData() );
+
+    connect( thread, SIGNAL(finished()), this, SLOT(useBrickedSupervoxels()) );
+
+    runThreadWithProgress<BrickedSupervoxelThread>( this, thread );
+}
+
+void AnnotatorWnd::loadSuperVoxelBrickedClicked()
+{
+    QString folder = QFileDialog::getExistingDirectory( this, "Folder with supervoxel bricks", mSettingsData.loadPathScores );
+
+    if (folder.isEmpty())
+        return;
+
+    mSelectedSV.valid = false;
+
+    if ( !mSVBricked.load( folder.toLocal8Bit().constData() ) ) {
+        QMessageBox::critical(this, "Cannot open folder", QString("No valid supervoxel bricks found in %1.").arg(folder));
+        return;
+    }
+
+    if ( !mSVBricked.isSizeLike( mVolumeData ) )
+        QMessageBox::critical(this, "Dimensions do not match", "Supervoxel volume does not match original volume dimensions. Re-setting supervoxels.");
+
+    useBrickedSupervoxels();
+
+    if (mSVUseBricked)
+        statusBarMsg("Supervoxel data loaded successfully.");
+}
+
 void AnnotatorWnd::genSupervoxelClicked()
 {
     //qDebug() << "Pos:  " << ui->labelImg->x() << " " <<  ui->labelImg->y();
@@ -1093,6 +1469,7 @@ void AnnotatorWnd::genSupervoxelClicked()
 
     //mSVoxel.apply( mCroppedVolumeData, ui->spinSVSeed->value(), ui->spinSVCubeness->value() );
     mSelectedSV.valid = false;
+    mSVUseBricked = false;
 
     // save supervoxel parameters
     saveSettings();
@@ -1187,6 +1564,13 @@ void AnnotatorWnd::runConnectivityCheck( const Region3D &reg )
         if( ui->autoLabel->isChecked() ){
 
             Matrix3D<LabelType> *overlayData = getSelectedOverlayData();
+
+            // the regions are inside the region they were computed for
+            beginUndoStep( "label regions" );
+            const Region3D &r = mLabelListData.region3D;
+            mUndoJournal.touch( overlayData, r.corner.x, r.corner.y, r.corner.z,
+                                r.corner.x + r.size.x - 1, r.corner.y + r.size.y - 1, r.corner.z + r.size.z - 1 );
+
             for(int i=0; i < lblCount; i++){
 
                 //TODO fix the labeling color
@@ -1194,6 +1578,7 @@ void AnnotatorWnd::runConnectivityCheck( const Region3D &reg )
 
             }
 
+            endUndoStep();
         }
     }
 }
@@ -1226,6 +1611,8 @@ void AnnotatorWnd::regionListFrameLabelRegion(uint regionIdx, uint labelId)
                                                    mSelectedSV.pixelList );
 
     mSelectedSV.valid = true;
+    mSelectedSV.isSupervoxel = false;
+    mSelectedSV.spansValid = false;
 
     annotateSupervoxel(mSelectedSV, labelId);
 
@@ -1251,9 +1638,17 @@ void AnnotatorWnd::regionListFrameIndexChanged(int newRegionIdx)
 
     centerPix.divideBy( mSelectedSV.pixelList.size() );
 
-    ui->zSlider->setValue( centerPix.z );
+    mCurXSlice = centerPix.x;
+    mCurYSlice = centerPix.y;
+    mCurZSlice = centerPix.z;
+
+    int u, v, n;
+    mSliceAxes.toSlice( centerPix.x, centerPix.y, centerPix.z, u, v, n );
+    ui->zSlider->setValue( n );
 
     mSelectedSV.valid = true;
+    mSelectedSV.isSupervoxel = false;
+    mSelectedSV.spansValid = false;
 
     updateImageSlice();
 }
@@ -1373,20 +1768,23 @@ void AnnotatorWnd::annotVis3DClicked()
         vG.reallocSizeLike( lblCropped );   // alloc for each color channel
         vB.reallocSizeLike( lblCropped );
 
-        vR.fill(0); vG.fill(0); vB.fill(0);
+        // unlabeled voxels and labels without a color stay black
+        const QRgb *palette = mLblColorList.palette();
+        unsigned char lutR[256], lutG[256], lutB[256];
+        for (unsigned int i=0; i < 256; i++)
+        {
+            lutR[i] = qRed( palette[i] );
+            lutG[i] = qGreen( palette[i] );
+            lutB[i] = qBlue( palette[i] );
+        }
 
         const unsigned int N = lblCropped.numElem();
-        const unsigned int maxLbl = mLblColorList.count();
+        const LabelType *lblPtr = lblCropped.data();
         for (unsigned int i=0; i < N; i++)
         {
-            LabelType lbl = lblCropped.data()[i];
-            if (lbl <= 0)   continue;
-
-            if (lbl > maxLbl) continue;
-
-            vR.data()[i] = mLblColorList.getColor(lbl-1).red();
-            vG.data()[i] = mLblColorList.getColor(lbl-1).green();
-            vB.data()[i] = mLblColorList.getColor(lbl-1).blue();
+            vR.data()[i] = lutR[ lblPtr[i] ];
+            vG.data()[i] = lutG[ lblPtr[i] ];
+            vB.data()[i] = lutB[ lblPtr[i] ];
         }
 
         // color
@@ -1443,10 +1841,27 @@ void AnnotatorWnd::dialOverlayTransparencyMoved( int value )
     if(ui->layersDisplay->currentRow() >= 0 )
         mOverlayInfo[ui->layersDisplay->currentRow()]->alpha = value * 1.0 / 100;
 
-    updateImageSlice();
+    // the OpenGL viewer only needs the new blending weights
+    if ( glViewerActive() )
+        mRedrawScheduler->request();
+    else
+        updateImageSlice();
 }
 
 
+void AnnotatorWnd::labelOverlayOpacityTriggered()
+{
+    bool ok;
+    const int opacity = QInputDialog::getInt( this, "Label overlay opacity", "Opacity of the color-coded labels (%):",
+                                              mSettingsData.labelOverlayOpacity, 0, 100, 5, &ok );
+    if ( !ok || (opacity == (int)mSettingsData.labelOverlayOpacity) )
+        return;
+
+    // the label layer tables are premultiplied by the opacity, rendered slices have to be composited again
+    mSettingsData.labelOverlayOpacity = opacity;
+    updateImageSlice();
+}
+
 void AnnotatorWnd::actionLabelOverlayTriggered()
 {
     ui->chkLabelOverlay->setChecked( ui->actionOverlay_labels->isChecked() );
@@ -1511,14 +1926,89 @@ void AnnotatorWnd::updateCursorPixelInfo(int x, int y, int z)
 
 void AnnotatorWnd::zSliderMoved(int newPos)
 {
-    mCurZSlice = newPos;
+    // the slider moves the displayed slice along its normal, Z for the XY view
+    int &pos = curSlicePos();
+    const int prevPos = pos;
+    const int numSlices = mSliceAxes.numSlices( mVolumeData.width(), mVolumeData.height(), mVolumeData.depth() );
+
+    pos = newPos;
+
+    if (pos < 0)
+        pos = 0;
+
+    if (pos >= numSlices)
+        pos = numSlices - 1;
+
+    // nothing was edited, the render cache only has to switch slices
+    mRedrawScheduler->request();
+
+    if (pos != prevPos)
+        prefetchSlices( (pos > prevPos) ? 1 : -1 );
+}
+
+int & AnnotatorWnd::curSlicePos()
+{
+    switch (mSliceAxes.orientation)
+    {
+        case SliceXZ:   return mCurYSlice;
+        case SliceYZ:   return mCurXSlice;
+        default:        return mCurZSlice;
+    }
+}
+
+unsigned int AnnotatorWnd::sliceWidth() const
+{
+    return mSliceAxes.sliceWidth( mVolumeData.width(), mVolumeData.height(), mVolumeData.depth() );
+}
+
+unsigned int AnnotatorWnd::sliceHeight() const
+{
+    return mSliceAxes.sliceHeight( mVolumeData.width(), mVolumeData.height(), mVolumeData.depth() );
+}
+
+const unsigned char * AnnotatorWnd::sliceAt( const Matrix3D<unsigned char> &vol, int pos )
+{
+    if ( mSliceAxes.orientation == SliceXY )
+        return vol.sliceData( pos );
+
+    // the volume only changes through plugins, overlays are edited all the time
+    if ( &vol == &mVolumeData )
+        return mOrthoBase.slice( vol, mSliceAxes, pos );
+
+    return mOrthoOverlays.slice( vol, mSliceAxes, pos );
+}
+
+void AnnotatorWnd::sliceOrientationTriggered()
+{
+    QAction *action = qobject_cast<QAction *>( sender() );
+    if ( action == 0 )
+        return;
+
+    setSliceOrientation( (SliceOrientation) action->data().toInt() );
+}
+
+void AnnotatorWnd::setSliceOrientation( SliceOrientation orientation )
+{
+    if ( orientation == mSliceAxes.orientation )
+        return;
+
+    mSliceAxes = SliceAxes( orientation );
+
+    // spans are in slice coordinates
+    mSelectedSV.spansValid = false;
 
-    if (mCurZSlice < 0)
-        mCurZSlice = 0;
+    // the slice has another size, the base layer is rebuilt on the next render
+    mRenderCache.invalidateBase();
 
-    if (mCurZSlice >= mVolumeData.depth())
-        mCurZSlice = mVolumeData.depth() - 1;
+    const int numSlices = mSliceAxes.numSlices( mVolumeData.width(), mVolumeData.height(), mVolumeData.depth() );
+    const int pos = curSlicePos();
 
+    ui->zSlider->blockSignals(true);
+    ui->zSlider->setMaximum( numSlices - 1 );
+    ui->zSlider->setValue( pos );
+    ui->zSlider->blockSignals(false);
+
+    // both viewers recenter when the image size changes
     updateImageSlice();
 }
 
@@ -1527,7 +2017,29 @@ void AnnotatorWnd::updateImageSlice(int)
     updateImageSlice();
 }
 
-bool AnnotatorWnd::constraintsUpdateImagesliceCallback(QImage &slice)
+// blends the layers over rect of qimg (RGB32), whose pixels are indexed as the layer slices
+static void compositeRect( const OverlayCompositor &layers, QImage &qimg, const QRect &rect )
+{
+    const QRect r = rect.intersected( qimg.rect() );
+
+    if ( (layers.numLayers() == 0) || r.isEmpty() )
+        return;
+
+    unsigned int *pixPtr = (unsigned int *) qimg.constBits(); // trick!
+    const unsigned int w = qimg.width();
+
+    if ( r == qimg.rect() )
+        layers.composite( pixPtr, pixPtr, w * qimg.height() );
+    else
+    {
+        for (int y = r.top(); y <= r.bottom(); y++) {
+            const unsigned int off = y * w + r.left();
+            layers.composite( pixPtr + off, pixPtr + off, r.width(), off );
+        }
+    }
+}
+
+bool AnnotatorWnd::constraintsUpdateImagesliceCallback( QImage &slice, const QRect &rect )
 {
     if (!mConstraintsDisplayTimer->isActive())
         return false;
@@ -1535,14 +2047,14 @@ bool AnnotatorWnd::constraintsUpdateImagesliceCallback(QImage &slice)
     if ( !ui->groupBoxRestrictPixLabels->isChecked() )
         return false;
 
-    const PixelType *imgPtr = mVolumeData.sliceData( mCurZSlice );
-    unsigned int *pixPtr = (unsigned int *) slice.constBits(); // trick!
-    unsigned int sz = mVolumeData.width() * mVolumeData.height();
+    const PixelType *imgPtr = sliceAt( mVolumeData, curSlicePos() );
 
     const unsigned char minThr = ui->spinPixMin->value();
     const unsigned char maxThr = ui->spinPixMax->value();
 
-    overlayRGBThresholded( pixPtr, imgPtr, pixPtr, sz, mScoreColor, minThr, maxThr, false );
+    mOverlayCompositor.clear();
+    mOverlayCompositor.addLayer( imgPtr, mScoreColor.red(), mScoreColor.green(), mScoreColor.blue(), 1.0, minThr, maxThr, false );
+    compositeRect( mOverlayCompositor, slice, rect );
 
     return true;
 }
@@ -1580,165 +2092,821 @@ void AnnotatorWnd::on_cubeBrushSizeZ_valueChanged(int depth){
 
 void AnnotatorWnd::updateImageSlice()
 {
-    QImage qimg;
+    // labels/overlays may have changed, only the gray slice can be reused
+    mRenderCache.invalidateOverlays();
+    mOrthoOverlays.invalidate();
+    if ( mPrefetcher != 0 )
+        mPrefetcher->invalidate();
+    if ( mGLView != 0 )
+        mGLView->invalidateOverlays();
+    mRedrawScheduler->request();
+}
 
-    mVolumeData.QImageSlice( mCurZSlice, qimg );
+void AnnotatorWnd::updateImageSlice( const QRect &changedRect )
+{
+    invalidateSliceOverlays( changedRect );
+    mRedrawScheduler->request();
+}
 
-    // hide?
-    if ( ui->actionHide_volume->isChecked() )
-        qimg.fill( Qt::black );
+void AnnotatorWnd::invalidateSliceOverlays( const QRect &changedRect )
+{
+    // only the overlays inside changedRect have to be composited again
+    mRenderCache.invalidateOverlays( changedRect );
+    mOrthoOverlays.invalidate( changedRect );
+    if ( mPrefetcher != 0 )
+        mPrefetcher->invalidate();
+    if ( mGLView != 0 )
+        mGLView->invalidateOverlays( changedRect );
+}
 
-    if (constraintsUpdateImagesliceCallback(qimg))
-    {
-        // just update and return
-        ui->labelImg->setImage(qimg);
+void AnnotatorWnd::paintBrushStroke()
+{
+    const StrokeBounds pending = mBrushStroke.pendingBounds();
+    if ( !pending.valid )
         return;
-    }
 
+    mUndoJournal.touch( mBrushStroke.data(), pending.x0, pending.y0, pending.z0, pending.x1, pending.y1, pending.z1 );
 
-    // score overlay?
-    if ( mScoreImageEnabled )
-    {
-        // sanity check
-        if ( !mScoreImage.isSizeLike( mVolumeData ) ) {
-            qWarning("mScoreImageEnabled == true but score image is not of valid size");
-        }
-        else
-        {
-            // use as red channel
-            const PixelType *scorePtr = mScoreImage.sliceData( mCurZSlice );
-            unsigned int *pixPtr = (unsigned int *) qimg.constBits(); // trick!
-            unsigned int sz = mVolumeLabels.width() * mVolumeLabels.height();
+    const StrokeBounds bounds = mBrushStroke.paintPending();
+    invalidateVolumeBox( bounds.x0, bounds.y0, bounds.z0, bounds.x1, bounds.y1, bounds.z1 );
+}
 
-            const unsigned char minThr = ui->spinScoreThrAbove->value();
-            const unsigned char maxThr = ui->spinScoreThrBelow->value();
+void AnnotatorWnd::invalidateVolumeBox( int x0, int y0, int z0, int x1, int y1, int z1 )
+{
+    // keep the part of the box on the displayed slice
+    int u0, v0, n0, u1, v1, n1;
+    mSliceAxes.toSlice( x0, y0, z0, u0, v0, n0 );
+    mSliceAxes.toSlice( x1, y1, z1, u1, v1, n1 );
 
-            if (minThr == 0 && maxThr==255)
-                overlayRGB( pixPtr, scorePtr, pixPtr, sz, mScoreColor );
-            else
-                overlayRGBThresholded( pixPtr, scorePtr, pixPtr, sz, mScoreColor, minThr, maxThr, ui->chkHardThreshold->isChecked() );
-        }
-    }
+    QRect changedRect;
+    if ( (n0 <= curSlicePos()) && (curSlicePos() <= n1) )
+        changedRect = QRect( QPoint(u0, v0), QPoint(u1, v1) );
 
-    // user-overlays
-    for (unsigned int overlayIdx=0; overlayIdx < mOverlayMenuActions.size(); overlayIdx++)
-    {
-        if ( !mOverlayVolumeList[overlayIdx]->isSizeLike( mVolumeData ) )
-            continue;
-        if ( !mOverlayMenuActions[overlayIdx]->isChecked() )
-            continue;
+    invalidateSliceOverlays( changedRect );
+}
 
-        //int floatTransp = 256 * mOverlayInfo[overlayIdx]->alpha;
-        //int floatTranspInv = 256 - floatTransp;
-        const OverlayType *scorePtr = mOverlayVolumeList[overlayIdx]->sliceData( mCurZSlice );
-        unsigned int *pixPtr = (unsigned int *) qimg.constBits(); // trick!
-        unsigned int sz = mVolumeLabels.width() * mVolumeLabels.height();
+void AnnotatorWnd::finishPluginStroke()
+{
+    if ( !mPluginStrokeOpen )
+        return;
 
+    mPluginStrokeOpen = false;
+    endUndoStep();
+}
 
-        const QColor &color = mOverlayColorList.getColor(overlayIdx);
+void AnnotatorWnd::finishBrushStroke()
+{
+    if ( !mBrushStroke.active() )
+        return;
 
-        overlayRGB( pixPtr, scorePtr, pixPtr, sz, color, mOverlayInfo[overlayIdx]->alpha );
+    paintBrushStroke();
+    mBrushStroke.end();
+    endUndoStep();
 
-    }
+    mRedrawScheduler->request();
+}
 
-    // check ground truth slice and draw it
-    /*
-    if (mOverlayLabelImage)
-    {
-        //int intTransp = 255*mOverlayLabelImageTransparency;
-        int floatTransp = 256 * mOverlayLabelImageTransparency;
-        int floatTranspInv = 256 - floatTransp;
+void AnnotatorWnd::beginUndoStep( const QString &name )
+{
+    mUndoJournal.beginStep( name );
+}
 
-        const LabelType *lblPtr = mVolumeLabels.sliceData( mCurZSlice );
-        unsigned int *pixPtr = (unsigned int *) qimg.constBits(); // trick!
+void AnnotatorWnd::endUndoStep()
+{
+    if ( !mUndoJournal.endStep() )
+        statusBarMsg( "The last change was too large for the undo memory or reallocated a volume, the undo history was cleared.", 3000 );
 
-        unsigned int sz = mVolumeLabels.width() * mVolumeLabels.height();
-        int maxLabel = (int) mLblColorList.count();
+    updateUndoActions();
+}
 
-        for (unsigned int i=0; i < sz; i++)
-        {
-            if ( lblPtr[i] == 0 )
-                continue;   // unlabeled, we don't care
+void AnnotatorWnd::updateUndoActions()
+{
+    if ( mUndoAction == 0 )
+        return;     // not created yet
 
-            if (lblPtr[i] > maxLabel) {
-                qDebug("Label exceed possible colors: %d", (int)lblPtr[i]);
-                continue;
-            }
+    mUndoAction->setEnabled( mUndoJournal.canUndo() );
+    mUndoAction->setText( mUndoJournal.canUndo() ? "Undo " + mUndoJournal.undoName() : QString("Undo") );
+
+    mRedoAction->setEnabled( mUndoJournal.canRedo() );
+    mRedoAction->setText( mUndoJournal.canRedo() ? "Redo " + mUndoJournal.redoName() : QString("Redo") );
+}
+
+void AnnotatorWnd::undoTriggered()
+{
+    // a stroke being dragged is a step of its own
+    finishBrushStroke();
+    finishPluginStroke();
+
+    if ( !mUndoJournal.canUndo() )
+        return;
+
+    std::vector<UndoJournal::Change> changes;
+    const QString name = mUndoJournal.undoName();
+    if ( !mUndoJournal.undo( changes ) )
+        statusBarMsg( "The volumes were modified outside of the undo history, it was cleared.", 3000 );
+    else
+        statusBarMsg( "Undone: " + name );
+
+    for (unsigned int i=0; i < changes.size(); i++)
+        invalidateVolumeBox( changes[i].x0, changes[i].y0, changes[i].z0, changes[i].x1, changes[i].y1, changes[i].z1 );
+
+    updateUndoActions();
+    mRedrawScheduler->request();
+}
+
+void AnnotatorWnd::redoTriggered()
+{
+    finishBrushStroke();
+    finishPluginStroke();
+
+    if ( !mUndoJournal.canRedo() )
+        return;
+
+    std::vector<UndoJournal::Change> changes;
+    const QString name = mUndoJournal.redoName();
+    if ( !mUndoJournal.redo( changes ) )
+        statusBarMsg( "The volumes were modified outside of the undo history, it was cleared.", 3000 );
+    else
+        statusBarMsg( "Redone: " + name );
+
+    for (unsigned int i=0; i < changes.size(); i++)
+        invalidateVolumeBox( changes[i].x0, changes[i].y0, changes[i].z0, changes[i].x1, changes[i].y1, changes[i].z1 );
+
+    updateUndoActions();
+    mRedrawScheduler->request();
+}
+
+void AnnotatorWnd::updateCursorLayer()
+{
+    mRedrawScheduler->request();
+}
+
+// brush extents are along x,y,z: returns a brush of the same shape with its extents along the
+//  axes of the displayed slice, to draw the cursor
+static SizedBrush *orientedBrush( const SizedBrush &brush, bool sphere, const SliceAxes &axes )
+{
+    static CubeBrush cube;
+    static SphereBrush ellipsoid;
+
+    SizedBrush *oriented = &cube;
+    if (sphere)
+        oriented = &ellipsoid;
+
+    const int ext[3] = { brush.width, brush.height, brush.depth };
+    oriented->setSize( ext[axes.uAxis], ext[axes.vAxis], ext[axes.nAxis] );
+
+    return oriented;
+}
+
+// gray slice p (of qimg's width) to RGB32 as Matrix3D::QImageSlice() does, only inside rect.
+//  If p is 0 the rect is filled with black
+static void grayToRGB32( const unsigned char *p, QImage &qimg, const QRect &rect )
+{
+    const unsigned int w = qimg.width();
+
+    for (int y = rect.top(); y <= rect.bottom(); y++)
+    {
+        unsigned int *dataPtr = ((unsigned int *) qimg.scanLine(y)) + rect.left();
+
+        if ( p == 0 ) {
+            std::fill( dataPtr, dataPtr + rect.width(), 0xFF000000 );
+            continue;
+        }
+
+        const unsigned char *src = p + y * w + rect.left();
+        for (int i=0; i < rect.width(); i++) {
+            unsigned int D = src[i];
+            dataPtr[i] = D | (D<<8) | (D<<16) | (0xFF<<24);
+        }
+    }
+}
+
+void AnnotatorWnd::renderSlice()
+{
+    // the positions dragged through since the last render are painted at once
+    paintBrushStroke();
+
+    if ( glViewerActive() ) {
+        renderSliceGL();
+        return;
+    }
+
+    mRenderStats.beginFrame();
+
+    const bool hidden = ui->actionHide_volume->isChecked();
+    const int sliceKey = mSliceAxes.orientation + 3 * curSlicePos();
 
-            int vv = (floatTransp * (pixPtr[i] & 0xFF))/256;
+    // while scrolling, the slice may have been rendered in the background already (XY only)
+    if ( mRenderCache.needsBase( sliceKey, hidden ) && (mPrefetcher != 0) && (mSliceAxes.orientation == SliceXY) )
+    {
+        RenderStageTimer timer( mRenderStats, RenderStats::Fetch );
+
+        QImage base, composited;
+        if ( mPrefetcher->lookup( mCurZSlice, hidden, base, composited ) )
+            mRenderCache.adopt( sliceKey, hidden, base, composited );
+    }
+
+    if ( mRenderCache.needsBase( sliceKey, hidden ) )
+        mRenderCache.beginBase( sliceKey, hidden, QSize( sliceWidth(), sliceHeight() ) );
+
+    // only the visible area (plus a margin, so that small pans render nothing) is rendered,
+    //  the rest when it is scrolled into view
+    QRect needed = ui->labelImg->getViewableRect();
+    if ( !needed.isEmpty() )
+    {
+        const int margin = std::max( 64, std::max( needed.width(), needed.height() ) / 4 );
+        needed.adjust( -margin, -margin, margin, margin );
+    }
+    mRenderCache.setNeededRect( needed );
 
-            const QColor &color = mLblColorList.getColor(lblPtr[i] - 1);
+    if ( mRenderCache.needsBaseRects() )
+    {
+        QVector<QRect> rects;
+        QImage &base = mRenderCache.beginBaseRects( rects );
+
+        // hide?
+        const unsigned char *grayPtr = 0;
+        if ( !hidden ) {
+            RenderStageTimer timer( mRenderStats, RenderStats::Fetch );
+            grayPtr = sliceAt( mVolumeData, curSlicePos() );
+        }
+
+        RenderStageTimer timer( mRenderStats, RenderStats::Gray );
+        for (int i=0; i < rects.size(); i++)
+            grayToRGB32( grayPtr, base, rects[i] );
+    }
+
+    // while the pixel constraints are being shown, there are no overlays nor cursor
+    const bool constraintsPreview = mConstraintsDisplayTimer->isActive() && ui->groupBoxRestrictPixLabels->isChecked();
+
+    if ( mRenderCache.needsCompositedRects() )
+    {
+        RenderStageTimer timer( mRenderStats, RenderStats::Blend );
 
-            int g = vv + (floatTranspInv * color.green()) / 256;
-            int b = vv + (floatTranspInv * color.blue()) / 256;
-            int r = vv + (floatTranspInv * color.red()) / 256;
+        QVector<QRect> rects;
+        QImage &composited = mRenderCache.beginCompositedRects( rects );
+
+        for (int i=0; i < rects.size(); i++)
+            if ( !constraintsUpdateImagesliceCallback( composited, rects[i] ) )
+                compositeOverlays( composited, rects[i] );
+    }
+
+    {
+        RenderStageTimer timer( mRenderStats, RenderStats::Selection );
+
+        QImage &frame = mRenderCache.beginTransient();
+        QRect transientRect;
+
+        if ( !constraintsPreview )
+            transientRect = drawTransientLayer( frame );
+
+        mRenderCache.endTransient( transientRect );
+    }
+
+    {
+        RenderStageTimer timer( mRenderStats, RenderStats::Cursor );
+        updateBrushCursor( !constraintsPreview );
+    }
+
+    if ( !mRenderCache.dirtyRect().isEmpty() )
+    {
+        RenderStageTimer timer( mRenderStats, RenderStats::Upload );
+        ui->labelImg->setImage( mRenderCache.frame(), mRenderCache.dirtyRect() );
+    }
+}
+
+void AnnotatorWnd::prefetchSlices( int direction )
+{
+    // XZ/YZ slices are extracted on demand, the prefetcher renders XY slices only
+    if ( (mPrefetcher == 0) || glViewerActive() || (mSliceAxes.orientation != SliceXY) )
+        return;
+
+    // slices look different while the pixel constraints are shown
+    if ( mConstraintsDisplayTimer->isActive() && ui->groupBoxRestrictPixLabels->isChecked() )
+        return;
+
+    const bool hidden = ui->actionHide_volume->isChecked();
+
+    std::vector<SlicePrefetcher::Job> jobs;
+    for (unsigned int k=1; k <= mSettingsData.prefetchSlices; k++)
+    {
+        const int z = mCurZSlice + direction * (int)k;
+        if ( (z < 0) || (z >= (int)mVolumeData.depth()) )
+            break;
+
+        SlicePrefetcher::Job job;
+        job.z = z;
+        job.hidden = hidden;
+        collectOverlayLayers( job.layers, z );
+
+        jobs.push_back( job );
+    }
+
+    mPrefetcher->request( jobs );
+}
+
+void AnnotatorWnd::collectOverlayLayers( OverlayCompositor &layers, int pos, bool withLabels )
+{
+    layers.clear();
+
+    // score overlay?
+    if ( mScoreImageEnabled )
+    {
+        // sanity check
+        if ( !mScoreImage.isSizeLike( mVolumeData ) ) {
+            qWarning("mScoreImageEnabled == true but score image is not of valid size");
+        }
+        else
+        {
+            const PixelType *scorePtr = sliceAt( mScoreImage, pos );
 
-            QColor c = QColor::fromRgb( r,g,b );
+            const unsigned char minThr = ui->spinScoreThrAbove->value();
+            const unsigned char maxThr = ui->spinScoreThrBelow->value();
 
-            pixPtr[i] = c.rgb();
+            if (minThr == 0 && maxThr==255)
+                layers.addLayer( scorePtr, mScoreColor.red(), mScoreColor.green(), mScoreColor.blue(), 0.5 );
+            else
+                layers.addLayer( scorePtr, mScoreColor.red(), mScoreColor.green(), mScoreColor.blue(), 1.0,
+                                 minThr, maxThr, ui->chkHardThreshold->isChecked() );
         }
     }
-    */
 
+    // user-overlays
+    for (unsigned int overlayIdx=0; overlayIdx < mOverlayMenuActions.size(); overlayIdx++)
+    {
+        if ( !mOverlayVolumeList[overlayIdx]->isSizeLike( mVolumeData ) )
+            continue;
+        if ( !mOverlayMenuActions[overlayIdx]->isChecked() )
+            continue;
+
+        const OverlayType *scorePtr = sliceAt( *mOverlayVolumeList[overlayIdx], pos );
+
+        const QColor &color = mOverlayColorList.getColor(overlayIdx);
+
+        layers.addLayer( scorePtr, color.red(), color.green(), color.blue(), mOverlayInfo[overlayIdx]->alpha );
+    }
+
+    // color-coded labels on top
+    if ( withLabels && mOverlayLabelImage && mVolumeLabels.isSizeLike( mVolumeData ) )
+        layers.addPaletteLayer( sliceAt( mVolumeLabels, pos ), mLblColorList.palette(), mSettingsData.labelOverlayOpacity / 100.0f );
+}
+
+void AnnotatorWnd::compositeOverlays( QImage &qimg, const QRect &rect )
+{
+    // score image and overlays are collected as layers and blended in a single pass
+    collectOverlayLayers( mOverlayCompositor, curSlicePos() );
+    compositeRect( mOverlayCompositor, qimg, rect );
+}
+
+QRect AnnotatorWnd::drawTransientLayer( QImage &qimg )
+{
     if (mSelectedSV.valid)  //if selection is valid, draw highlight
     {
-        const qreal opacity = 0.6;
-        const qreal invOpacity = 0.99 - opacity;
+        updateSVSelectionPixels( mSelectedSV );
+
+        unsigned int xMin, yMin, xMax, yMax;
+        if ( !mSelectedSV.spans.sliceBounds( curSlicePos(), xMin, yMin, xMax, yMax ) )
+            return QRect();
+
+        // only the runs of the current slice are visited, clipped to the rendered area
+        QRect clip = qimg.rect();
+        if ( !mRenderCache.neededRect().isEmpty() )
+            clip = clip.intersected( mRenderCache.neededRect() );
 
-        const qreal cRd = mSelectionColor.redF() * opacity;
-        const qreal cGr = mSelectionColor.greenF() * opacity;
-        const qreal cBl = mSelectionColor.blueF() * opacity;
+        unsigned int *pixPtr = (unsigned int *) qimg.bits();
+        const unsigned int w = qimg.width();
 
-        for (int i=0; i < mSelectedSV.pixelList.size(); i++)
+        const SliceSpan *spanEnd = mSelectedSV.spans.sliceEnd( curSlicePos() );
+        for (const SliceSpan *span = mSelectedSV.spans.sliceBegin( curSlicePos() ); span != spanEnd; ++span)
         {
-            unsigned int z = mSelectedSV.pixelList[i].coords.z;
-            if ( mCurZSlice != z )
+            if ( ((int)span->y < clip.top()) || ((int)span->y > clip.bottom()) )
                 continue;
 
-            unsigned int x = mSelectedSV.pixelList[i].coords.x;
-            unsigned int y = mSelectedSV.pixelList[i].coords.y;
+            const int x0 = std::max( (int)span->x0, clip.left() );
+            const int x1 = std::min( (int)span->x1, clip.right() );
+            if ( x0 <= x1 )
+                blendSpanRGB( pixPtr + span->y * w + x0, x1 - x0 + 1, mSelectionColor, 0.6 );
+        }
+
+        return QRect( QPoint(xMin, yMin), QPoint(xMax, yMax) ).intersected( clip );
+    }
+
+    // the brush cursor is not drawn on the slice, see updateBrushCursor()
+    return QRect();
+}
+
+void AnnotatorWnd::updateBrushCursor( bool visible )
+{
+    // the selection highlight replaces the cursor, as in the OpenGL viewer
+    if ( !visible || mSelectedSV.valid || (mCurX < 0) || (mCurY < 0) ) {
+        ui->labelImg->hideBrushCursor();
+        return;
+    }
+
+    SizedBrush *brush = &cubeBrush;
+    if( ui->brushToolSphere->isChecked())
+        brush = &sphereBrush;
+
+    // the cursor is shown with the brush extents along the slice axes
+    brush = orientedBrush( *brush, ui->brushToolSphere->isChecked(), mSliceAxes );
+
+    // brushes cover [x - width, x + width) x [y - height, y + height)
+    ui->labelImg->setBrushCursor( QRect( mCurX - brush->width, mCurY - brush->height, 2 * brush->width, 2 * brush->height ),
+                                  ui->brushToolSphere->isChecked(), mSelectionColor );
+}
+
+bool AnnotatorWnd::glViewerActive() const
+{
+    return (mGLView != 0) && mGLViewerAction->isChecked();
+}
+
+void AnnotatorWnd::renderSliceGL()
+{
+    // XZ/YZ slices of every position are extracted to the same buffers, so their pointers
+    //  do not tell the slices apart
+    const int sliceKey = mSliceAxes.orientation + 3 * curSlicePos();
+    if ( (sliceKey != mGLSliceKey) && (mSliceAxes.orientation != SliceXY) )
+    {
+        mGLView->invalidateBase();
+        mGLView->invalidateOverlays();
+    }
+    mGLSliceKey = sliceKey;
+
+    // textures are only uploaded if the slice pointers changed or were invalidated
+    mGLView->setBase( sliceAt( mVolumeData, curSlicePos() ), sliceWidth(), sliceHeight(),
+                      ui->actionHide_volume->isChecked() );
+
+    // while the pixel constraints are being shown, there are no overlays nor cursor
+    const bool constraintsPreview = mConstraintsDisplayTimer->isActive() && ui->groupBoxRestrictPixLabels->isChecked();
+
+    if ( constraintsPreview )
+    {
+        // same layer as in constraintsUpdateImagesliceCallback()
+        mOverlayCompositor.clear();
+        mOverlayCompositor.addLayer( sliceAt( mVolumeData, curSlicePos() ), mScoreColor.red(), mScoreColor.green(), mScoreColor.blue(),
+                                     1.0, ui->spinPixMin->value(), ui->spinPixMax->value(), false );
+    }
+    else
+        collectOverlayLayers( mOverlayCompositor, curSlicePos(), false );   // labels have their own texture
+
+    if ( mOverlayLabelImage && !constraintsPreview )
+        mGLView->setLabels( sliceAt( mVolumeLabels, curSlicePos() ), mLblColorList.palette(), mSettingsData.labelOverlayOpacity / 100.0f );
+    else
+        mGLView->setLabels( 0, 0, 0 );
+
+    // the cursor is the topmost layer
+    const QRect cursorChanged = drawCursorMask( !constraintsPreview );
+    mGLView->invalidateOverlays( cursorChanged );
+
+    if ( !constraintsPreview )
+        mOverlayCompositor.addLayer( mCursorMask.data(), mSelectionColor.red(), mSelectionColor.green(), mSelectionColor.blue(), 0.6 );
+
+    mGLView->setLayers( mOverlayCompositor );
+}
+
+QRect AnnotatorWnd::drawCursorMask( bool visible )
+{
+    const unsigned int w = sliceWidth();
+    const unsigned int h = sliceHeight();
+
+    QRect changed = mCursorMaskRect;
 
-            QColor pixColor = QColor::fromRgb( qimg.pixel(x, y) );
+    if ( (mCursorMask.width() != w) || (mCursorMask.height() != h) )
+    {
+        mCursorMask.realloc( w, h, 1 );
+        mCursorMask.fill( 0 );
+        changed = QRect( 0, 0, w, h );
+    }
+    else
+    {
+        // remove the previous cursor
+        for (int y = mCursorMaskRect.top(); y <= mCursorMaskRect.bottom(); y++)
+            std::fill( mCursorMask.data() + y * w + mCursorMaskRect.left(),
+                       mCursorMask.data() + y * w + mCursorMaskRect.right() + 1, 0 );
+    }
 
-            qreal r = pixColor.redF() * invOpacity + cRd;
-            qreal g = pixColor.greenF() * invOpacity + cGr;
-            qreal b = pixColor.blueF() * invOpacity + cBl;
+    mCursorMaskRect = QRect();
 
-            qimg.setPixel( x, y, QColor::fromRgbF( r, g, b ).rgb() );
+    if ( !visible )
+        return changed;
+
+    if (mSelectedSV.valid)  //if selection is valid, draw highlight
+    {
+        updateSVSelectionPixels( mSelectedSV );
+
+        unsigned int xMin, yMin, xMax, yMax;
+        if ( mSelectedSV.spans.sliceBounds( curSlicePos(), xMin, yMin, xMax, yMax ) )
+        {
+            OverlayType *maskPtr = mCursorMask.data();
+
+            const SliceSpan *spanEnd = mSelectedSV.spans.sliceEnd( curSlicePos() );
+            for (const SliceSpan *span = mSelectedSV.spans.sliceBegin( curSlicePos() ); span != spanEnd; ++span)
+                std::fill( maskPtr + span->y * w + span->x0, maskPtr + span->y * w + span->x1 + 1, 255 );
+
+            mCursorMaskRect = QRect( QPoint(xMin, yMin), QPoint(xMax, yMax) );
         }
-    }else{ //if mouse point valid
+    }
+    else
+    {
+        SizedBrush *brush = &cubeBrush;
+        if( ui->brushToolSphere->isChecked())
+            brush = &sphereBrush;
 
-        if (ui->brushToolCube->isChecked()){
-            cubeBrush.paint(qimg, mCurX, mCurY, mSelectionColor);
-        }else if( ui->brushToolSphere->isChecked())
-            sphereBrush.paint(qimg, mCurX, mCurY, mSelectionColor);
+        // the cursor is drawn with the brush extents along the slice axes
+        brush = orientedBrush( *brush, ui->brushToolSphere->isChecked(), mSliceAxes );
+
+        // the mask is a single slice, so the brush is painted at z = 0
+        brush->paint( mCursorMask, mCurX, mCurY, 0, 255 );
+
+        mCursorMaskRect = QRect( mCurX - brush->width, mCurY - brush->height, 2 * brush->width, 2 * brush->height ).intersected( QRect(0, 0, w, h) );
+    }
+
+    return changed | mCursorMaskRect;
+}
+
+void AnnotatorWnd::useGLViewer( bool enable )
+{
+    if ( enable && (mGLView == 0) )
+    {
+        mGLView = new GLSliceView( ui->centralWidget );
+
+        if ( !mGLView->initShaders() )
+        {
+            delete mGLView;
+            mGLView = 0;
+
+            QMessageBox::warning( this, "OpenGL viewer", "OpenGL 2.0 is not available, using the default viewer." );
+            mGLViewerAction->setChecked( false );
+            return;
+        }
+
+        ui->horizontalLayout->insertWidget( ui->horizontalLayout->indexOf( ui->labelImg ), mGLView );
+
+        connect(mGLView,SIGNAL(wheelEventSignal(QWheelEvent*)),this,SLOT(labelImageWheelEvent(QWheelEvent*)));
+        connect(mGLView,SIGNAL(mouseMoveEventSignal(QMouseEvent*)),this,SLOT(labelImageMouseMoveEvent(QMouseEvent*)));
+        connect(mGLView,SIGNAL(mouseReleaseEventSignal(QMouseEvent*)),this,SLOT(labelImageMouseReleaseEvent(QMouseEvent*)));
+
+        mGLView->setMouseTracking(true);
+
+        connect( ui->actionZoom_fit, SIGNAL(triggered()), mGLView, SLOT(zoomFit()) );
+    }
+
+    if ( mGLView == 0 )
+        return;
+
+    if ( enable )
+    {
+        ui->labelImg->hide();
+        mGLView->show();
+        mViewer = mGLView;
+    }
+    else
+    {
+        mGLView->hide();
+        ui->labelImg->show();
+        mViewer = ui->labelImg;
+
+        // the graphics view missed all updates in the meantime
+        mRenderCache.invalidateBase();
+    }
+
+    updateImageSlice();
+}
+
+void AnnotatorWnd::showRenderStats( bool show )
+{
+    mRenderStats.setEnabled( show || mRenderStatsLogAction->isChecked() );
+
+    mRenderStatsLabel->setVisible( show );
+    if (show) {
+        mRenderStats.clear();
+        updateRenderStatsLabel();
+        mRenderStatsTimer->start();
+    }
+    else
+        mRenderStatsTimer->stop();
+}
+
+void AnnotatorWnd::logRenderStats( bool log )
+{
+    if (log)
+    {
+        QString fileName = QFileDialog::getSaveFileName( this, "Log render timings", QString(), "CSV files (*.csv)" );
+        if ( fileName.isEmpty() || !mRenderStats.openLog( fileName ) )
+        {
+            if ( !fileName.isEmpty() )
+                QMessageBox::critical( this, "Error", "Could not open " + fileName );
+
+            mRenderStatsLogAction->blockSignals(true);
+            mRenderStatsLogAction->setChecked(false);
+            mRenderStatsLogAction->blockSignals(false);
+            return;
+        }
+
+        statusBarMsg( "Logging render timings to " + fileName );
+    }
+    else
+        mRenderStats.closeLog();
+
+    mRenderStats.setEnabled( log || mRenderStatsAction->isChecked() );
+}
+
+void AnnotatorWnd::updateRenderStatsLabel()
+{
+    mRenderStatsLabel->setText( mRenderStats.summary() );
+    mRenderStatsLabel->setToolTip( "<pre>" + mRenderStats.details() + "</pre>" );
+}
+
+void AnnotatorWnd::viewportPainted( qint64 nsecs )
+{
+    mRenderStats.add( RenderStats::Paint, nsecs );
+}
+
+void AnnotatorWnd::updateSVSelectionPixels( SupervoxelSelection &SV )
+{
+    if ( !SV.valid )
+        return;
+
+    if ( SV.isSupervoxel )
+        updateSVSelectionPixelList( SV );
+
+    if ( !SV.spansValid )
+    {
+        const unsigned int w = mVolumeData.width(), h = mVolumeData.height(), d = mVolumeData.depth();
+
+        if ( mSliceAxes.orientation == SliceXY )
+            SV.spans.build( SV.pixelList, w, h, d );
         else
-            cubeBrush.paint(qimg, mCurX, mCurY, mSelectionColor);
-     }
+        {
+            // spans are along the slice axes, index the pixels as if the volume was stored as (u,v,n)
+            const unsigned int sw = mSliceAxes.sliceWidth( w, h, d );
+            const unsigned int sh = mSliceAxes.sliceHeight( w, h, d );
+
+            PixelInfoList oriented( SV.pixelList.size() );
+            for (unsigned int i=0; i < SV.pixelList.size(); i++)
+            {
+                const UIntPoint3D &c = SV.pixelList[i].coords;
+
+                int u, v, n;
+                mSliceAxes.toSlice( c.x, c.y, c.z, u, v, n );
+
+                oriented[i].coords = UIntPoint3D( u, v, n );
+                oriented[i].index = u + v * sw + n * sw * sh;
+            }
+
+            SV.spans.build( oriented, sw, sh, mSliceAxes.numSlices( w, h, d ) );
+        }
+
+        SV.spansValid = true;
+    }
+}
+
+void AnnotatorWnd::updateBrushConstraints()
+{
+    mBrushConstraints = BrushConstraints();
+
+    if ( ui->groupBoxRestrictPixLabels->isChecked() && mVolumeData.isSizeLike(mVolumeLabels) )
+    {
+        mBrushConstraints.volume = mVolumeData.data();
+        mBrushConstraints.pixMin = ui->spinPixMin->value();
+        mBrushConstraints.pixMax = ui->spinPixMax->value();
+        mBrushConstraints.dontOverwriteLabeled = ui->chkDontOverwriteLabeledPIxs->isChecked();
+    }
+
+    if ( ui->chkScoreEnable->isChecked() && mScoreImage.isSizeLike(mVolumeLabels) )
+    {
+        mBrushConstraints.score = mScoreImage.data();
+        mBrushConstraints.scoreThr = ui->spinScoreThreshold->value();
+    }
+}
 
-    ui->labelImg->setImage( qimg );
+void AnnotatorWnd::updateSVSelectionPixelList( SupervoxelSelection &SV )
+{
+    SupervoxelFilter filter;
+    filter.restrictPixels = ui->groupBoxRestrictPixLabels->isChecked();
+    filter.pixMin = ui->spinPixMin->value();
+    filter.pixMax = ui->spinPixMax->value();
+    filter.dontOverwriteLabeled = filter.restrictPixels && ui->chkDontOverwriteLabeledPIxs->isChecked();
+    filter.restrictScore = ui->chkScoreEnable->isChecked() && mScoreImage.isSizeLike(mVolumeData);
+    filter.scoreThr = ui->spinScoreThreshold->value();
+
+    if ( SV.pixelListValid && (SV.filter == filter) )
+        return; // cached
+
+    // convert to whole-volume coordinates and apply the restrictions in a single pass.
+    //  pixelList keeps its capacity, so hovering does not reallocate
+    // out-of-core supervoxels are fetched from their brick, in whole-volume coordinates (the region covers the whole volume)
+    if (mSVUseBricked)
+        mSVBricked.voxelToPixel( SV.svIdx, mSVBrickedPixels );
+
+    const PixelInfoList &cropped = mSVUseBricked ? mSVBrickedPixels : mSVoxel.voxelToPixel().at( SV.svIdx );
+
+    SV.pixelList.clear();
+    SV.pixelList.reserve( cropped.size() );
+
+    PixelInfo pix;
+    for (unsigned int i=0; i < cropped.size(); i++)
+    {
+        pix.coords.x = cropped[i].coords.x + mSVRegion.corner.x;
+        pix.coords.y = cropped[i].coords.y + mSVRegion.corner.y;
+        pix.coords.z = cropped[i].coords.z + mSVRegion.corner.z;
+        pix.index = mVolumeData.coordToIdx( pix.coords.x, pix.coords.y, pix.coords.z );
+
+        if ( filter.restrictPixels )
+        {
+            PixelType val = mVolumeData.data()[ pix.index ];
+            if ( (val < filter.pixMin) || (val > filter.pixMax) )
+                continue;   //ignore
+
+            if ( filter.dontOverwriteLabeled && (mVolumeLabels.data()[ pix.index ] != 0) )
+                continue;
+        }
+
+        if ( filter.restrictScore && (mScoreImage.data()[ pix.index ] < filter.scoreThr) )
+            continue;
+
+        SV.pixelList.push_back( pix );
+    }
+
+    SV.filter = filter;
+    SV.pixelListValid = true;
+    SV.spansValid = false;
 }
 
-void AnnotatorWnd::annotateSupervoxel( const SupervoxelSelection &SV, LabelType label, bool onlyCurrentSlice )
+void AnnotatorWnd::annotateSupervoxel( SupervoxelSelection &SV, LabelType label, bool onlyCurrentSlice )
 {
     if (!SV.valid)
         return;
 
+    updateSVSelectionPixels( SV );
+
+    beginUndoStep( "label supervoxel" );
+
+    // box that is labeled, for the undo journal
+    if (!onlyCurrentSlice)
+    {
+        const unsigned int w = mVolumeLabels.width();
+        const unsigned int wh = w * mVolumeLabels.height();
+
+        int x0 = mVolumeLabels.width(), y0 = mVolumeLabels.height(), z0 = mVolumeLabels.depth();
+        int x1 = -1, y1 = -1, z1 = -1;
+        for (int i=0; i < SV.pixelList.size(); i++)
+        {
+            const unsigned int idx = SV.pixelList[i].index;
+            const int x = idx % w, y = (idx % wh) / w, z = idx / wh;
+
+            x0 = std::min( x0, x );     x1 = std::max( x1, x );
+            y0 = std::min( y0, y );     y1 = std::max( y1, y );
+            z0 = std::min( z0, z );     z1 = std::max( z1, z );
+        }
+
+        mUndoJournal.touch( &mVolumeLabels, x0, y0, z0, x1, y1, z1 );
+    } else
+    {
+        unsigned int uMin, vMin, uMax, vMax;
+        if ( SV.spans.sliceBounds( curSlicePos(), uMin, vMin, uMax, vMax ) )
+        {
+            int x0, y0, z0, x1, y1, z1;
+            mSliceAxes.toVolume( uMin, vMin, curSlicePos(), x0, y0, z0 );
+            mSliceAxes.toVolume( uMax, vMax, curSlicePos(), x1, y1, z1 );
+            mUndoJournal.touch( &mVolumeLabels, x0, y0, z0, x1, y1, z1 );
+        }
+    }
+
     // then mark it according to the GT
     if (!onlyCurrentSlice)
     {
         for (int i=0; i < SV.pixelList.size(); i++) {
             mVolumeLabels.data()[ SV.pixelList[i].index ] = label;
         }
+    } else if ( mSliceAxes.orientation == SliceXY )
+    {
+        LabelType *lblPtr = mVolumeLabels.sliceData( mCurZSlice );
+        const unsigned int w = mVolumeLabels.width();
+
+        const SliceSpan *spanEnd = SV.spans.sliceEnd( mCurZSlice );
+        for (const SliceSpan *span = SV.spans.sliceBegin( mCurZSlice ); span != spanEnd; ++span)
+            std::fill( lblPtr + span->y * w + span->x0, lblPtr + span->y * w + span->x1 + 1, label );
     } else
     {
-        for (int i=0; i < SV.pixelList.size(); i++)
-        {
-            if ( SV.pixelList[i].coords.z == mCurZSlice )
-                mVolumeLabels.data()[ SV.pixelList[i].index ] = label;
-        }
+        // spans are along the slice axes, which are strided in the volume
+        const int pos = curSlicePos();
+
+        const SliceSpan *spanEnd = SV.spans.sliceEnd( pos );
+        for (const SliceSpan *span = SV.spans.sliceBegin( pos ); span != spanEnd; ++span)
+            for (unsigned int u = span->x0; u <= span->x1; u++)
+            {
+                int x, y, z;
+                mSliceAxes.toVolume( u, span->y, pos, x, y, z );
+                mVolumeLabels.set( x, y, z, label );
+            }
     }
 
+    endUndoStep();
+
+    // labels changed, so a 'don't overwrite' filtered list is outdated
+    SV.pixelListValid = false;
+
     //// this should go on a status bar, and disappear after a while
     statusBarMsg(QString("%1 pixels labeled with Label %2").arg(SV.pixelList.size()).arg(label));
 
@@ -1748,13 +2916,16 @@ void AnnotatorWnd::annotateSupervoxel( const SupervoxelSelection &SV, LabelType
 
 void AnnotatorWnd::labelImageMouseReleaseEvent(QMouseEvent * e)
 {
-    QPoint pt = ui->labelImg->screenToImage( e->pos() );
+    QPoint pt = mViewer->screenToImage( e->pos() );
 
     //TODO copy stuff from moved to released
 
     int x = pt.x();
     int y = pt.y();
 
+    // any button ends a plugin drag
+    finishPluginStroke();
+
     // call plugin mouse move event
     //for (unsigned i=0; i < mPluginBaseList.size(); i++)
     //    mPluginBaseList[i]->mouseReleaseEvent( e, x, y, mCurZSlice );
@@ -1762,27 +2933,32 @@ void AnnotatorWnd::labelImageMouseReleaseEvent(QMouseEvent * e)
     // select supervoxel for labeling?
     if ( e->button() == Qt::LeftButton )
     {
-        if ( !mSelectedSV.valid )
-            return; // no superpixel valid
+        // a brush stroke may be left
+        finishBrushStroke();
 
-        // try to find a pixel of the current supervoxel where the mouse is
-        // otherwise we will not do anything
-        bool found = false;
-        for (int i=0; i < mSelectedSV.pixelList.size(); i++)
+        // fill tool, Shift erases as with the brushes
+        if ( ui->brushToolFill->isChecked() && !ui->superAnnotation->isChecked() )
         {
-            if (mSelectedSV.pixelList[i].coords.z != mCurZSlice)
-                continue;
+            if ( (x < 0) || (y < 0) || (x >= (int)sliceWidth()) || (y >= (int)sliceHeight()) )
+                return;
 
-            if ( (mSelectedSV.pixelList[i].coords.x == pt.x()) && (mSelectedSV.pixelList[i].coords.y == pt.y())) {
-                found = true;
-                break;
-            }
+            int vx, vy, vz;
+            mSliceAxes.toVolume( x, y, curSlicePos(), vx, vy, vz );
+            floodFillAt( vx, vy, vz, e->modifiers() == Qt::ShiftModifier );
+            return;
         }
 
-        if (!found)
+        if ( !mSelectedSV.valid )
+            return; // no superpixel valid
+
+        updateSVSelectionPixels( mSelectedSV );
+
+        // the mouse has to be over a pixel of the current supervoxel
+        // otherwise we will not do anything
+        if ( !mSelectedSV.spans.contains( pt.x(), pt.y(), curSlicePos() ) )
             return;
 
-        if(0)   // try region growing
+        if ( mSVGrowAction->isChecked() )   // region growing, from the supervoxel to the voxels within a std dev of its mean
         {
             // compute region mean
             unsigned int mean = 0;
@@ -1805,21 +2981,27 @@ void AnnotatorWnd::labelImageMouseReleaseEvent(QMouseEvent * e)
 
             if ( minVal < 0 )   minVal = 0;
             if ( maxVal > 255 )   maxVal = 255;
-            qDebug() << "Limits " << minVal << "  " << maxVal;
 
             PixelInfoList pixListResult;
             unsigned int maxRegionSize = 4 * mSelectedSV.pixelList.size();
-            RegionGrow<PixelType>( mVolumeData, mSelectedSV.pixelList, (PixelType)minVal, (PixelType)maxVal, maxRegionSize,  &pixListResult );
-
-            qDebug() << "New: " << pixListResult.size();
+            RegionGrow<PixelType>( mVolumeData, mSelectedSV.pixelList, (PixelType)minVal, (PixelType)maxVal, maxRegionSize,  &pixListResult, mGrowVisited );
 
-            mSelectedSV.pixelList = pixListResult;
+            mSelectedSV.pixelList.swap( pixListResult );
+            mSelectedSV.spansValid = false;
         }
 
+        // area of the current slice that is labeled
+        updateSVSelectionPixels( mSelectedSV );
+
+        QRect changedRect;
+        unsigned int xMin, yMin, xMax, yMax;
+        if ( mSelectedSV.spans.sliceBounds( curSlicePos(), xMin, yMin, xMax, yMax ) )
+            changedRect = QRect( QPoint(xMin, yMin), QPoint(xMax, yMax) );
+
         annotateSupervoxel( mSelectedSV, ui->comboLabel->currentIndex(), ui->chkOnlyCurSlice->isChecked() );
         mSelectedSV.valid = false;
 
-        updateImageSlice();
+        updateImageSlice( changedRect );
     }
 
     if ( e->button() == Qt::RightButton )  // iterate through possible labels
@@ -1839,166 +3021,294 @@ void AnnotatorWnd::labelImageMouseReleaseEvent(QMouseEvent * e)
 }
 
 //TODO change this to support plain annotation as well as SV annotation
-void AnnotatorWnd::labelImageMouseMoveEvent(QMouseEvent * e)
+// value painted for a label of the combo box, 0 erases
+// value the brushes and the fill tool write for a label, 0 erases
+static LabelType paintValue( int label )
 {
-    //qDebug("Mouse move: %d %d", e->x(), e->y());
+    if (label == 0)
+        return 0;
+
+    switch(label) {
+    case 1:
+        return 128;
+    case 2:
+        return 255;
+    default:
+        return 255;
+    }
+}
 
-    QPoint pt = ui->labelImg->screenToImage( e->pos() );
+Matrix3D<LabelType> *AnnotatorWnd::annotationTarget()
+{
+    int overlayindex = ui->layersDisplay->currentIndex().row();
+    if( !(overlayindex >= 0 && overlayindex < mOverlayVolumeList.size()) )
+        return &mVolumeLabels;
 
+    return mOverlayVolumeList.at(overlayindex);
+}
 
-    int x = pt.x();
-    int y = pt.y();
+void AnnotatorWnd::allocAnnotationTarget( Matrix3D<LabelType> *target, QRect &changedRect )
+{
+    if ( !target->isEmpty() )
+        return;
 
-    mCurX = x;
-    mCurY = y;
+    const unsigned int overlayindex = std::find( mOverlayVolumeList.begin(), mOverlayVolumeList.end(), target ) - mOverlayVolumeList.begin();
+    if ( overlayindex == mOverlayVolumeList.size() )
+        return;
 
-    bool invalid = false;
-    if (x < 0)  invalid = true;
-    if (y < 0)  invalid = true;
-    if (x >= mVolumeData.width())   invalid = true;
-    if (y >= mVolumeData.height())  invalid = true;
+    // recorded as empty, its bricks are diffed against 0 when the step ends
+    mUndoJournal.touch( target );
 
-    if (!invalid)
-        updateCursorPixelInfo( x, y, mCurZSlice );
+    mPrefetcher->invalidate( true );
+    target->reallocSizeLike( mVolumeData );
+    target->fill(0);
 
-    if( invalid )
+    mOverlayMenuActions[overlayindex]->setChecked(true);
+    mOverlayMenuActions[overlayindex]->setEnabled(true);
+
+    // overlay just became visible, the whole slice changes
+    changedRect = QRect( 0, 0, sliceWidth(), sliceHeight() );
+}
+
+// flood fill progress in a dialog, which can cancel it
+struct FillProgress
+{
+    QProgressDialog &dialog;
+    FillProgress( QProgressDialog &dlg ) : dialog(dlg) { }
+
+    bool operator()( unsigned int count )
+    {
+        dialog.setValue( std::min( count, (unsigned int) dialog.maximum() ) );
+        return !dialog.wasCanceled();
+    }
+};
+
+void AnnotatorWnd::floodFillAt( int x, int y, int z, bool erase )
+{
+    if ( mVolumeData.isEmpty() )
         return;
 
-    // call plugin mouse move event if control is not pressed
-    if (ui->brushToolPlugin->isChecked()){
-        for (unsigned i=0; i < mPluginBaseList.size(); i++)
-            mPluginBaseList[i]->mouseMoveEvent( e, x, y, mCurZSlice );
+    QRect changedRect;
+    Matrix3D<LabelType> *target = annotationTarget();
+    const LabelType value = erase ? 0 : paintValue( ui->comboLabel->currentIndex() );
+
+    // intensity window around the seed
+    const int seedVal = mVolumeData( x, y, z );
+    const int tol = mSettingsData.fillTolerance;
+    const PixelType minVal = std::max( seedVal - tol, 0 );
+    const PixelType maxVal = std::min( seedVal + tol, 255 );
+
+    // only shown if the fill takes a while
+    QProgressDialog progressDialog( "Filling...", "Cancel", 0, (int) std::min( mSettingsData.fillMaxVoxels, 2000000000u ), this );
+    progressDialog.setWindowModality( Qt::WindowModal );
+    progressDialog.setMinimumDuration( 500 );
+    FillProgress progress( progressDialog );
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // one bit per voxel, only while filling: allocating it costs the same as clearing a kept one
+    BitVolume region;
+    const FloodFillResult res = floodFill( mVolumeData, x, y, z, minVal, maxVal, mSettingsData.fill26Connected,
+                                           mSettingsData.fillMaxVoxels, region, progress );
+    progressDialog.reset();
+
+    if ( res.canceled || (res.count == 0) ) {
+        if ( res.canceled )
+            statusBarMsg( "Fill canceled" );
+        updateImageSlice( changedRect );
         return;
     }
 
-    if(ui->superAnnotation->isChecked()){
-        if(!mSVRegion.valid)
-            return;
-        //TODO move this somwhere else
-        // convert to cropped region coordinates
-        UIntPoint3D croppedCoords;
-        if (!mSVRegion.inRegion( UIntPoint3D(x, y, mCurZSlice), &croppedCoords ))
-            return; // nothing to do, outside cropped area
+    beginUndoStep( erase ? "erase fill" : "fill" );
+    allocAnnotationTarget( target, changedRect );
+    mUndoJournal.touch( target, res.x0, res.y0, res.z0, res.x1, res.y1, res.z1 );
 
-        // find supervoxel idx
-        unsigned int slicIdx = mSVoxel.pixelToVoxel() (croppedCoords.x, croppedCoords.y, croppedCoords.z);
-        //qDebug("Slic IDX: %u", slicIdx);
+    // labels are filled with the same restrictions as the brushes
+    updateBrushConstraints();
+    if ( (target == &mVolumeLabels) && mBrushConstraints.active() )
+        fillRegion( *target, region, res, value,
+                    BrushKernels::WriteConstrained( mBrushConstraints, erase ? BrushWriteErase : BrushWriteSet ) );
+    else
+        fillRegion( *target, region, res, value );
 
-        // find corresponding pixels and copy them to the local structure
-        mSVRegion.croppedToWholePixList( mVolumeData, mSVoxel.voxelToPixel().at(slicIdx), mSelectedSV.pixelList );
+    endUndoStep();
 
-        // if restricted pixel values is checked..
-        if ( ui->groupBoxRestrictPixLabels->isChecked() )
-        {
-            unsigned char thrMin = ui->spinPixMin->value();
-            unsigned char thrMax = ui->spinPixMax->value();
-            // make copy
-            SlicMapType::value_type oldList = mSelectedSV.pixelList;
+    // labels changed, so a 'don't overwrite' filtered list is outdated
+    mSelectedSV.pixelListValid = false;
 
-            const bool dontOverwriteLabeledPixs = ui->chkDontOverwriteLabeledPIxs->isChecked();
+    QString msg = QString("%1 voxels filled in %2 ms").arg(res.count).arg(timer.elapsed());
+    if ( res.truncated )
+        msg += QString(", stopped at the limit of %1 voxels").arg(mSettingsData.fillMaxVoxels);
+    statusBarMsg( msg, 3000 );
 
-            mSelectedSV.pixelList.clear();
+    invalidateVolumeBox( res.x0, res.y0, res.z0, res.x1, res.y1, res.z1 );
+    updateImageSlice( changedRect );
+}
 
-            for (int i=0; i < (int)oldList.size(); i++)
-            {
-                PixelType val = mVolumeData.data()[ oldList[i].index ];
+void AnnotatorWnd::fillToleranceTriggered()
+{
+    bool ok;
+    const int tol = QInputDialog::getInt( this, "Fill tolerance", "Voxels within this distance of the intensity of the clicked voxel are filled:",
+                                          mSettingsData.fillTolerance, 0, 255, 1, &ok );
+    if (ok)
+        mSettingsData.fillTolerance = tol;
+}
 
-                if ( (val < thrMin) || (val > thrMax) )
-                    continue;   //ignore
+void AnnotatorWnd::fill26ConnectedToggled( bool on )
+{
+    mSettingsData.fill26Connected = on;
+}
 
-                if ( dontOverwriteLabeledPixs ) {
-                    bool alreayLabeled = mVolumeLabels.data()[ oldList[i].index ] != 0;
-                    if ( alreayLabeled )
-                        continue;
-                }
+void AnnotatorWnd::labelImageMouseMoveEvent(QMouseEvent * e)
+{
+    //qDebug("Mouse move: %d %d", e->x(), e->y());
 
-                mSelectedSV.pixelList.push_back( oldList[i] );
-            }
-        }
+    QPoint pt = mViewer->screenToImage( e->pos() );
 
-        // if score image present + score thresholding selected
-        if ( ui->chkScoreEnable->isChecked() && mScoreImage.isSizeLike(mVolumeData) )
-        {
-            // make copy
-            SlicMapType::value_type oldList = mSelectedSV.pixelList;
+    // position in the displayed slice
+    mCurX = pt.x();
+    mCurY = pt.y();
 
-            mSelectedSV.pixelList.clear();
+    bool invalid = false;
+    if (mCurX < 0)  invalid = true;
+    if (mCurY < 0)  invalid = true;
+    if (mCurX >= (int)sliceWidth())   invalid = true;
+    if (mCurY >= (int)sliceHeight())  invalid = true;
 
-            unsigned char thrVal = ui->spinScoreThreshold->value();
+    if( invalid )
+        return;
 
-            for (int i=0; i < (int)oldList.size(); i++)
-            {
-                PixelType val = mScoreImage.data()[ oldList[i].index ];
+    // volume coordinates
+    int x, y, z;
+    mSliceAxes.toVolume( mCurX, mCurY, curSlicePos(), x, y, z );
 
-                if ( val < thrVal )
-                    continue;   //ignore
+    updateCursorPixelInfo( x, y, z );
 
-                mSelectedSV.pixelList.push_back( oldList[i] );
-            }
+    // call plugin mouse move event if control is not pressed
+    if (ui->brushToolPlugin->isChecked()){
+        // a drag is one undo step, the steps of the plugins are nested in it
+        if ( (e->buttons() != Qt::NoButton) && !mPluginStrokeOpen ) {
+            beginUndoStep( "plugin brush" );
+            mPluginStrokeOpen = true;
+        }
+
+        for (unsigned i=0; i < mPluginBaseList.size(); i++)
+            mPluginBaseList[i]->mouseMoveEvent( e, x, y, z );
+        return;
+    }
+
+    // area of the current slice whose labels/overlays are modified below
+    QRect changedRect;
+
+    if(ui->superAnnotation->isChecked()){
+        if(!mSVRegion.valid)
+            return;
+        //TODO move this somwhere else
+        // convert to cropped region coordinates
+        UIntPoint3D croppedCoords;
+        if (!mSVRegion.inRegion( UIntPoint3D(x, y, z), &croppedCoords ))
+            return; // nothing to do, outside cropped area
+
+        // find supervoxel idx
+        unsigned int slicIdx;
+        // hovering does not wait for a brick to be read from disk, annotating does
+        if (mSVUseBricked) {
+            const bool found = ( e->buttons() == Qt::LeftButton ) ?
+                                mSVBricked.idAt( croppedCoords.x, croppedCoords.y, croppedCoords.z, slicIdx ) :
+                                mSVBricked.cachedIdAt( croppedCoords.x, croppedCoords.y, croppedCoords.z, slicIdx );
+            if (!found)
+                return;
         }
+        else
+            slicIdx = mSVoxel.pixelToVoxel() (croppedCoords.x, croppedCoords.y, croppedCoords.z);
+        //qDebug("Slic IDX: %u", slicIdx);
 
-        mSelectedSV.svIdx = slicIdx;
-        mSelectedSV.valid = true;
+        // only record the ID, pixels are fetched and filtered lazily when drawing/annotating
+        const bool sameSV = mSelectedSV.valid && mSelectedSV.isSupervoxel && (mSelectedSV.svIdx == slicIdx);
+        if (!sameSV)
+        {
+            mSelectedSV.svIdx = slicIdx;
+            mSelectedSV.isSupervoxel = true;
+            mSelectedSV.pixelListValid = false;
+            mSelectedSV.valid = true;
+        }
 
         // if mouse is pressed, then automatically annotate it
         if ( e->buttons() == Qt::LeftButton ) {
+            updateSVSelectionPixels( mSelectedSV );
+
+            unsigned int xMin, yMin, xMax, yMax;
+            if ( mSelectedSV.spans.sliceBounds( curSlicePos(), xMin, yMin, xMax, yMax ) )
+                changedRect = QRect( QPoint(xMin, yMin), QPoint(xMax, yMax) );
+
             annotateSupervoxel( mSelectedSV, ui->comboLabel->currentIndex(), ui->chkOnlyCurSlice->isChecked() );
             mSelectedSV.valid = false;
         }
+        else if (sameSV)
+            return; // still over the same supervoxel, nothing to redraw
+        else {
+            // only the highlighted supervoxel changed
+            updateCursorLayer();
+            return;
+        }
 
     }else{
         int label = ui->comboLabel->currentIndex();
         int color = 0;
-        if ( e->buttons() == Qt::LeftButton ) {
+        if ( (e->buttons() == Qt::LeftButton) && !ui->brushToolFill->isChecked() ) {
             //Shift to erase //TODO we want this?
             if (e->modifiers() == Qt::ShiftModifier)
                 label = 0;
 
-            Matrix3D<LabelType> *annotationData;
+            Matrix3D<LabelType> *annotationData = annotationTarget();
+
+            //TODO fix this
+            //color = mLblColorList.getColor(label-1).rgb();
+            color = paintValue( label );
 
-            int overlayindex = ui->layersDisplay->currentIndex().row();
-            if(overlayindex >= 0 && overlayindex < mOverlayVolumeList.size() ) {
-                annotationData = mOverlayVolumeList.at(overlayindex);
-                if (annotationData->isEmpty())
-                {
-                    annotationData->reallocSizeLike( getVolumeVoxelData() );
-                    annotationData->fill(0);
+            SizedBrush *brush = &cubeBrush;
+            if( ui->brushToolSphere->isChecked())
+                brush = &sphereBrush;
 
-                    mOverlayMenuActions[overlayindex]->setChecked(true);
-                    mOverlayMenuActions[overlayindex]->setEnabled(true);
-                }
+            // labels are painted with the same restrictions as supervoxels, evaluated by the brush itself
+            if ( annotationData == &mVolumeLabels ) {
+                updateBrushConstraints();
+                brush->constraints = &mBrushConstraints;
             } else
-                annotationData = &mVolumeLabels;
-
-            if(label != 0){
-                //TODO fix this
-                //color = mLblColorList.getColor(label-1).rgb();
-                switch(label) {
-                case 1:
-                    color = 128;
-                    break;
-                case 2:
-                    color = 255;
-                    break;
-                default:
-                    color = 255;
-                }
-            }else
-                color = 0;
-
-            if (ui->brushToolCube->isChecked())
-                cubeBrush.paint(*annotationData, x, y, mCurZSlice, color );
-            else if( ui->brushToolSphere->isChecked())
-                sphereBrush.paint(*annotationData, x, y, mCurZSlice, color);
-            else
-                cubeBrush.paint(*annotationData, x, y, mCurZSlice, color);
+                brush->constraints = 0;
+
+            // the stroke goes on from the previous position, unless what it paints changed
+            if ( !mBrushStroke.paints( annotationData, brush, color ) )
+            {
+                finishBrushStroke();
+                beginUndoStep( (label == 0) ? "erase stroke" : "brush stroke" );
+                allocAnnotationTarget( annotationData, changedRect );
+
+                // erasing is not restricted by "don't overwrite labeled"
+                brush->writeMode = (label == 0) ? BrushWriteErase : BrushWriteSet;
+                mBrushStroke.begin( annotationData, brush, color );
+            }
+
+            // painted with the next render, which also takes the other positions queued until then
+            mBrushStroke.moveTo( x, y, z );
+
+            if ( changedRect.isEmpty() ) {
+                mRedrawScheduler->request();
+                return;
+            }
+        }
+        else {
+            // nothing was painted, just move the cursor
+            finishBrushStroke();
+            updateCursorLayer();
+            return;
         }
 
     }
 
-    //TODO check if I want this
-    updateImageSlice();
-
+    // only the touched area is composited and uploaded again
+    updateImageSlice( changedRect );
 }
 
 void AnnotatorWnd::labelImageWheelEvent(QWheelEvent * e)
@@ -2016,7 +3326,7 @@ void AnnotatorWnd::labelImageWheelEvent(QWheelEvent * e)
     if ( e->modifiers() == Qt::ShiftModifier )
         op = opVScroll;
 
-    QPoint pt = ui->labelImg->screenToImage( e->pos() );
+    QPoint pt = mViewer->screenToImage( e->pos() );
 
     switch(op)
     {
@@ -2032,7 +3342,9 @@ void AnnotatorWnd::labelImageWheelEvent(QWheelEvent * e)
             // force handler call
             zSliderMoved( ui->zSlider->value() );
 
-            updateCursorPixelInfo( pt.x(), pt.y(), mCurZSlice );
+            int x, y, z;
+            mSliceAxes.toVolume( pt.x(), pt.y(), curSlicePos(), x, y, z );
+            updateCursorPixelInfo( x, y, z );
 
             break;
         }
@@ -2044,8 +3356,8 @@ void AnnotatorWnd::labelImageWheelEvent(QWheelEvent * e)
             if (e->delta() < 0)
                 toZoom = 1.0/toZoom;
 
-            ui->labelImg->scale( toZoom );
-            statusBarMsg( QString().sprintf("Zoom: %.1f", ui->labelImg->scaleFactor()) );
+            mViewer->scale( toZoom );
+            statusBarMsg( QString().sprintf("Zoom: %.1f", mViewer->scaleFactor()) );
 
             break;
         }
@@ -2056,9 +3368,9 @@ void AnnotatorWnd::labelImageWheelEvent(QWheelEvent * e)
             const int toScroll = -e->delta()/4;
 
             if (op == opHScroll)
-                ui->labelImg->pan( toScroll, 0 );
+                mViewer->pan( toScroll, 0 );
             else
-                ui->labelImg->pan( 0, toScroll );
+                mViewer->pan( 0, toScroll );
 
             break;
         }
@@ -2070,9 +3382,26 @@ void AnnotatorWnd::labelImageWheelEvent(QWheelEvent * e)
 
 void AnnotatorWnd::pluginUpdateDisplay()
 {
+    // plugins have write access to the volume as well
+    mRenderCache.invalidateBase();
+    mOrthoBase.invalidate();
+    if ( mGLView != 0 )
+        mGLView->invalidateBase();
     updateImageSlice();
 }
 
+void AnnotatorWnd::pluginUpdateDisplay( int x0, int y0, int z0, int x1, int y1, int z1 )
+{
+    // only labels/overlays inside the box changed, plugins may pass boxes past the volume borders
+    x0 = std::max( x0, 0 );     x1 = std::min( x1, (int)mVolumeData.width() - 1 );
+    y0 = std::max( y0, 0 );     y1 = std::min( y1, (int)mVolumeData.height() - 1 );
+    z0 = std::max( z0, 0 );     z1 = std::min( z1, (int)mVolumeData.depth() - 1 );
+
+    if ( (x0 <= x1) && (y0 <= y1) && (z0 <= z1) )
+        invalidateVolumeBox( x0, y0, z0, x1, y1, z1 );
+    mRedrawScheduler->request();
+}
+
 QMenu *AnnotatorWnd::getPluginMenuPtr()
 {
     return ui->menuPlugins;
@@ -2080,6 +3409,8 @@ QMenu *AnnotatorWnd::getPluginMenuPtr()
 
 AnnotatorWnd::~AnnotatorWnd()
 {
+            // it reads the volumes, stop it before they are freed
+            delete mPrefetcher;
             delete ui;
 }
 
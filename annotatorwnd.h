@@ -17,6 +17,11 @@
 #include "brush.h"
 
 #include "overlay.h"
+#include "slicerendercache.h"
+#include "OrthoSlices.h"
+#include "BrushStroke.h"
+#include "UndoJournal.h"
+#include "BitVolume.h"
 
 
 namespace Ui {
@@ -24,6 +29,12 @@ namespace Ui {
 }
 
 struct SupervoxelSelection;
+class SliceViewer;
+class GLSliceView;
+class SlicePrefetcher;
+class RedrawScheduler;
+class OverlayCompositor;
+class QLabel;
 
 class AnnotatorWnd : public QMainWindow
 {
@@ -49,6 +60,14 @@ private:
         QString fijiExePath;
 
         unsigned maxVoxForSVox;
+        unsigned svBrickSize;       // brick side for out-of-core supervoxels
+        unsigned svBrickCacheMB;    // memory for cached supervoxel bricks
+        unsigned prefetchSlices;    // slices rendered ahead when scrolling through Z
+        unsigned undoMemoryMB;      // memory for the undo journal
+        unsigned fillTolerance;     // fill tool intensity window, seed value +- fillTolerance
+        unsigned fillMaxVoxels;     // fill tool stops after this many voxels
+        bool     fill26Connected;   // fill tool connectivity, 6 otherwise
+        unsigned labelOverlayOpacity;   // color-coded label overlay, in %
         unsigned sliceJump;
     } mSettingsData;
 
@@ -67,8 +86,24 @@ protected:
 private:
     Ui::AnnotatorWnd *ui;
     int mCurZSlice;
-    int mCurX;
+    int mCurXSlice;     // positions of the XZ/YZ slices
+    int mCurYSlice;
+    int mCurX;          // cursor position in the displayed slice
     int mCurY;
+
+    // orientation of the displayed slice. The slider moves it along mSliceAxes.nAxis
+    SliceAxes mSliceAxes;
+    int &curSlicePos();     // mCurZSlice, mCurYSlice or mCurXSlice
+    unsigned int sliceWidth() const;
+    unsigned int sliceHeight() const;
+
+    // XZ/YZ slices of the volume and of the labels/score/overlays, which are not contiguous
+    OrthoSliceCache<PixelType> mOrthoBase;
+    OrthoSliceCache<PixelType> mOrthoOverlays;
+
+    // slice of vol at pos along the current orientation, sliceWidth() x sliceHeight().
+    //  XZ/YZ slices are only valid until the next call for the same volume
+    const unsigned char *sliceAt( const Matrix3D<unsigned char> &vol, int pos );
     // if label file shoul be saved on exit, and which would be the path
     bool        mSaveLabelsOnExit;
     QString     mSaveLabelsOnExitPath;
@@ -99,11 +134,82 @@ private:
     SphereBrush sphereBrush;
     PixelBrush pixelBrush;
 
+    // pixel value/score/label restrictions of label brushes, as for supervoxels
+    BrushConstraints mBrushConstraints;
+    void updateBrushConstraints();  // from the restriction settings
+
+    // label painting drag, painted in batches when the slice is rendered
+    BrushStroke mBrushStroke;
+    void paintBrushStroke();    // paints the queued positions and invalidates the area they changed
+    void finishBrushStroke();   // paints what is left and ends the stroke
+
+    bool mPluginStrokeOpen;     // undo step of a plugin brush drag
+    void finishPluginStroke();
+
+    // supervoxel selections grown by intensity before labelling them, if checked
+    QAction   *mSVGrowAction;
+    BitVolume mGrowVisited;     // kept between grows, RegionGrow leaves it clear so a grow only touches its own bits
+    void floodFillAt( int x, int y, int z, bool erase );    // volume coordinates
+
+    // volume painted by the brushes/fill: the selected overlay (possibly empty) or the labels
+    Matrix3D<LabelType> *annotationTarget();
+    // allocates and shows target if it is an empty overlay, changedRect is then the whole slice.
+    //  Called inside the undo step, which records the overlay as empty: undoing clears what was
+    //  painted, but the overlay stays allocated and shown
+    void allocAnnotationTarget( Matrix3D<LabelType> *target, QRect &changedRect );
+
+    // undo/redo of the label and overlay edits
+    UndoJournal mUndoJournal;
+    QAction     *mUndoAction;
+    QAction     *mRedoAction;
+    void updateUndoActions();   // enables them and shows the names of the steps
+
+    // displayed slice, split in layers that are invalidated independently
+    SliceRenderCache mRenderCache;
+
+    // renders are requested through mRedrawScheduler, so that bursts of updates render once
+    RedrawScheduler *mRedrawScheduler;
+    void invalidateSliceOverlays( const QRect &changedRect );   // labels/overlays changed inside changedRect
+    void invalidateVolumeBox( int x0, int y0, int z0, int x1, int y1, int z1 ); // same as above, inclusive box in volume coordinates
+    void collectOverlayLayers( OverlayCompositor &layers, int pos, bool withLabels = true );   // score image + overlays (+ labels) of slice pos
+    void compositeOverlays( QImage &qimg, const QRect &rect );   // score image + overlays, only inside rect
+    QRect drawTransientLayer( QImage &qimg ); // selection highlight, returns the area drawn
+    void updateBrushCursor( bool visible );   // moves the brush cursor item of ui->labelImg
+
+    // renders the next slices in the scroll direction (+1/-1) in the background
+    SlicePrefetcher *mPrefetcher;
+    void prefetchSlices( int direction );
+
+    // widget the slice is shown in: ui->labelImg, or mGLView if the OpenGL viewer is enabled
+    SliceViewer *mViewer;
+    GLSliceView *mGLView;
+    QAction     *mGLViewerAction;
+
+    // time breakdown of the rendered frames, shown in the status bar and/or logged to a file
+    QLabel      *mRenderStatsLabel;
+    QAction     *mRenderStatsAction;
+    QAction     *mRenderStatsLogAction;
+    QTimer      *mRenderStatsTimer;     // refreshes mRenderStatsLabel
+
+    bool glViewerActive() const;
+    void renderSliceGL();   // hands the slices to mGLView, which blends them
+    int  mGLSliceKey;       // slice the textures of mGLView were uploaded for
+
+    // transient layer for mGLView, as a mask of the slice
+    Matrix3D<OverlayType> mCursorMask;
+    QRect                 mCursorMaskRect;  // area set in mCursorMask
+    QRect drawCursorMask( bool visible );   // returns the area that changed
+
     void updateCursorPixelInfo( int x, int y, int z );   // shows current pixel position
 
     bool   mOverlayLabelImage;    // if true, then an overlay is drawn on top of the image, showing color-coded pixel labels
 
-    void annotateSupervoxel( const SupervoxelSelection &SV, LabelType label, bool onlyCurrentSlice = false );
+    void annotateSupervoxel( SupervoxelSelection &SV, LabelType label, bool onlyCurrentSlice = false );
+
+    // builds the pixel list of a supervoxel selection from its ID if it is outdated,
+    //  applying the pixel value/score restrictions, and its per-slice span index
+    void updateSVSelectionPixels( SupervoxelSelection &SV );
+    void updateSVSelectionPixelList( SupervoxelSelection &SV );
 
     // scans for plugins and adds them.
     void scanPlugins( const QString &pluginFolder );
@@ -113,19 +219,23 @@ private:
 
     void labelRegion(Matrix3D<LabelType> &data, uint regionIdx, uint labelValue);
 
+    // true if supervoxels were computed/loaded for the whole volume
+    bool globalSupervoxelsValid() const;
+
 public:
 
     std::vector< Overlay * >  mOverlayInfo;
 
     // called by the plugin to update the display
     void pluginUpdateDisplay();
+    void pluginUpdateDisplay( int x0, int y0, int z0, int x1, int y1, int z1 );   // only labels/overlays in the (inclusive) box changed
 
     QMenu *getPluginMenuPtr();
 
     // more for plugins
-    Matrix3D<PixelType> &   getVolumeVoxelData() {  return mVolumeData; }
-    Matrix3D<LabelType> &   getLabelVoxelData()  {  return mVolumeLabels; }
-    Matrix3D<ScoreType> &   getScoreVoxelData()  {  return mScoreImage; }
+    Matrix3D<PixelType> &   getVolumeVoxelData();
+    Matrix3D<LabelType> &   getLabelVoxelData();
+    Matrix3D<ScoreType> &   getScoreVoxelData();
 
     Matrix3D<OverlayType> & getOverlayVoxelData( unsigned int num );
     Matrix3D<OverlayType> *getSelectedOverlayData();
@@ -134,6 +244,18 @@ public:
     // returns one string per class name
     void                    getLabelClassList( QStringList &sList );
 
+    // supervoxel ID map, only if supervoxels cover the whole volume, 0 otherwise
+    const Matrix3D<unsigned int> * getGlobalSupervoxelMap( unsigned int *numSupervoxels = 0 );
+
+    // edits of the label/overlay volumes between these two can be undone as one step,
+    //  the boxes written have to be passed to getUndoJournal().touch() before writing them
+    void            beginUndoStep( const QString &name );
+    void            endUndoStep();
+    UndoJournal &   getUndoJournal() { return mUndoJournal; }
+
+
+private slots:
+    void renderSlice();     // redraws the layers of mRenderCache that are outdated
 
 private:
     QTimer  *mConstraintsDisplayTimer;  // to keep track of a timeout to show some overlays
@@ -141,7 +263,7 @@ private:
     // called before redrawing, should ckec if the timer hasn't expired
     //  and do necessary drawing. returns true if the image was modified,
     //  so that nothing else is drawn
-    bool    constraintsUpdateImagesliceCallback(QImage &slice);
+    bool    constraintsUpdateImagesliceCallback( QImage &slice, const QRect &rect );  // only inside rect
 
 public slots:
     void    constraintsTimerCallback(); // timer callback
@@ -154,6 +276,18 @@ public slots:
 
     void updateImageSlice();    //updates the label widget with mCurZSlice slice
     void updateImageSlice(int);    //same as above, discards parameter int
+    void updateImageSlice( const QRect &changedRect );  // same as above, when only changedRect was modified
+    void updateCursorLayer();   // same as above, when only the selection/brush cursor changed
+
+    void useGLViewer( bool enable );    // switches between the OpenGL and the QGraphicsView viewer
+
+    void showRenderStats( bool show );  // frame time percentiles in the status bar
+    void logRenderStats( bool log );    // every frame time breakdown to a CSV file
+    void updateRenderStatsLabel();
+    void viewportPainted( qint64 nsecs );
+
+    void sliceOrientationTriggered();   // from the XY/XZ/YZ actions
+    void setSliceOrientation( SliceOrientation orientation );
 
     void showPreferencesDialog();
 
@@ -169,6 +303,7 @@ public slots:
 
     void chkLabelOverlayStateChanged(int state);
     void actionLabelOverlayTriggered();
+    void labelOverlayOpacityTriggered();
 
     void annotVis3DClicked();
 
@@ -181,10 +316,19 @@ public slots:
     void genSuperVoxelWholeVolumeClicked();
     void loadSuperVoxelWholeVolumeClicked();
     void saveSuperVoxelWholeVolumeClicked();
+    void genSuperVoxelBrickedClicked();
+    void loadSuperVoxelBrickedClicked();
+    void useBrickedSupervoxels();   // switches to out-of-core supervoxels if they match the volume
 
     void actionSaveAnnotTriggered();
     void actionLoadAnnotTriggered();
 
+    void undoTriggered();
+    void redoTriggered();
+
+    void fillToleranceTriggered();
+    void fill26ConnectedToggled( bool on );
+
     void actionImportAnnotTriggered();
 
     void actionLoadScoreImageTriggered();
@@ -1,8 +1,12 @@
 #include "brush.h"
 
-#include <QColor>
 #include <QtGlobal>
 
+#include <algorithm>
+#include <cstdlib>
+
+// the rasterisers are the kernels of BrushKernels.h, specialised for every shape and write mode
+
 SizedBrush::SizedBrush()
 {
     this->width = 10;
@@ -22,36 +26,25 @@ PixelBrush::PixelBrush()
 
 }
 
-void PixelBrush::paint(QImage &qimg,
-                        int x, int y, QColor highlightColor)
+void PixelBrush::paint(Matrix3D<LabelType> &data, int x, int y, int z, LabelType label)
 {
-    const qreal opacity = 0.6;
-    const qreal invOpacity = 0.99 - opacity;
-
-    const qreal cRd = highlightColor.redF() * opacity;
-    const qreal cGr = highlightColor.greenF() * opacity;
-    const qreal cBl = highlightColor.blueF() * opacity;
-
-    //TODO maybe skip rows by shifting i=0,j=0...
-    if (x < 0 || y < 0)
-        return;
-    if (x >= qimg.width() || y >= qimg.height())
-        return;
-    QColor pixColor = QColor::fromRgb( qimg.pixel(x, y) );
-
-    qreal r = pixColor.redF() * invOpacity + cRd;
-    qreal g = pixColor.greenF() * invOpacity + cGr;
-    qreal b = pixColor.blueF() * invOpacity + cBl;
-
-    QRgb qrgb =  QColor::fromRgbF( r, g, b ).rgb();
-
-    qimg.setPixel( x, y, qrgb);
+    BrushKernels::paint( BrushPixel, writeMode, data, x, y, z, 0, 0, 0, label, constraints );
+}
 
+void PixelBrush::paintStroke(Matrix3D<LabelType> &data, int x0, int y0, int z0, int x1, int y1, int z1, LabelType label)
+{
+    BrushKernels::paintStroke( BrushPixel, writeMode, data, x0, y0, z0, x1, y1, z1, 0, 0, 0, label, constraints );
 }
 
-void PixelBrush::paint(Matrix3D<LabelType> &data, int x, int y, int z, LabelType label)
+void Brush::paintStroke(Matrix3D<LabelType> &data, int x0, int y0, int z0, int x1, int y1, int z1, LabelType label)
 {
-    data.set(x, y, z, label);
+    const int n = std::max( std::abs(x1 - x0), std::max( std::abs(y1 - y0), std::abs(z1 - z0) ) );
+
+    for (int s = 0; s <= n; s++)
+    {
+        const double t = (n == 0) ? 0.0 : s / (double)n;
+        paint( data, qRound( x0 + t * (x1 - x0) ), qRound( y0 + t * (y1 - y0) ), qRound( z0 + t * (z1 - z0) ), label );
+    }
 }
 
 
@@ -66,57 +59,20 @@ CubeBrush::CubeBrush(int width,int height, int depth)
     this->depth = depth;
 }
 
-//TODO maybe template this or similar
-void CubeBrush::paint(QImage &qimg,
-                        int x, int y, QColor highlightColor)
-{
-    const qreal opacity = 0.6;
-    const qreal invOpacity = 0.99 - opacity;
-
-    const qreal cRd = highlightColor.redF() * opacity;
-    const qreal cGr = highlightColor.greenF() * opacity;
-    const qreal cBl = highlightColor.blueF() * opacity;
-
-    for(int i = x-width;i<x+width;i++) {
-        for(int j = y-height; j<y+height; j++) {
-                //TODO maybe skip rows by shifting i=0,j=0...
-                if (i < 0 || j < 0)
-                    continue;
-                if (i >= qimg.width() || j >= qimg.height())
-                    continue;
-                QColor pixColor = QColor::fromRgb( qimg.pixel(i, j) );
-
-                qreal r = pixColor.redF() * invOpacity + cRd;
-                qreal g = pixColor.greenF() * invOpacity + cGr;
-                qreal b = pixColor.blueF() * invOpacity + cBl;
-
-                QRgb qrgb =  QColor::fromRgbF( r, g, b ).rgb();
-
-                qimg.setPixel( i, j, qrgb);
-
-        }
-    }
-}
-
 void CubeBrush::paint(Matrix3D<LabelType> &data,
                         int x, int y, int z,
                         LabelType label)
 {
-    for(int i = x-width;i<x+width;i++) {
-        for(int j = y-height; j<y+height; j++) {
-            for(int k = z-depth; k<z+depth; k++)
-            {
-                //TODO maybe skip rows by shifting i=0,j=0...
-                if (i < 0 || j < 0 || k < 0)
-                    continue;
-                if (i >= data.width() || j >= data.height()
-                  ||k >= data.depth())
-                    continue;
-
-                 data.set(i, j, k, label);
-            }
-        }
-    }
+    // the brush covers [x - width, x + width) x [y - height, y + height) x [z - depth, z + depth)
+    BrushKernels::paint( BrushCube, writeMode, data, x, y, z, width, height, depth, label, constraints );
+}
+
+void CubeBrush::paintStroke(Matrix3D<LabelType> &data,
+                            int x0, int y0, int z0,
+                            int x1, int y1, int z1,
+                            LabelType label)
+{
+    BrushKernels::paintStroke( BrushCube, writeMode, data, x0, y0, z0, x1, y1, z1, width, height, depth, label, constraints );
 }
 
 SphereBrush::SphereBrush(){
@@ -130,63 +86,19 @@ SphereBrush::SphereBrush(int width,int height, int depth)
     this->depth = depth;
 }
 
-//TODO maybe template this or similar
-void SphereBrush::paint(QImage &qimg,
-                        int x, int y,  QColor highlightColor)
-{
-
-    const qreal opacity = 0.6;
-    const qreal invOpacity = 0.99 - opacity;
-
-    const qreal cRd = highlightColor.redF() * opacity;
-    const qreal cGr = highlightColor.greenF() * opacity;
-    const qreal cBl = highlightColor.blueF() * opacity;
-    for(int i = x - width;i < x+width; i++)
-    {
-        for(int j = y-height; j < y+height; j++)
-        {
-            //TODO maybe skip rows by shifting i=0,j=0...
-            if (i < 0 || j < 0)
-                continue;
-            if (i >= qimg.width() || j >= qimg.height())
-                continue;
-
-            if ( (i-x)*(i-x)/( (double)(width*width) )
-               + (j-y)*(j-y)/( (double)(height*height) ) <= 1)
-            {
-                QColor pixColor = QColor::fromRgb( qimg.pixel(i, j) );
-
-                qreal r = pixColor.redF() * invOpacity + cRd;
-                qreal g = pixColor.greenF() * invOpacity + cGr;
-                qreal b = pixColor.blueF() * invOpacity + cBl;
-
-                QRgb qrgb =  QColor::fromRgbF( r, g, b ).rgb();
-                qimg.setPixel( i, j, qrgb);
-            }
-        }
-    }
-}
-
 void SphereBrush::paint(Matrix3D<LabelType> &data,
                         int x, int y, int z,
                         LabelType label)
 {
-    for(int i = x-width;i<x+width;i++) {
-        for(int j = y-height; j<y+height; j++) {
-            for(int k = z-depth; k<z+depth; k++)
-            {
-                //TODO maybe skip rows by shifting i=0,j=0...
-                if (i < 0 || j < 0 || k < 0)
-                    continue;
-                if (i >= data.width() || j >= data.height()
-                  ||k >= data.depth())
-                    continue;
-
-             if ( (i-x)*(i-x)/( (double)(width*width) )
-                + (j-y)*(j-y)/( (double)(height*height) )
-                + (k-z)*(k-z)/( (double)(depth*depth) ) <= 1)
-                    data.set(i, j, k, label);
-            }
-        }
-    }
+    // same box as the cube brush, inside the ellipsoid
+    //  (i-x)^2/width^2 + (j-y)^2/height^2 + (k-z)^2/depth^2 <= 1
+    BrushKernels::paint( BrushEllipsoid, writeMode, data, x, y, z, width, height, depth, label, constraints );
+}
+
+void SphereBrush::paintStroke(Matrix3D<LabelType> &data,
+                              int x0, int y0, int z0,
+                              int x1, int y1, int z1,
+                              LabelType label)
+{
+    BrushKernels::paintStroke( BrushEllipsoid, writeMode, data, x0, y0, z0, x1, y1, z1, width, height, depth, label, constraints );
 }
@@ -1,16 +1,27 @@
 #ifndef BRUSH_H
 #define BRUSH_H
 
-#include <QImage>
-
 #include "Matrix3D.h"
 #include "CommonTypes.h"
+#include "BrushKernels.h"
 
 class Brush
 {
 public:
-    virtual void paint(QImage &data, int x, int y, QColor highlightColor) = 0;
+    // how the covered voxels are written, BrushWriteSet by default
+    BrushWriteMode writeMode;
+
+    // if not 0, only the voxels that satisfy them are written (not owned)
+    const BrushConstraints *constraints;
+
+    Brush() : writeMode(BrushWriteSet), constraints(0) {}
+
     virtual void paint(Matrix3D<LabelType> &data, int x, int y, int z, LabelType label) = 0;
+
+    // paints the volume swept by the brush moved from (x0,y0,z0) to (x1,y1,z1).
+    //  By default it is stamped at every voxel of the way
+    virtual void paintStroke(Matrix3D<LabelType> &data, int x0, int y0, int z0, int x1, int y1, int z1, LabelType label);
+
     virtual ~Brush() {}
 };
 
@@ -19,9 +30,10 @@ class PixelBrush : public Brush
 
 public:
     PixelBrush();
-    void paint(QImage &data, int x, int y, QColor highlightColor);
     void paint(Matrix3D<LabelType> &data, int x, int y, int z, LabelType label);
 
+    void paintStroke(Matrix3D<LabelType> &data, int x0, int y0, int z0, int x1, int y1, int z1, LabelType label);
+
 };
 
 class SizedBrush : public Brush
@@ -46,10 +58,10 @@ public:
 
     CubeBrush(int width, int height, int depth);
 
-    void paint(QImage &data, int x, int y, QColor highlightColor);
-
     void paint(Matrix3D<LabelType> &data, int x, int y, int z, LabelType label);
 
+    void paintStroke(Matrix3D<LabelType> &data, int x0, int y0, int z0, int x1, int y1, int z1, LabelType label);
+
 };
 
 class SphereBrush : public SizedBrush
@@ -60,10 +72,10 @@ public:
 
     SphereBrush(int width, int height, int depth);
 
-    void paint(QImage &data, int x, int y, QColor highlightColor);
-
     void paint(Matrix3D<LabelType> &data, int x, int y, int z, LabelType label);
 
+    void paintStroke(Matrix3D<LabelType> &data, int x0, int y0, int z0, int x1, int y1, int z1, LabelType label);
+
 };
 
 
@@ -0,0 +1,485 @@
+#include "glsliceview.h"
+#include "OverlayCompositor.h"
+
+#include <QDebug>
+#include <QString>
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// not in every gl.h (e.g. the OpenGL 1.1 one of windows)
+#ifndef GL_CLAMP_TO_EDGE
+    #define GL_CLAMP_TO_EDGE 0x812F
+#endif
+#ifndef GL_TEXTURE0
+    #define GL_TEXTURE0 0x84C0
+#endif
+#ifndef GL_MAX_TEXTURE_IMAGE_UNITS
+    #define GL_MAX_TEXTURE_IMAGE_UNITS 0x8872
+#endif
+
+static const char *vertexShaderSrc =
+        "varying vec2 vTexCoord;\n"
+        "void main()\n"
+        "{\n"
+        "    vTexCoord = gl_MultiTexCoord0.xy;\n"
+        "    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
+        "}\n";
+
+// fragment shader for numLayers overlay layers. Texture values v (0..1) are mapped to
+//  the center of texel v*255 of the 256-wide tables
+static QString fragmentShaderSrc( unsigned int numLayers, unsigned int maxLayers )
+{
+    QString s =
+        "uniform sampler2D uBase;\n"
+        "uniform float uBaseVisible;\n"
+        "uniform sampler2D uLabels;\n"
+        "uniform sampler2D uPalette;\n"
+        "uniform float uLabelAlpha;\n"
+        "uniform sampler2D uWeights;\n"
+        "uniform int uNumLayers;\n"
+        "varying vec2 vTexCoord;\n";
+
+    if (numLayers > 0)
+        s += QString("uniform vec3 uColor[%1];\n").arg(numLayers);
+
+    for (unsigned int l=0; l < numLayers; l++)
+        s += QString("uniform sampler2D uLayer%1;\n").arg(l);
+
+    s +=
+        "float lutCoord( float v ) { return (v * 255.0 + 0.5) / 256.0; }\n"
+        "void main()\n"
+        "{\n"
+        "    vec3 c = vec3( texture2D( uBase, vTexCoord ).r * uBaseVisible );\n"
+        "    if ( uLabelAlpha > 0.0 ) {\n"
+        "        vec4 p = texture2D( uPalette, vec2( lutCoord( texture2D( uLabels, vTexCoord ).r ), 0.5 ) );\n"
+        "        c = mix( c, p.rgb, p.a * uLabelAlpha );\n"
+        "    }\n";
+
+    // GLSL 1.10 can't index samplers in a loop, so the layers are unrolled
+    for (unsigned int l=0; l < numLayers; l++)
+        s += QString(
+        "    if ( %1 < uNumLayers ) {\n"
+        "        vec4 t = texture2D( uWeights, vec2( lutCoord( texture2D( uLayer%1, vTexCoord ).r ), %2 ) );\n"
+        "        float w = (t.a * 255.0 * 256.0 + t.r * 255.0) / 256.0;\n"
+        "        c = mix( c, uColor[%1], w );\n"
+        "    }\n").arg(l).arg( (l + 0.5) / maxLayers, 0, 'f', 6 );
+
+    s +=
+        "    gl_FragColor = vec4( c, 1.0 );\n"
+        "}\n";
+
+    return s;
+}
+
+GLSliceView::GLSliceView(QWidget *parent) :
+    QGLWidget(parent)
+{
+    mProgram = 0;
+    mReady = mFailed = false;
+    mNumLayerUnits = 0;
+
+    mImgWidth = mImgHeight = 0;
+    mBaseHidden = false;
+
+    mLabelAlpha = 0;
+    mPaletteTex = 0;
+    memset( mPalette, 0, sizeof(mPalette) );
+
+    mLayers.resize( MaxLayers );
+    mNumLayers = 0;
+    mWeightsTex = 0;
+    memset( mWeights, 0, sizeof(mWeights) );
+    memset( mLayerColors, 0, sizeof(mLayerColors) );
+
+    mScaleFactor = 1.0;
+    setZoomLimits( 0.1, 7 );
+
+    setAutoFillBackground( false );
+}
+
+GLSliceView::~GLSliceView()
+{
+    if (!mReady)
+        return;
+
+    makeCurrent();
+
+    std::vector<GLuint> textures;
+    textures.push_back( mBase.tex );
+    textures.push_back( mLabels.tex );
+    textures.push_back( mPaletteTex );
+    textures.push_back( mWeightsTex );
+    for (unsigned int l=0; l < mLayers.size(); l++)
+        textures.push_back( mLayers[l].tex );
+
+    glDeleteTextures( textures.size(), &textures[0] );
+}
+
+bool GLSliceView::initShaders()
+{
+    if (mFailed)
+        return false;
+
+    makeCurrent();
+
+    if (!mReady)
+    {
+        mReady = setupGL();
+        mFailed = !mReady;
+    }
+
+    return mReady;
+}
+
+void GLSliceView::initializeGL()
+{
+    initShaders();
+}
+
+static void setTextureParams()
+{
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+}
+
+bool GLSliceView::setupGL()
+{
+    initializeGLFunctions();
+
+    if ( !QGLShaderProgram::hasOpenGLShaderPrograms( context() ) ) {
+        qWarning("OpenGL viewer: shader programs not supported");
+        return false;
+    }
+
+    // base, labels, palette and weights use the first units
+    GLint numUnits = 0;
+    glGetIntegerv( GL_MAX_TEXTURE_IMAGE_UNITS, &numUnits );
+
+    mNumLayerUnits = std::max( 0, std::min( (int)MaxLayers, numUnits - (int)FirstLayerUnit ) );
+
+    mProgram = new QGLShaderProgram( context(), this );
+    if ( !mProgram->addShaderFromSourceCode( QGLShader::Vertex, vertexShaderSrc ) ||
+         !mProgram->addShaderFromSourceCode( QGLShader::Fragment, fragmentShaderSrc( mNumLayerUnits, MaxLayers ) ) ||
+         !mProgram->link() )
+    {
+        qWarning() << "OpenGL viewer: error building shaders:" << mProgram->log();
+        return false;
+    }
+
+    GLuint tex[4];
+    glGenTextures( 4, tex );
+    mBase.tex = tex[0];
+    mLabels.tex = tex[1];
+    mPaletteTex = tex[2];
+    mWeightsTex = tex[3];
+
+    for (unsigned int l=0; l < mLayers.size(); l++) {
+        GLuint t;
+        glGenTextures( 1, &t );
+        mLayers[l].tex = t;
+    }
+
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+    glBindTexture( GL_TEXTURE_2D, mPaletteTex );
+    setTextureParams();
+    const std::vector<unsigned char> transparent( 256 * 4, 0 );   // same as mPalette
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &transparent[0] );
+
+    glBindTexture( GL_TEXTURE_2D, mWeightsTex );
+    setTextureParams();
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_LUMINANCE8_ALPHA8, 256, MaxLayers, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, mWeights );
+
+    qDebug("OpenGL viewer: %s, %u overlay layers", (const char *) glGetString(GL_RENDERER), mNumLayerUnits);
+
+    return true;
+}
+
+void GLSliceView::allocSliceTexture( SliceTexture &st )
+{
+    glBindTexture( GL_TEXTURE_2D, st.tex );
+    setTextureParams();
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_LUMINANCE8, mImgWidth, mImgHeight, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, 0 );
+
+    st.data = 0;
+    st.dirty = QRect();
+}
+
+void GLSliceView::updateSlice( SliceTexture &st, const unsigned char *data )
+{
+    if (data == 0)
+        return;
+
+    const QRect imgRect( 0, 0, mImgWidth, mImgHeight );
+
+    QRect r = imgRect;
+    if ( st.data == data )
+    {
+        r = st.dirty.intersected( imgRect );
+        if ( r.isEmpty() )
+            return;
+    }
+
+    glBindTexture( GL_TEXTURE_2D, st.tex );
+
+    // rows of the slice are mImgWidth apart
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, mImgWidth );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, r.left(), r.top(), r.width(), r.height(), GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                     data + r.top() * mImgWidth + r.left() );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+
+    st.data = data;
+    st.dirty = QRect();
+}
+
+void GLSliceView::setBase( const unsigned char *data, unsigned int width, unsigned int height, bool hidden )
+{
+    if ( !initShaders() )
+        return;
+
+    if ( (width != mImgWidth) || (height != mImgHeight) )
+    {
+        mImgWidth = width;
+        mImgHeight = height;
+
+        allocSliceTexture( mBase );
+        allocSliceTexture( mLabels );
+        for (unsigned int l=0; l < mLayers.size(); l++)
+            allocSliceTexture( mLayers[l] );
+
+        mCenter = QPointF( width / 2.0, height / 2.0 );
+        clampCenter();
+    }
+
+    mBaseHidden = hidden;
+    if (!hidden)
+        updateSlice( mBase, data );
+
+    update();
+}
+
+void GLSliceView::invalidateBase()
+{
+    mBase.data = 0;
+}
+
+void GLSliceView::setLabels( const unsigned char *data, const QRgb *palette, float alpha )
+{
+    if ( !initShaders() || (mImgWidth == 0) )
+        return;
+
+    mLabelAlpha = (data == 0) ? 0 : alpha;
+    if (data == 0)
+        return;
+
+    updateSlice( mLabels, data );
+
+    if ( memcmp( palette, mPalette, sizeof(mPalette) ) != 0 )
+    {
+        memcpy( mPalette, palette, sizeof(mPalette) );
+
+        unsigned char rgba[256 * 4];
+        for (unsigned int i=0; i < 256; i++) {
+            rgba[4*i + 0] = qRed( palette[i] );
+            rgba[4*i + 1] = qGreen( palette[i] );
+            rgba[4*i + 2] = qBlue( palette[i] );
+            rgba[4*i + 3] = qAlpha( palette[i] );
+        }
+
+        glBindTexture( GL_TEXTURE_2D, mPaletteTex );
+        glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba );
+    }
+}
+
+void GLSliceView::setLayers( const OverlayCompositor &layers )
+{
+    if ( !initShaders() || (mImgWidth == 0) )
+        return;
+
+    mNumLayers = std::min( layers.numLayers(), mNumLayerUnits );
+
+    static bool warned = false;
+    if ( (layers.numLayers() > mNumLayerUnits) && !warned ) {
+        qWarning("OpenGL viewer: only %u of %u overlay layers can be shown", mNumLayerUnits, layers.numLayers());
+        warned = true;
+    }
+
+    for (unsigned int l=0; l < mNumLayers; l++)
+    {
+        updateSlice( mLayers[l], layers.layerData(l) );
+
+        // weights are 0..256, which takes 9 bits: the shader puts the two bytes together again
+        const unsigned short *w = layers.layerWeights(l);
+        for (unsigned int v=0; v < 256; v++) {
+            mWeights[2 * (l * 256 + v) + 0] = w[v] & 0xFF;
+            mWeights[2 * (l * 256 + v) + 1] = w[v] >> 8;
+        }
+
+        const unsigned short *rgb = layers.layerColor(l);
+        for (unsigned int c=0; c < 3; c++)
+            mLayerColors[3*l + c] = rgb[c] / 255.0f;
+    }
+
+    // the weight tables are tiny, no need to check what changed
+    glBindTexture( GL_TEXTURE_2D, mWeightsTex );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, 256, MaxLayers, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, mWeights );
+
+    update();
+}
+
+void GLSliceView::invalidateOverlays()
+{
+    mLabels.data = 0;
+    for (unsigned int l=0; l < mLayers.size(); l++)
+        mLayers[l].data = 0;
+}
+
+void GLSliceView::invalidateOverlays( const QRect &rect )
+{
+    mLabels.dirty |= rect;
+    for (unsigned int l=0; l < mLayers.size(); l++)
+        mLayers[l].dirty |= rect;
+}
+
+void GLSliceView::resizeGL( int w, int h )
+{
+    glViewport( 0, 0, w, h );
+    clampCenter();
+}
+
+void GLSliceView::paintGL()
+{
+    qglClearColor( palette().color( backgroundRole() ) );
+    glClear( GL_COLOR_BUFFER_BIT );
+
+    if ( !mReady || (mImgWidth == 0) )
+        return;
+
+    glMatrixMode( GL_PROJECTION );
+    glLoadIdentity();
+    glOrtho( 0, width(), height(), 0, -1, 1 );
+
+    // image coordinates -> widget coordinates
+    glMatrixMode( GL_MODELVIEW );
+    glLoadIdentity();
+    glTranslated( width() / 2.0, height() / 2.0, 0 );
+    glScaled( mScaleFactor, mScaleFactor, 1 );
+    glTranslated( -mCenter.x(), -mCenter.y(), 0 );
+
+    const GLuint units[FirstLayerUnit] = { mBase.tex, mLabels.tex, mPaletteTex, mWeightsTex };
+    for (unsigned int u=0; u < FirstLayerUnit; u++) {
+        glActiveTexture( GL_TEXTURE0 + u );
+        glBindTexture( GL_TEXTURE_2D, units[u] );
+    }
+    for (unsigned int l=0; l < mNumLayers; l++) {
+        glActiveTexture( GL_TEXTURE0 + FirstLayerUnit + l );
+        glBindTexture( GL_TEXTURE_2D, mLayers[l].tex );
+    }
+    glActiveTexture( GL_TEXTURE0 );
+
+    mProgram->bind();
+    mProgram->setUniformValue( "uBase", 0 );
+    mProgram->setUniformValue( "uLabels", 1 );
+    mProgram->setUniformValue( "uPalette", 2 );
+    mProgram->setUniformValue( "uWeights", 3 );
+    mProgram->setUniformValue( "uBaseVisible", mBaseHidden ? 0.0f : 1.0f );
+    mProgram->setUniformValue( "uLabelAlpha", mLabelAlpha );
+    mProgram->setUniformValue( "uNumLayers", (GLint) mNumLayers );
+
+    for (unsigned int l=0; l < mNumLayerUnits; l++)
+        mProgram->setUniformValue( QString("uLayer%1").arg(l).toLatin1().constData(), (GLint)(FirstLayerUnit + l) );
+    if (mNumLayerUnits > 0)
+        mProgram->setUniformValueArray( "uColor", mLayerColors, mNumLayerUnits, 3 );
+
+    glBegin( GL_QUADS );
+        glTexCoord2f( 0, 0 ); glVertex2f( 0, 0 );
+        glTexCoord2f( 1, 0 ); glVertex2f( mImgWidth, 0 );
+        glTexCoord2f( 1, 1 ); glVertex2f( mImgWidth, mImgHeight );
+        glTexCoord2f( 0, 1 ); glVertex2f( 0, mImgHeight );
+    glEnd();
+
+    mProgram->release();
+}
+
+QPointF GLSliceView::screenToImageF( const QPointF &p ) const
+{
+    return QPointF( (p.x() - width() / 2.0) / mScaleFactor + mCenter.x(),
+                    (p.y() - height() / 2.0) / mScaleFactor + mCenter.y() );
+}
+
+QPoint GLSliceView::screenToImage( const QPoint &ev )
+{
+    const QPointF pf = screenToImageF( ev );
+    return QPoint( floor(pf.x()), floor(pf.y()) );
+}
+
+QRect GLSliceView::getViewableRect() const
+{
+    if ( mImgWidth == 0 )
+        return QRect();
+
+    const QPointF tl = screenToImageF( QPointF(0, 0) );
+    const QPointF br = screenToImageF( QPointF(width(), height()) );
+
+    QRect r( QPoint( floor(tl.x()), floor(tl.y()) ), QPoint( ceil(br.x()) - 1, ceil(br.y()) - 1 ) );
+
+    return r.intersected( QRect(0, 0, mImgWidth, mImgHeight) );
+}
+
+// keeps the view inside the image, or centered if the image is smaller than the view
+void GLSliceView::clampCenter()
+{
+    const double halfW = width() / (2.0 * mScaleFactor);
+    const double halfH = height() / (2.0 * mScaleFactor);
+
+    if ( 2 * halfW >= mImgWidth )
+        mCenter.setX( mImgWidth / 2.0 );
+    else
+        mCenter.setX( std::max( halfW, std::min( mImgWidth - halfW, mCenter.x() ) ) );
+
+    if ( 2 * halfH >= mImgHeight )
+        mCenter.setY( mImgHeight / 2.0 );
+    else
+        mCenter.setY( std::max( halfH, std::min( mImgHeight - halfH, mCenter.y() ) ) );
+}
+
+void GLSliceView::scale( double factor )
+{
+    // zoom around the mouse pointer
+    const QPointF pointBeforeScale = screenToImageF( mLastMouseMovePt );
+
+    mScaleFactor = std::max( mZoomMin, std::min( mZoomMax, mScaleFactor * factor ) );
+
+    const QPointF pointAfterScale = screenToImageF( mLastMouseMovePt );
+
+    mCenter += pointBeforeScale - pointAfterScale;
+    clampCenter();
+
+    update();
+}
+
+void GLSliceView::pan( double x, double y )
+{
+    mCenter += QPointF( x, y );
+    clampCenter();
+
+    update();
+}
+
+void GLSliceView::zoomFit()
+{
+    if ( (mImgWidth == 0) || (mImgHeight == 0) )
+        return;
+
+    const double fit = std::min( width() / (double)mImgWidth, height() / (double)mImgHeight );
+    mScaleFactor = std::max( mZoomMin, std::min( mZoomMax, fit ) );
+
+    mCenter = QPointF( mImgWidth / 2.0, mImgHeight / 2.0 );
+    clampCenter();
+
+    update();
+}
@@ -0,0 +1,141 @@
+#ifndef GLSLICEVIEW_H
+#define GLSLICEVIEW_H
+
+#include <QGLWidget>
+#include <QGLShaderProgram>
+#include <QGLFunctions>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QPointF>
+#include <QColor>
+#include <vector>
+
+#include "SliceViewer.h"
+
+class OverlayCompositor;
+
+/**
+ ** Slice viewer that blends on the GPU.
+ *  The gray slice, the label slice and the overlay slices are kept as 8-bit textures,
+ *  and a fragment shader blends them with the colors and weight tables of an OverlayCompositor.
+ *  The weights are exact, but the shader blends in floating point and the CPU path in integers,
+ *  so the colors approximately match it (within one level per channel).
+ *  Textures are only uploaded when their data changed, so zoom, pan and opacity changes
+ *  just redraw a quad. Needs OpenGL 2.0 / GLSL 1.10, which Mesa llvmpipe provides as well.
+ */
+class GLSliceView : public QGLWidget, public SliceViewer, protected QGLFunctions
+{
+    Q_OBJECT
+public:
+    explicit GLSliceView(QWidget *parent = 0);
+    ~GLSliceView();
+
+    // makes the context current, creating the textures and compiling the shaders the first time.
+    //  false if OpenGL 2.0 is not available
+    bool initShaders();
+
+    // gray slice, uploaded only if data/size changed or invalidateBase() was called
+    void setBase( const unsigned char *data, unsigned int width, unsigned int height, bool hidden );
+    void invalidateBase();
+
+    // label slice (0 to disable), colored with a palette of 256 entries whose alpha is the label opacity
+    void setLabels( const unsigned char *data, const QRgb *palette, float alpha );
+
+    // overlay layers, blended as OverlayCompositor::composite() does. The slices are
+    //  only uploaded again for layers whose data pointer changed
+    void setLayers( const OverlayCompositor &layers );
+
+    // contents of the label/overlay slices changed (only in rect)
+    void invalidateOverlays();
+    void invalidateOverlays( const QRect &rect );
+
+    // SliceViewer
+    QPoint screenToImage( const QPoint &ev );
+    QRect getViewableRect() const;
+    void scale( double factor );
+    void pan( double x, double y );
+    double scaleFactor() const { return mScaleFactor; }
+
+    void setZoomLimits( double min, double max) { mZoomMax = max; mZoomMin = min; }
+
+private:
+    enum { MaxLayers = 8, FirstLayerUnit = 4 };
+
+    struct SliceTexture
+    {
+        unsigned int         tex;
+        const unsigned char *data;      // slice it was uploaded from
+        QRect                dirty;     // area to upload again
+
+        SliceTexture() : tex(0), data(0) { }
+    };
+
+    QGLShaderProgram *mProgram;
+    bool    mReady;
+    bool    mFailed;
+    unsigned int mNumLayerUnits;    // layers supported by the shader
+
+    unsigned int mImgWidth, mImgHeight;
+
+    SliceTexture mBase;
+    bool         mBaseHidden;
+
+    SliceTexture mLabels;
+    float        mLabelAlpha;
+    unsigned int mPaletteTex;
+    QRgb         mPalette[256];
+
+    std::vector<SliceTexture> mLayers;
+    unsigned int mNumLayers;
+    unsigned int mWeightsTex;       // 256 x MaxLayers weight tables, 0..256 as low (luminance) and high (alpha) byte
+    unsigned char mWeights[MaxLayers * 256 * 2];
+    float        mLayerColors[MaxLayers * 3];
+
+    double  mScaleFactor;
+    double  mZoomMax, mZoomMin;
+    QPointF mCenter;        // image coordinates at the center of the widget
+    QPoint  mLastMouseMovePt;
+
+    bool setupGL();     // called once with the context current
+
+    // uploads data (image size) to st.tex if it is another slice than the last one,
+    //  otherwise only the dirty area
+    void updateSlice( SliceTexture &st, const unsigned char *data );
+    void allocSliceTexture( SliceTexture &st );
+
+    QPointF screenToImageF( const QPointF &p ) const;
+    void clampCenter();
+
+protected:
+    void initializeGL();
+    void resizeGL( int w, int h );
+    void paintGL();
+
+    virtual void wheelEvent ( QWheelEvent * event ) {
+        emit wheelEventSignal(event);
+    }
+
+    virtual void mouseMoveEvent ( QMouseEvent * ev ) {
+        mLastMouseMovePt = ev->pos();
+        emit mouseMoveEventSignal(ev);
+    }
+
+    virtual void mouseReleaseEvent ( QMouseEvent * ev ) {
+        emit mouseReleaseEventSignal(ev);
+    }
+
+    virtual void mousePressEvent ( QMouseEvent * ev ) {
+        emit mousePressEventSignal(ev);
+    }
+
+signals:
+    void wheelEventSignal( QWheelEvent *event );
+    void mouseMoveEventSignal( QMouseEvent *event );
+    void mouseReleaseEventSignal( QMouseEvent *event );
+    void mousePressEventSignal( QMouseEvent *event );
+
+public slots:
+    void zoomFit();
+};
+
+#endif // GLSLICEVIEW_H
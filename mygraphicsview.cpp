@@ -10,20 +10,43 @@
 #include <QWheelEvent>
 #include <QDebug>
 #include <QTime>
+#include <QElapsedTimer>
 #include <QImage>
+#include <QPen>
+
+#include <cstring>
+#include <algorithm>
 
 class MyPixmapItem : public QGraphicsPixmapItem
 {
 protected:
-    QImage *mImgPtr;
+    QImage  mTileImage;     // own copy of the image region shown by this tile
     bool    mImgUpdated;
-    QRect   mImgPtrRegion;
+    QRect   mImgRegion;     // region of the whole image covered by this tile
 
 public:
-    inline void setImgPtr( QImage *ptr, const QRect &region )
+    MyPixmapItem( const QRect &region ) : mImgUpdated(false), mImgRegion(region) { }
+
+    inline const QRect &region() const { return mImgRegion; }
+
+    // copies the part of 'rect' that falls inside this tile from img
+    inline void updateFrom( const QImage &img, const QRect &rect )
     {
-        mImgPtr = ptr;
-        mImgPtrRegion = region;
+        const QRect r = rect.intersected( mImgRegion );
+        if (r.isEmpty())
+            return;
+
+        if ( (mTileImage.size() != mImgRegion.size()) || (mTileImage.format() != img.format()) ) {
+            mTileImage = QImage( mImgRegion.size(), img.format() );
+            mTileImage.fill( 0 );   // the image may only be partially rendered
+        }
+
+        const unsigned int bpp = img.depth() / 8;
+        const unsigned int rowBytes = r.width() * bpp;
+        for (int y = r.top(); y <= r.bottom(); y++)
+            memcpy( mTileImage.scanLine( y - mImgRegion.top() ) + (r.left() - mImgRegion.left()) * bpp,
+                    img.constScanLine( y ) + r.left() * bpp, rowBytes );
+
         mImgUpdated = true;
     }
 
@@ -34,7 +57,7 @@ public:
         // only  update if flag is set
         if (mImgUpdated)
         {
-            setPixmap( QPixmap::fromImage( mImgPtr->copy( mImgPtrRegion ) ) );
+            setPixmap( QPixmap::fromImage( mTileImage ) );
             mImgUpdated = false;
             //qDebug("Updated");
         }
@@ -46,36 +69,45 @@ public:
 
 void MyGraphicsView::setImage( const QImage &img, const QRect &updateRect )
 {
-    const bool firstTime = (mScene->items().size() == 0) || ( img.width() != sceneRect().toRect().width() ) || ( img.height() != sceneRect().toRect().height() );
+    const bool firstTime = mTiles.empty() || ( img.width() != sceneRect().toRect().width() ) || ( img.height() != sceneRect().toRect().height() );
     const unsigned blockSize = 100;
 
-    // check how many blocks fit in x and y (round up)
-    const unsigned nBlocksX = (img.width() + blockSize - 1) / blockSize;
-    const unsigned nBlocksY = (img.height() + blockSize - 1) / blockSize;
-
-    const unsigned nTotal = nBlocksX * nBlocksY;
-
-    //qDebug("nTotal: %d", (int) nTotal);
-
     const unsigned imWidth = img.width();
     const unsigned imHeight = img.height();
 
-    // copy image
-    mOrigImage = img;
-
-
     //Set-up the view if it is the 1st time
     if (firstTime)
     {
         qDebug("First time graphics view");
+
+        for (unsigned int i=0; i < mTiles.size(); i++) {
+            mScene->removeItem( mTiles[i] );
+            delete mTiles[i];
+        }
+        mTiles.clear();
+
         setSceneRect(0, 0, img.width(), img.height());
         SetCenter(QPointF(img.width()/2.0, img.height()/2.0)); //A modified version of centerOn(), handles special cases
 
+        // the caller may have rendered only the area that was visible with the previous image
+        emit viewableRectChanged();
+
         for (unsigned xb=0; xb < imWidth; xb += blockSize)
         for (unsigned yb=0; yb < imHeight; yb += blockSize)
         {
-            MyPixmapItem *pi = new MyPixmapItem();
+            // this + 1 is a trick to avoid some artifacts when scaling
+            //  it means that some blocks will overlap, but who cares
+            unsigned w = blockSize + 1;
+            unsigned h = blockSize + 1;
+
+            if ( xb + w > imWidth )
+                w = imWidth - xb;
+            if ( yb + h > imHeight )
+                h = imHeight - yb;
+
+            MyPixmapItem *pi = new MyPixmapItem( QRect( xb, yb, w, h ) );
             mScene->addItem( pi );
+            mTiles.push_back( pi );
 
             // set coords
             pi->setPos( xb, yb );
@@ -86,57 +118,28 @@ void MyGraphicsView::setImage( const QImage &img, const QRect &updateRect )
         }
     }
 
-    unsigned int i=0;
-    for (unsigned xb=0; xb < imWidth; xb += blockSize)
-    for (unsigned yb=0; yb < imHeight; yb += blockSize)
-    {
-        MyPixmapItem *pi = ((MyPixmapItem *) mScene->items()[i]);
-
-
-        // this + 1 is a trick to avoid some artifacts when scaling
-        //  it means that some blocks will overlap, but who cares
-        unsigned w = blockSize + 1;
-        unsigned h = blockSize + 1;
-
-        QPointF pos = pi->pos();
+    // only the tiles touched by updateRect are copied (and uploaded when painted)
+    //  tiles never updated are not drawn, so a new image can also be set partially
+    QRect toUpdate = img.rect();
+    if ( updateRect.isValid() )
+        toUpdate = updateRect.intersected( img.rect() );
 
-        if ( pos.x() + w > imWidth )
-            w = imWidth - pos.x();
-        if ( pos.y() + h > imHeight )
-            h = imHeight - pos.y();
-
-        pi->setImgPtr( &mOrigImage, QRect( pos.x(), pos.y(), w, h ) );
-
-        i++;
+    if ( toUpdate.isEmpty() ) {
+        if (firstTime)
+            viewport()->update();
+        return;
     }
 
-    viewport()->update();
-
+    for (unsigned int i=0; i < mTiles.size(); i++)
+    {
+        if ( mTiles[i]->region().intersects( toUpdate ) )
+            mTiles[i]->updateFrom( img, toUpdate );
+    }
 
-    //qDebug("Valid: %d", (int)updateRect.isValid());
-/*
-    QRect toUpdate;
-    if (updateRect.isValid())
-        toUpdate = updateRect;
+    if ( firstTime || (toUpdate == img.rect()) )
+        viewport()->update();
     else
-        toUpdate = img.rect();
-
-    //toUpdate.setHeight(100);
-    //toUpdate.setWidth(100);
-
-    QRect thisToScreen = mapFromScene( toUpdate ).boundingRect();
-
-    QRect newUpdate = thisToScreen.intersect( viewport()->rect() );
-
-    viewport()->update( newUpdate );*/
-
-    //mScene->update( QRectF(0,0,10,10) );
-
-    //qDebug("Image: %d %d", img.size().width(), img.size().height() );
-    //mScene->addPixmap( mPixmap );
-
-    /*mScene->update();
-    update();*/
+        viewport()->update( mapFromScene( QRectF(toUpdate) ).boundingRect().adjusted( -2, -2, 2, 2 ) );
 }
 
 /**
@@ -157,6 +160,15 @@ MyGraphicsView::MyGraphicsView(QWidget* parent) : QGraphicsView(parent)
     this->setCacheMode( QGraphicsView::CacheNone );
 
     this->setViewportUpdateMode( QGraphicsView::NoViewportUpdate );
+
+    mCursorRect = mScene->addRect( QRectF() );
+    mCursorEllipse = mScene->addEllipse( QRectF() );
+
+    QAbstractGraphicsShapeItem *cursors[] = { mCursorRect, mCursorEllipse };
+    for (unsigned int i=0; i < 2; i++) {
+        cursors[i]->setZValue( 1 );     // above the tiles
+        cursors[i]->hide();
+    }
 }
 
 /**
@@ -312,6 +324,8 @@ void MyGraphicsView::scale(double factor)
     //Adjust to the new center for correct zooming
     QPointF newCenter = screenCenter + offset;
     SetCenter(newCenter);
+
+    emit viewableRectChanged();
 }
 
 
@@ -333,11 +347,80 @@ void MyGraphicsView::resizeEvent(QResizeEvent* event) {
 
     //Call the subclass resize so the scrollbars are updated correctly
     QGraphicsView::resizeEvent(event);
+
+    emit viewableRectChanged();
+}
+
+void MyGraphicsView::scrollContentsBy( int dx, int dy )
+{
+    QGraphicsView::scrollContentsBy( dx, dy );
+
+    emit viewableRectChanged();
+}
+
+void MyGraphicsView::paintEvent( QPaintEvent *event )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QGraphicsView::paintEvent( event );
+
+    emit viewportPainted( timer.nsecsElapsed() );
+}
+
+void MyGraphicsView::setBrushCursor( const QRect &rect, bool ellipse, const QColor &color )
+{
+    QAbstractGraphicsShapeItem *shown = mCursorRect;
+    QAbstractGraphicsShapeItem *hidden = mCursorEllipse;
+    if (ellipse)
+        std::swap( shown, hidden );
+
+    // cosmetic pen, one screen pixel wide at any zoom, and a faint fill
+    QPen pen( color );
+    pen.setCosmetic( true );
+
+    QColor fill( color );
+    fill.setAlpha( 60 );
+
+    if (ellipse)
+        mCursorEllipse->setRect( QRectF(rect) );
+    else
+        mCursorRect->setRect( QRectF(rect) );
+
+    shown->setPen( pen );
+    shown->setBrush( fill );
+    shown->show();
+    hidden->hide();
+
+    // the viewport is only updated explicitly (NoViewportUpdate): the old and the new position
+    updateCursorArea();
+    mCursorSceneRect = QRectF(rect);
+    updateCursorArea();
+}
+
+void MyGraphicsView::hideBrushCursor()
+{
+    if ( !mCursorRect->isVisible() && !mCursorEllipse->isVisible() )
+        return;
+
+    mCursorRect->hide();
+    mCursorEllipse->hide();
+
+    updateCursorArea();
+    mCursorSceneRect = QRectF();
+}
+
+void MyGraphicsView::updateCursorArea()
+{
+    if ( mCursorSceneRect.isEmpty() )
+        return;
+
+    viewport()->update( mapFromScene( mCursorSceneRect ).boundingRect().adjusted( -2, -2, 2, 2 ) );
 }
 
 QRect MyGraphicsView::getViewableRect() const
 {
-    if (mScene->items().size() == 0)
+    if ( mTiles.empty() )
         return QRect();
 
     QRect r =
@@ -3,17 +3,31 @@
 
 #include <QGraphicsView>
 #include <QGraphicsRectItem>
+#include <QGraphicsEllipseItem>
 #include <QPixmap>
 #include <QMouseEvent>
 #include <QGraphicsScene>
 #include <QImage>
+#include <vector>
 
-class MyGraphicsView : public QGraphicsView
+#include "SliceViewer.h"
+
+class MyPixmapItem;
+
+class MyGraphicsView : public QGraphicsView, public SliceViewer
 {
     Q_OBJECT
 protected:
     QGraphicsScene* mScene;
-    QImage  mOrigImage;
+    std::vector<MyPixmapItem *> mTiles;  // image tiles, owned by mScene
+
+    // brush cursor outlines, on top of the tiles and owned by mScene. Moving them only
+    //  repaints the viewport around them, the image is not touched
+    QGraphicsRectItem    *mCursorRect;
+    QGraphicsEllipseItem *mCursorEllipse;
+    QRectF                mCursorSceneRect;  // area covered by the visible cursor
+
+    void updateCursorArea();    // repaints the viewport where the cursor is
 
 public:
     explicit MyGraphicsView(QWidget *parent = 0);
@@ -26,16 +40,22 @@ public:
     void setZoomLimits( double min, double max) { mZoomMax = max; mZoomMin = min; }
     double scaleFactor() const { return mScaleFactor; }
 
+    // copies the area updateRect of img to the tiles it touches (whole image if not valid),
+    //  img is not retained
     void setImage( const QImage &img, const QRect &updateRect = QRect() );
 
     // returns 'viewable rect' in image (pixmap) coordinates
     QRect getViewableRect() const;
 
+    // shows the brush cursor as the outline of rect (image coordinates), or of the ellipse inside it
+    void setBrushCursor( const QRect &rect, bool ellipse, const QColor &color );
+    void hideBrushCursor();
+
     // pan / scale
     void scale(double factor);
     void pan( double x, double y );
 
-    inline QPoint screenToImage( const QPoint &ev )
+    QPoint screenToImage( const QPoint &ev )
     {
         QPointF pf = mapToScene( ev );
 
@@ -78,6 +98,8 @@ protected:
     }
 
     virtual void resizeEvent(QResizeEvent* event);
+    virtual void scrollContentsBy( int dx, int dy );
+    virtual void paintEvent( QPaintEvent *event );
     
 signals:
     void wheelEventSignal( QWheelEvent *event );
@@ -85,6 +107,12 @@ signals:
     void mouseReleaseEventSignal( QMouseEvent *event );
     void mousePressEventSignal( QMouseEvent *event );
 
+    // getViewableRect() may have changed (scroll, zoom, resize or a new image size)
+    void viewableRectChanged();
+
+    // the viewport was painted, in nsecs (tile pixmaps are converted while painting)
+    void viewportPainted( qint64 nsecs );
+
 public slots:
     // fits the image within the scrollarea size
     void zoomFit()
@@ -9,6 +9,7 @@
 #include "utils.h"
 
 #include <QDebug>
+#include <QTime>
 
 #include "itkImage.h"
 #include "itkImageFileWriter.h"
@@ -31,7 +32,6 @@ PluginBase *createPlugin()
 GraphCutsPlugin::GraphCutsPlugin(QObject *parent) : PluginBase(parent)
 {
     activeOverlay = 0;
-    mouseEventDetected = false;
     brushSizeX = 3;
     brushSizeY = 3;
     brushSizeZ = 3;
@@ -43,18 +43,10 @@ GraphCutsPlugin::GraphCutsPlugin(QObject *parent) : PluginBase(parent)
 
     outputWeightImage = 0;
     cache_gaussianVariance = -1;
-
-    timer = new QTimer;
-    timer->setInterval(40);
-    timer->setSingleShot(false);
-    QObject::connect(timer, SIGNAL(timeout()), this, SLOT(updateOverlay()));
-    timer->start();
 }
 
 GraphCutsPlugin::~GraphCutsPlugin()
 {    
-    timer->stop();
-    delete timer;
     if(outputWeightImage) {
         delete[] outputWeightImage;
     }
@@ -77,6 +69,104 @@ void GraphCutsPlugin::changeSettings()
     delete window;
 }
 
+void GraphCutsPlugin::updateWeightImage(Matrix3D<PixelType>& volData)
+{
+    if(outputWeightImage == 0 || cache_gaussianVariance != gaussianVariance) {
+        cache_gaussianVariance = gaussianVariance;
+        float* foutputWeightImage = 0;
+        gradientMagnitude<unsigned char, float>(volData.data(), volData.width(), volData.height(), volData.depth(), 1, gaussianVariance, foutputWeightImage);
+
+        cubeFloat2Uchar(foutputWeightImage,outputWeightImage,volData.width(), volData.height(), volData.depth());
+        delete[] foutputWeightImage;
+    }
+}
+
+void GraphCutsPlugin::runSupervoxelGraphCuts()
+{
+    unsigned int nSupervoxels = 0;
+    const Matrix3D<unsigned int> *svMap = mPluginServices->getSupervoxelMap(&nSupervoxels);
+    if(svMap == 0 || nSupervoxels == 0) {
+        QMessageBox::critical( mPluginServices->getMainWindow(), "No supervoxels",
+                               "Global supervoxels must be computed or loaded before running graph cuts on supervoxels." );
+        return;
+    }
+
+    Matrix3D<PixelType>& volData = mPluginServices->getVolumeVoxelData();
+    ulong cubeSize = volData.numElem();
+
+    // generate list of seeds
+    Matrix3D<ScoreType> &seedOverlay = mPluginServices->getOverlayVolumeData(idx_seed_overlay);
+    if(!seedOverlay.isSizeLike(volData)) {
+        fprintf(stderr,"Error: seed overlay is empty\n");
+        return;
+    }
+
+    std::vector<Point> sinkPoints;
+    std::vector<Point> sourcePoints;
+    for(int z = 0; z < seedOverlay.depth(); ++z) {
+        for(int y = 0; y < seedOverlay.height(); ++y) {
+            for(int x = 0; x < seedOverlay.width(); ++x) {
+                if(seedOverlay(x,y,z) == label_seed) {
+                    sourcePoints.push_back(Point(x,y,z));
+                } else {
+                    if(seedOverlay(x,y,z) == label_sink) {
+                        sinkPoints.push_back(Point(x,y,z));
+                    }
+                }
+            }
+        }
+    }
+
+    if(sourcePoints.size() == 0) {
+        fprintf(stderr,"Error: 0 source points\n");
+        return;
+    }
+    if(sinkPoints.size() == 0) {
+        fprintf(stderr,"Error: 0 sink points\n");
+        return;
+    }
+
+    qDebug() << "Running supervoxel graphcuts with variance " << gaussianVariance << " and sigma " << sigma;
+
+    QTime t; t.start();
+
+    // get weight image
+    updateWeightImage(volData);
+
+    Cube volumeCube;
+    volumeCube.width = volData.width();
+    volumeCube.height = volData.height();
+    volumeCube.depth = volData.depth();
+    volumeCube.wh = volumeCube.width*volumeCube.height;
+    volumeCube.data = volData.data();
+
+    Cube cGCWeight;
+    cGCWeight.width = volData.width();
+    cGCWeight.height = volData.height();
+    cGCWeight.depth = volData.depth();
+    cGCWeight.wh = cGCWeight.width*cGCWeight.height;
+    cGCWeight.data = outputWeightImage;
+
+    GraphCut g;
+    printf("Running max-flow with %ld sources and %ld sinks on %d supervoxels\n", sourcePoints.size(), sinkPoints.size(), nSupervoxels);
+    g.run_maxflow_supervoxels(svMap->data(), nSupervoxels, &volumeCube, &cGCWeight, sourcePoints, sinkPoints, sigma);
+
+    // copy output to a new overlay
+    mPluginServices->beginUndoStep( "supervoxel graph cut" );
+    mPluginServices->aboutToModifyOverlay( idx_output_overlay );
+
+    Matrix3D<OverlayType> &ovMatrix = mPluginServices->getOverlayVolumeData(idx_output_overlay);
+    ovMatrix.reallocSizeLike(volData);
+    g.getOutputSupervoxels(svMap->data(), cubeSize, ovMatrix.data());
+
+    mPluginServices->endUndoStep();
+
+    printf("Supervoxel graph cut done in %d ms\n", t.elapsed());
+
+    mPluginServices->setOverlayVisible( idx_output_overlay, true );
+    mPluginServices->updateDisplay();
+}
+
 void GraphCutsPlugin::runGraphCuts()
 {
     //const int seedRadius = 3;
@@ -86,6 +176,11 @@ void GraphCutsPlugin::runGraphCuts()
     QAction *action = qobject_cast<QAction *>(sender());
     unsigned int idx = action->data().toUInt();
 
+    if(idx == GC_SUPERVOXELS) {
+        runSupervoxelGraphCuts();
+        return;
+    }
+
     Matrix3D<OverlayType> &scoreImage = mPluginServices->getOverlayVolumeData(idx_bindata_overlay);
     if(scoreImage.isEmpty()) {
         printf("Error: No score image loaded in overlay %d\n", idx_bindata_overlay);
@@ -144,14 +239,7 @@ void GraphCutsPlugin::runGraphCuts()
     ulong cubeSize = volData.numElem();
 
     // get weight image
-    if(outputWeightImage == 0 || cache_gaussianVariance != gaussianVariance) {
-        cache_gaussianVariance = gaussianVariance;
-        float* foutputWeightImage = 0;
-        gradientMagnitude<unsigned char, float>(volData.data(), volData.width(), volData.height(), volData.depth(), 1, gaussianVariance, foutputWeightImage);
-
-        cubeFloat2Uchar(foutputWeightImage,outputWeightImage,volData.width(), volData.height(), volData.depth());
-        delete[] foutputWeightImage;
-    }
+    updateWeightImage(volData);
 
     if(outputOverlays) {
         // copy weight image to overlay
@@ -353,6 +441,9 @@ void GraphCutsPlugin::runGraphCuts()
     }
 
     // copy output to a new overlay    
+    mPluginServices->beginUndoStep( "graph cut" );
+    mPluginServices->aboutToModifyOverlay( idx_output_overlay );
+
     Matrix3D<OverlayType> &ovMatrix = mPluginServices->getOverlayVolumeData(idx_output_overlay);
     ovMatrix.reallocSizeLike(volData);
     LabelType *dPtr = ovMatrix.data();
@@ -360,6 +451,8 @@ void GraphCutsPlugin::runGraphCuts()
         dPtr[i] = output_data1d[i];
     }
 
+    mPluginServices->endUndoStep();
+
     // set enabled    
     mPluginServices->setOverlayVisible( idx_weight_overlay, true );
     mPluginServices->setOverlayVisible( idx_output_overlay, true );
@@ -374,12 +467,17 @@ void GraphCutsPlugin::cleanSeedOverlay()
 {
     Matrix3D<ScoreType> &seedOverlay = mPluginServices->getOverlayVolumeData(idx_seed_overlay);
 
+    mPluginServices->beginUndoStep( "clean seeds" );
+    mPluginServices->aboutToModifyOverlay( idx_seed_overlay );
+
     if (seedOverlay.isEmpty())
     {
         seedOverlay.reallocSizeLike( mPluginServices->getVolumeVoxelData() );
     }
 
     seedOverlay.fill(0);
+
+    mPluginServices->endUndoStep();
     mPluginServices->setOverlayVisible(idx_seed_overlay, true );
     mPluginServices->updateDisplay();
 }
@@ -390,6 +488,10 @@ void GraphCutsPlugin::transferOverlay()
 
     if (!outputOverlay.isEmpty())
     {
+        // the seeds are cleaned in the same step
+        mPluginServices->beginUndoStep( "transfer overlay" );
+        mPluginServices->aboutToModifyOverlay( idx_bindata_overlay );
+
         Matrix3D<ScoreType> &inputOverlay = mPluginServices->getOverlayVolumeData(idx_bindata_overlay);
         //inputOverlay.copyFrom(outputOverlay);
         LabelType *dPtrInput = inputOverlay.data();
@@ -402,5 +504,7 @@ void GraphCutsPlugin::transferOverlay()
         mPluginServices->updateDisplay();
 
         cleanSeedOverlay();
+
+        mPluginServices->endUndoStep();
     }    
 }
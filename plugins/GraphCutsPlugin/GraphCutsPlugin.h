@@ -6,10 +6,10 @@
   */
 
 #include <PluginBase.h>
+#include <BrushKernels.h>
 #include <cstdlib>
 #include <QMessageBox>
 #include <QMouseEvent>
-#include <QTimer>
 
 using namespace std;
 
@@ -28,7 +28,8 @@ enum eGCType
     GC_DEFAULT = 0,
     GC_LIMITED,
     GC_SCORES,
-    GC_DATA
+    GC_DATA,
+    GC_SUPERVOXELS
 };
 
 class GraphCutsPlugin : public PluginBase
@@ -37,8 +38,6 @@ class GraphCutsPlugin : public PluginBase
 private:
     const PluginServices* mPluginServices;
 
-    QTimer* timer;
-
     // id of the active overlay
     int activeOverlay;
 
@@ -54,11 +53,15 @@ private:
     float gaussianVariance;
     float sigma;
 
-    bool mouseEventDetected;
-
     uchar* outputWeightImage;
     float cache_gaussianVariance;
 
+    // (re)computes outputWeightImage if gaussianVariance changed
+    void updateWeightImage(Matrix3D<PixelType>& volData);
+
+    // graph over the global supervoxels instead of a voxel sub-cube
+    void runSupervoxelGraphCuts();
+
 public:
     GraphCutsPlugin(QObject *parent = 0);
 
@@ -102,6 +105,13 @@ public:
             connect( action, SIGNAL(triggered()), this, SLOT(runGraphCuts()) );
         }
 
+        /** Add a menu item **/
+        {
+            QAction *action = mPluginServices->getPluginMenu()->addAction( QString("Run (supervoxels)") );
+            action->setData(GC_SUPERVOXELS);
+            connect( action, SIGNAL(triggered()), this, SLOT(runGraphCuts()) );
+        }
+
         /** Add a menu item **/
         {
             QAction *action = mPluginServices->getPluginMenu()->addAction( "Clean seed overlay" );
@@ -148,44 +158,34 @@ public:
     {
         Matrix3D<ScoreType> &activeOverlayMatrix = mPluginServices->getOverlayVolumeData(activeOverlay);
 
+        // brush box [img - brushSize, img + brushSize], inclusive
+        const int x0 = (int)imgX - brushSizeX, x1 = (int)imgX + brushSizeX;
+        const int y0 = (int)imgY - brushSizeY, y1 = (int)imgY + brushSizeY;
+        const int z0 = (int)imgZ - brushSizeZ, z1 = (int)imgZ + brushSizeZ;
+
+        // the main window makes a drag a single undo step, this one is nested in it.
+        //  An empty overlay is recorded as such, before it is allocated
+        mPluginServices->beginUndoStep( "seed brush" );
+        mPluginServices->aboutToModifyOverlay( activeOverlay, x0, y0, z0, x1, y1, z1 );
+
         if (activeOverlayMatrix.isEmpty())
         {
             activeOverlayMatrix.reallocSizeLike( mPluginServices->getVolumeVoxelData() );
             activeOverlayMatrix.fill(0);
         }
 
-        if (evt->modifiers() & Qt::ControlModifier || evt->buttons() & Qt::RightButton) {
-            for(int x = max(0, (int)imgX - brushSizeX); x <= min(activeOverlayMatrix.width()-1, imgX + brushSizeX); ++x) {
-                for(int y = max(0, (int)imgY - brushSizeY); y <= min(activeOverlayMatrix.height()-1, imgY + brushSizeY); ++y) {
-                    for(int z = max(0, (int)imgZ - brushSizeZ); z <= min(activeOverlayMatrix.depth()-1, imgZ + brushSizeZ); ++z) {
-                        activeOverlayMatrix(x,y,z) = 0;
-                    }
-                }
-            }
-        } else {
-            if (evt->modifiers() & Qt::ShiftModifier) {
-                for(int x = max(0, (int)imgX - brushSizeX); x <= min(activeOverlayMatrix.width()-1, imgX + brushSizeX); ++x) {
-                    for(int y = max(0, (int)imgY - brushSizeY); y <= min(activeOverlayMatrix.height()-1, imgY + brushSizeY); ++y) {
-                        for(int z = max(0, (int)imgZ - brushSizeZ); z <= min(activeOverlayMatrix.depth()-1, imgZ + brushSizeZ); ++z) {
-                            activeOverlayMatrix(x,y,z) = 128;
-                        }
-                    }
-                }
-            }
-            else {
-                for(int x = max(0, (int)imgX - brushSizeX); x <= min(activeOverlayMatrix.width()-1, imgX + brushSizeX); ++x) {
-                    for(int y = max(0, (int)imgY - brushSizeY); y <= min(activeOverlayMatrix.height()-1, imgY + brushSizeY); ++y) {
-                        for(int z = max(0, (int)imgZ - brushSizeZ); z <= min(activeOverlayMatrix.depth()-1, imgZ + brushSizeZ); ++z) {
-                            activeOverlayMatrix(x,y,z) = 255;
-                        }
-                    }
-                }
-            }
-        }
+        if (evt->modifiers() & Qt::ControlModifier || evt->buttons() & Qt::RightButton)
+            BrushKernels::paintBox<BrushKernels::WriteErase>( activeOverlayMatrix, x0, y0, z0, x1, y1, z1, (ScoreType)0 );
+        else if (evt->modifiers() & Qt::ShiftModifier)
+            BrushKernels::paintBox<BrushKernels::WriteSet>( activeOverlayMatrix, x0, y0, z0, x1, y1, z1, (ScoreType)128 );
+        else
+            BrushKernels::paintBox<BrushKernels::WriteSet>( activeOverlayMatrix, x0, y0, z0, x1, y1, z1, (ScoreType)255 );
+
+        mPluginServices->endUndoStep();
 
-        mouseEventDetected = true;
-        //mPluginServices->setOverlayVisible(activeOverlay, true );
-        //mPluginServices->updateDisplay();
+        // only the brush box is composited again, redraws are coalesced by the main window
+        mPluginServices->setOverlayVisible(activeOverlay, true );
+        mPluginServices->updateDisplay( x0, y0, z0, x1, y1, z1 );
     }
 
 public slots:
@@ -203,15 +203,6 @@ public slots:
     {
         QMessageBox::information( mPluginServices->getMainWindow(), "Clicked me!", "You have just clicked me." );
     }
-
-    void updateOverlay()
-    {
-        if(mouseEventDetected) {
-            mouseEventDetected = false;
-            mPluginServices->setOverlayVisible(activeOverlay, true );
-            mPluginServices->updateDisplay();
-        }
-    }
 };
 
 #endif // GRAPHCUTSPLUGIN_H
@@ -17,6 +17,7 @@ HEADERS += \
     graphCut.h \
     utils.h \
     ../../PluginBase.h \
+    ../../BrushKernels.h \
     gcdialog.h \
     settingsdialog.h
 
@@ -1,5 +1,6 @@
 #include "graphCut.h"
 #include <climits>
+#include <cmath>
 
 GraphCut::GraphCut()
 {
@@ -10,6 +11,7 @@ GraphCut::GraphCut()
   subX = 0;
   subY = 0;
   subZ = 0;
+  nSupervoxelNodes = 0;
 }
 
 GraphCut::~GraphCut() {
@@ -442,3 +444,201 @@ void GraphCut::run_maxflow(Cube* cube,
   running_maxflow = false;
 }
 
+// boundary statistics between two neighbouring supervoxels
+struct SupervoxelBoundary
+{
+  unsigned int neighbor;
+  ulong count;        // number of voxel faces shared
+  float weightSum;    // sum of the weight (gradient) along the boundary
+
+  SupervoxelBoundary(unsigned int n) { neighbor = n; count = 0; weightSum = 0; }
+};
+
+typedef vector<SupervoxelBoundary> SupervoxelBoundaryList;
+
+// adjacency lists are short (~20 neighbours), a linear search is cheaper than a map
+static inline void addBoundary(SupervoxelBoundaryList& list, unsigned int neighbor, float weight)
+{
+  for(ulong i = 0; i < list.size(); i++) {
+    if(list[i].neighbor == neighbor) {
+      list[i].count++;
+      list[i].weightSum += weight;
+      return;
+    }
+  }
+  list.push_back(SupervoxelBoundary(neighbor));
+  list.back().count = 1;
+  list.back().weightSum = weight;
+}
+
+void GraphCut::run_maxflow_supervoxels(const unsigned int* svMap, unsigned int nSupervoxels,
+                                       Cube* volume, Cube* weights,
+                                       vector<Point>& sourcePoints, vector<Point>& sinkPoints,
+                                       float sigma)
+{
+  const int nbItemsPerBin = 25;
+  const int histoSize = 255/nbItemsPerBin + 1;
+  // avoids log(0) for bins never seen in the seeds
+  const float histoEps = 1e-4f;
+  float K = 1e8;
+
+  running_maxflow = true;
+
+  ulong width = volume->width;
+  ulong height = volume->height;
+  ulong depth = volume->depth;
+  ulong wh = volume->wh;
+
+  // Free memory
+  if(m_node_ids!=0) {
+    delete[] m_node_ids;
+  }
+  if(m_graph!=0) {
+    delete m_graph;
+  }
+
+  // Per-supervoxel histograms and adjacency, single pass over the volume
+  printf("[GraphCuts] Computing statistics for %d supervoxels\n", nSupervoxels);
+  vector<float> svHisto((ulong)nSupervoxels*histoSize, 0.0f);
+  vector<SupervoxelBoundaryList> adjacency(nSupervoxels);
+
+  ulong cubeIdx = 0;
+  for(ulong z = 0; z < depth; z++) {
+    for(ulong y = 0; y < height; y++) {
+      for(ulong x = 0; x < width; x++, cubeIdx++) {
+        unsigned int sv = svMap[cubeIdx];
+        if(sv >= nSupervoxels)
+          continue;
+
+        int binId = volume->data[cubeIdx]/nbItemsPerBin;
+        svHisto[(ulong)sv*histoSize + binId]++;
+
+        // only look forward, each face is visited once
+        if(x+1 < width && svMap[cubeIdx+1] != sv && svMap[cubeIdx+1] < nSupervoxels) {
+          float w = 0.5f*(weights->data[cubeIdx] + weights->data[cubeIdx+1]);
+          addBoundary(adjacency[sv], svMap[cubeIdx+1], w);
+        }
+        if(y+1 < height && svMap[cubeIdx+width] != sv && svMap[cubeIdx+width] < nSupervoxels) {
+          float w = 0.5f*(weights->data[cubeIdx] + weights->data[cubeIdx+width]);
+          addBoundary(adjacency[sv], svMap[cubeIdx+width], w);
+        }
+        if(z+1 < depth && svMap[cubeIdx+wh] != sv && svMap[cubeIdx+wh] < nSupervoxels) {
+          float w = 0.5f*(weights->data[cubeIdx] + weights->data[cubeIdx+wh]);
+          addBoundary(adjacency[sv], svMap[cubeIdx+wh], w);
+        }
+      }
+    }
+  }
+
+  // Seeded supervoxels and their histograms
+  vector<uchar> isSource(nSupervoxels, 0);
+  vector<uchar> isSink(nSupervoxels, 0);
+  for(vector<Point>::iterator itPoint=sourcePoints.begin();
+      itPoint != sourcePoints.end();itPoint++) {
+    unsigned int sv = svMap[itPoint->z*wh + itPoint->y*width + itPoint->x];
+    if(sv < nSupervoxels)
+      isSource[sv] = 1;
+  }
+  for(vector<Point>::iterator itPoint=sinkPoints.begin();
+      itPoint != sinkPoints.end();itPoint++) {
+    unsigned int sv = svMap[itPoint->z*wh + itPoint->y*width + itPoint->x];
+    if(sv < nSupervoxels)
+      isSink[sv] = 1;
+  }
+
+  vector<float> histoSource(histoSize, 0.0f);
+  vector<float> histoSink(histoSize, 0.0f);
+  for(unsigned int sv = 0; sv < nSupervoxels; sv++) {
+    for(int b = 0; b < histoSize; b++) {
+      if(isSource[sv])
+        histoSource[b] += svHisto[(ulong)sv*histoSize + b];
+      if(isSink[sv])
+        histoSink[b] += svHisto[(ulong)sv*histoSize + b];
+    }
+  }
+
+  // Normalize histograms and store negative log-likelihoods
+  float sumSource = 0;
+  float sumSink = 0;
+  for(int b = 0; b < histoSize; b++) {
+    sumSource += histoSource[b];
+    sumSink += histoSink[b];
+  }
+  for(int b = 0; b < histoSize; b++) {
+    histoSource[b] = -log(histoSource[b]/max(sumSource,1.0f) + histoEps);
+    histoSink[b] = -log(histoSink[b]/max(sumSink,1.0f) + histoEps);
+  }
+
+  ulong nEdges = 0;
+  for(unsigned int sv = 0; sv < nSupervoxels; sv++)
+    nEdges += adjacency[sv].size();
+
+  printf("[GraphCuts] supervoxel graph: %d nodes, %ld edges\n", nSupervoxels, nEdges);
+
+  m_graph = new GraphType(nSupervoxels, nEdges);
+  m_node_ids = new GraphType::node_id[nSupervoxels];
+  for(unsigned int i = 0;i < nSupervoxels; i++) {
+    m_node_ids[i] = m_graph->add_node();
+  }
+  nSupervoxelNodes = nSupervoxels;
+
+  // Regional term
+  // a supervoxel labelled as sink has its edge from the source cut, so that edge gets
+  // -log(P(I|sink)) summed over its voxels (from the sink histogram), and vice versa.
+  // Seeds are tied to their terminal with K
+  for(unsigned int sv = 0; sv < nSupervoxels; sv++) {
+    float weightToSource = 0;
+    float weightToSink = 0;
+
+    if(isSource[sv]) {
+      weightToSource = K;
+    } else if(isSink[sv]) {
+      weightToSink = K;
+    } else {
+      for(int b = 0; b < histoSize; b++) {
+        float count = svHisto[(ulong)sv*histoSize + b];
+        weightToSource += count*histoSink[b];
+        weightToSink += count*histoSource[b];
+      }
+    }
+
+    m_graph->add_tweights(m_node_ids[sv],weightToSource,weightToSink);
+  }
+
+  // Boundary term
+  // B(p,q) = sigma * |boundary(p,q)| / (1 + mean weight along boundary)
+  for(unsigned int sv = 0; sv < nSupervoxels; sv++) {
+    for(ulong i = 0; i < adjacency[sv].size(); i++) {
+      const SupervoxelBoundary& b = adjacency[sv][i];
+      float meanWeight = b.weightSum/b.count;
+      float weight = sigma*b.count/(1.0f + meanWeight);
+      m_graph->add_edge(m_node_ids[sv], m_node_ids[b.neighbor], weight, weight);
+    }
+  }
+
+  printf("[GraphCuts] Computing max flow\n");
+  float flow = m_graph->maxflow();
+
+  printf("[GraphCuts] Max flow=%f\n", flow);
+  running_maxflow = false;
+}
+
+void GraphCut::getOutputSupervoxels(const unsigned int* svMap, ulong nVoxels, uchar* output_data)
+{
+  // look up the segment once per supervoxel
+  vector<uchar> svLabel(nSupervoxelNodes);
+  for(ulong sv = 0; sv < nSupervoxelNodes; sv++) {
+    if(m_graph->what_segment(m_node_ids[sv]) == GraphType::SOURCE) {
+      svLabel[sv] = 128;
+    } else {
+      svLabel[sv] = 255;
+    }
+  }
+
+  for(ulong i = 0; i < nVoxels; i++) {
+    if(svMap[i] < nSupervoxelNodes)
+      output_data[i] = svLabel[svMap[i]];
+    else
+      output_data[i] = 0;
+  }
+}
@@ -89,6 +89,7 @@ class GraphCut
   GraphType::node_id* m_node_ids;
   int ni,nj,nk;
   ulong nij;
+  ulong nSupervoxelNodes; // != 0 if the graph was built over supervoxels
   ulong subX, subY, subZ;
   Cube* subCube;
   //uchar* subCube;
@@ -132,6 +133,19 @@ class GraphCut
                    vector<Point>& sourcePoints, vector<Point>& sinkPoints,
                    float sigma = 100.0f, int minDist = 3,
                    eUnaryWeights unaryType = UNARY_NONE, Cube* scores = 0);
+
+  // Builds the graph over supervoxels instead of voxels (one node per supervoxel).
+  // svMap holds the supervoxel ID of every voxel of volume/weights.
+  // Unary terms come from per-supervoxel intensity histograms compared
+  // to the histograms of the seeded supervoxels, pairwise terms from the
+  // area and mean weight (gradient) of the boundary between two supervoxels.
+  void run_maxflow_supervoxels(const unsigned int* svMap, unsigned int nSupervoxels,
+                               Cube* volume, Cube* weights,
+                               vector<Point>& sourcePoints, vector<Point>& sinkPoints,
+                               float sigma = 100.0f);
+
+  // output for run_maxflow_supervoxels, same labels as getOutput()
+  void getOutputSupervoxels(const unsigned int* svMap, ulong nVoxels, uchar* output_data);
  
   GraphType *m_graph;
 
@@ -60,6 +60,9 @@ void MainWindow::updateEdgeMap()
                                 gaussianVariance);
     printf("Canny map computed. Copying data...\n");
 
+    mPluginServices->beginUndoStep( "canny" );
+    mPluginServices->aboutToModifyOverlay( volume_idx );
+
     Matrix3D<OverlayType> &ovMatrix = mPluginServices->getOverlayVolumeData(volume_idx);
 
     // MUST BE RESIZED!
@@ -76,6 +79,8 @@ void MainWindow::updateEdgeMap()
     delete[] cannyMap;
     printf("Done\n");
 
+    mPluginServices->endUndoStep();
+
     // set enabled
     mPluginServices->setOverlayVisible( volume_idx, true );
 
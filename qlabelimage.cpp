@@ -1,8 +1,73 @@
 #include "qlabelimage.h"
 
+#include <QPainter>
+#include <cmath>
+
 QLabelImage::QLabelImage(QWidget *parent) :
     QLabel(parent)
 {
     mScaleFactor = 1.0;
     setZoomLimits( 0.1, 10 );
 }
+
+void QLabelImage::setImage( const QImage &img, const QRect &updateRect )
+{
+    if ( mOriginalPixmap.isNull() || (mOriginalPixmap.size() != img.size()) || !updateRect.isValid() )
+    {
+        setPixmap( QPixmap::fromImage(img) );
+        return;
+    }
+
+    const QRect r = updateRect.intersected( img.rect() );
+    if ( r.isEmpty() )
+        return;
+
+    {
+        QPainter painter( &mOriginalPixmap );
+        painter.setCompositionMode( QPainter::CompositionMode_Source );
+        painter.drawImage( r.topLeft(), img, r );
+    }
+
+    QLabel::update( imageToWidget( r ) );
+}
+
+QRect QLabelImage::imageToWidget( const QRect &r ) const
+{
+    const double sx = width() * 1.0 / mOriginalPixmap.width();
+    const double sy = height() * 1.0 / mOriginalPixmap.height();
+
+    return QRect( QPoint( floor( r.left() * sx ), floor( r.top() * sy ) ),
+                  QPoint( ceil( (r.right() + 1) * sx ) - 1, ceil( (r.bottom() + 1) * sy ) - 1 ) );
+}
+
+void QLabelImage::paintEvent( QPaintEvent *event )
+{
+    if ( mOriginalPixmap.isNull() ) {
+        QLabel::paintEvent( event );
+        return;
+    }
+
+    const QRect exposed = event->rect().intersected( rect() );
+    if ( exposed.isEmpty() )
+        return;
+
+    const double sx = width() * 1.0 / mOriginalPixmap.width();
+    const double sy = height() * 1.0 / mOriginalPixmap.height();
+
+    // whole image pixels that cover the exposed area, so that partial repaints match full ones.
+    //  Only these are scaled, so the memory needed depends on the exposed area and not on the zoom
+    int x0 = floor( exposed.left() / sx );
+    int y0 = floor( exposed.top() / sy );
+    int x1 = ceil( (exposed.right() + 1) / sx );
+    int y1 = ceil( (exposed.bottom() + 1) / sy );
+
+    if ( x1 > mOriginalPixmap.width() )     x1 = mOriginalPixmap.width();
+    if ( y1 > mOriginalPixmap.height() )    y1 = mOriginalPixmap.height();
+
+    const QRectF source( x0, y0, x1 - x0, y1 - y0 );
+    const QRectF target( x0 * sx, y0 * sy, (x1 - x0) * sx, (y1 - y0) * sy );
+
+    QPainter painter( this );
+    painter.setClipRect( exposed );
+    painter.drawPixmap( target, mOriginalPixmap, source );   // nearest neighbour, no SmoothPixmapTransform
+}
@@ -10,7 +10,9 @@
 #include <QPointF>
 #include <QSizeF>
 #include <QPixmap>
+#include <QImage>
 #include <QTime>
+#include <QPaintEvent>
 
 class QLabelImage : public QLabel
 {
@@ -21,7 +23,8 @@ private:
     double  mZoomMax, mZoomMin; // max and min zoom factor
 
     QPixmap mOriginalPixmap;  // we control scaling ourselves to be able to choose the interpolation method.
-                              // so this is the original pixmap, no scaling
+                              // so this is the original pixmap, no scaling. Only the exposed part of it
+                              // is scaled when painting, the scaled image is never allocated
 
 private:
      inline void adjustScrollBar(QScrollBar *scrollBar, double factor)
@@ -34,36 +37,12 @@ public slots:
      // overriden
      void setPixmap( const QPixmap& p ) {
          mOriginalPixmap = p;   // will hold an internal copy
-         rescalePixmap();
+         QLabel::update();
      }
 
 private:
-     void rescalePixmap()   // re-scale pixmap according to current size
-     {
-         //QTime t; t.restart();
-         QPixmap p = mOriginalPixmap.scaled( size(), Qt::IgnoreAspectRatio, Qt::FastTransformation );
-
-         //qDebug("%d", t.elapsed());
-
-         if ( !mOriginalPixmap.isNull() )
-         {
-            QSize oldSize(0,0);
-
-            if (QLabel::pixmap() != 0)
-                oldSize = QLabel::pixmap()->size();
-
-
-            //qDebug("val: %ld", (unsigned long int) QLabel::pixmap());
-            if (oldSize != p.size())
-                QLabel::setPixmap( p );
-            else {
-                *(QPixmap *)(QLabel::pixmap()) = p;
-                QLabel::update();
-            }
-         }
-
-         //qDebug("%d", t.elapsed());
-     }
+     // widget area covered by the image area r, which is scaled to the size of the widget
+     QRect imageToWidget( const QRect &r ) const;
 
 public:
     explicit QLabelImage(QWidget *parent = 0);
@@ -79,17 +58,15 @@ public:
     void resize( const QSize &newSize )
     {
         QLabel::resize( newSize );
-        rescalePixmap();
+        QLabel::update();
     }
 
     void setZoomLimits( double min, double max) { mZoomMax = max; mZoomMin = min; }
     void setScrollArea( QScrollArea *sa ) { mScrollArea = sa; }
 
-    inline void setImage( const QImage &img )
-    {
-        const QPixmap &p = QPixmap::fromImage(img);
-        this->setPixmap( p );
-    }
+    // if only updateRect of img changed (and it has the size of the current image),
+    //  only that area is converted and repainted
+    void setImage( const QImage &img, const QRect &updateRect = QRect() );
 
     // returns 'viewable rect' in image (pixmap) coordinates
     inline QRect getViewableRect() const
@@ -163,6 +140,8 @@ public:
     }
 
 protected:
+    void paintEvent( QPaintEvent *event );
+
     void wheelEvent ( QWheelEvent * event ) {
         emit wheelEventSignal(event);
     }
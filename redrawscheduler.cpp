@@ -0,0 +1,42 @@
+#include "redrawscheduler.h"
+
+#include <algorithm>
+
+RedrawScheduler::RedrawScheduler( int intervalMs, QObject *parent ) :
+    QObject(parent)
+{
+    mIntervalMs = intervalMs;
+    mDrawn = false;
+
+    mTimer.setSingleShot(true);
+    connect( &mTimer, SIGNAL(timeout()), this, SLOT(timeout()) );
+}
+
+void RedrawScheduler::request()
+{
+    if ( mTimer.isActive() )
+        return;     // coalesced with the pending one
+
+    int delay = 0;
+    if (mDrawn)
+        delay = std::max( 0, mIntervalMs - (int) mSinceLast.elapsed() );
+
+    mTimer.start( delay );
+}
+
+void RedrawScheduler::flush()
+{
+    if ( !mTimer.isActive() )
+        return;
+
+    mTimer.stop();
+    timeout();
+}
+
+void RedrawScheduler::timeout()
+{
+    mSinceLast.start();
+    mDrawn = true;
+
+    emit redraw();
+}
@@ -0,0 +1,43 @@
+#ifndef REDRAWSCHEDULER_H
+#define REDRAWSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+/**
+ ** Coalesces redraw requests into at most one redraw per frame interval.
+ *  Requests only mark that a redraw is needed, redraw() is emitted from the event loop,
+ *  right away if the last one was longer than an interval ago, otherwise when the
+ *  interval is over. Any number of requests in between (mouse/tablet events, plugins,
+ *  timers) result in a single redraw, which has to render the latest state.
+ */
+class RedrawScheduler : public QObject
+{
+    Q_OBJECT
+private:
+    QTimer          mTimer;
+    QElapsedTimer   mSinceLast;     // time since the last redraw
+    bool            mDrawn;         // mSinceLast was started
+    int             mIntervalMs;
+
+public:
+    explicit RedrawScheduler( int intervalMs = 16, QObject *parent = 0 );
+
+    void setInterval( int intervalMs ) { mIntervalMs = intervalMs; }
+    int interval() const { return mIntervalMs; }
+
+    bool pending() const { return mTimer.isActive(); }
+
+public slots:
+    void request();     // a redraw is needed
+    void flush();       // redraws now if one is pending
+
+signals:
+    void redraw();
+
+private slots:
+    void timeout();
+};
+
+#endif // REDRAWSCHEDULER_H
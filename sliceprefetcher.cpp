@@ -0,0 +1,155 @@
+#include "sliceprefetcher.h"
+
+#include <QMutexLocker>
+
+SlicePrefetcher::SlicePrefetcher( const Matrix3D<PixelType> &volume, QObject *parent ) :
+    QThread(parent), mVolume(volume)
+{
+    mCapacity = 8;
+    mGeneration = 0;
+    mBusy = false;
+    mStop = false;
+}
+
+SlicePrefetcher::~SlicePrefetcher()
+{
+    stop();
+}
+
+void SlicePrefetcher::setCapacity( unsigned int numSlices )
+{
+    QMutexLocker lock( &mMutex );
+
+    mCapacity = numSlices;
+    while ( mDone.size() > mCapacity )
+        mDone.pop_back();
+}
+
+std::list<SlicePrefetcher::Entry>::iterator SlicePrefetcher::find( int z, bool hidden )
+{
+    std::list<Entry>::iterator it;
+    for (it = mDone.begin(); it != mDone.end(); ++it)
+        if ( (it->z == z) && (it->hidden == hidden) )
+            break;
+
+    return it;
+}
+
+void SlicePrefetcher::request( const std::vector<Job> &jobs )
+{
+    {
+        QMutexLocker lock( &mMutex );
+
+        if (mStop)
+            return;
+
+        mPending.clear();
+        for (unsigned int i=0; i < jobs.size(); i++)
+            if ( find( jobs[i].z, jobs[i].hidden ) == mDone.end() )
+                mPending.push_back( jobs[i] );
+
+        if ( mPending.empty() )
+            return;
+
+        mWakeup.wakeOne();
+    }
+
+    if ( !isRunning() )
+        start( QThread::LowPriority );
+}
+
+void SlicePrefetcher::invalidate( bool waitIdle )
+{
+    QMutexLocker lock( &mMutex );
+
+    mGeneration++;
+    mPending.clear();
+    mDone.clear();
+
+    if (waitIdle)
+        while (mBusy)
+            mIdle.wait( &mMutex );
+}
+
+bool SlicePrefetcher::lookup( int z, bool hidden, QImage &base, QImage &composited )
+{
+    QMutexLocker lock( &mMutex );
+
+    std::list<Entry>::iterator it = find( z, hidden );
+    if ( it == mDone.end() )
+        return false;
+
+    base = it->base;
+    composited = it->composited;
+
+    // most recently used
+    mDone.splice( mDone.begin(), mDone, it );
+
+    return true;
+}
+
+void SlicePrefetcher::stop()
+{
+    {
+        QMutexLocker lock( &mMutex );
+        mStop = true;
+        mPending.clear();
+        mWakeup.wakeAll();
+    }
+
+    wait();
+}
+
+void SlicePrefetcher::run()
+{
+    QMutexLocker lock( &mMutex );
+
+    while (!mStop)
+    {
+        if ( mPending.empty() ) {
+            mWakeup.wait( &mMutex );
+            continue;
+        }
+
+        const Job job = mPending.front();
+        mPending.pop_front();
+
+        if ( (job.z < 0) || (job.z >= (int)mVolume.depth()) )
+            continue;
+
+        const unsigned int generation = mGeneration;
+        mBusy = true;
+        lock.unlock();
+
+        Entry entry;
+        entry.z = job.z;
+        entry.hidden = job.hidden;
+
+        mVolume.QImageSlice( job.z, entry.base );
+        if ( job.hidden )
+            entry.base.fill( Qt::black );
+
+        entry.composited = entry.base.copy();
+        if ( job.layers.numLayers() > 0 )
+        {
+            unsigned int *pixPtr = (unsigned int *) entry.composited.bits();
+            job.layers.composite( pixPtr, pixPtr, entry.composited.width() * entry.composited.height() );
+        }
+
+        lock.relock();
+        mBusy = false;
+        mIdle.wakeAll();
+
+        // the data or settings may have changed while rendering
+        if ( generation != mGeneration )
+            continue;
+
+        std::list<Entry>::iterator it = find( entry.z, entry.hidden );
+        if ( it != mDone.end() )
+            mDone.erase( it );
+
+        mDone.push_front( entry );
+        while ( mDone.size() > mCapacity )
+            mDone.pop_back();
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef SLICEPREFETCHER_H
+#define SLICEPREFETCHER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+
+#include <deque>
+#include <list>
+#include <vector>
+
+#include "Matrix3D.h"
+#include "CommonTypes.h"
+#include "OverlayCompositor.h"
+
+/**
+ ** Renders slices ahead of time in a background thread, so that they are ready
+ *  in the render cache when scrolling through Z.
+ *  Every slice is rendered as SliceRenderCache does: the gray base slice and the
+ *  base with the overlay layers of the job blended on top.
+ *  Rendered slices are tagged with a generation, invalidate() increments it so that
+ *  slices rendered from outdated data or settings are never returned.
+ */
+class SlicePrefetcher : public QThread
+{
+public:
+    struct Job
+    {
+        int  z;
+        bool hidden;
+        OverlayCompositor layers;   // layers of slice z
+    };
+
+private:
+    struct Entry
+    {
+        int    z;
+        bool   hidden;
+        QImage base;
+        QImage composited;
+    };
+
+    const Matrix3D<PixelType> &mVolume;
+
+    QMutex          mMutex;
+    QWaitCondition  mWakeup;    // new jobs or stop
+    QWaitCondition  mIdle;      // no job is being rendered
+
+    std::deque<Job>   mPending;
+    std::list<Entry>  mDone;        // most recently used first
+    unsigned int      mCapacity;    // max. number of slices in mDone
+    unsigned int      mGeneration;
+    bool              mBusy;
+    bool              mStop;
+
+    std::list<Entry>::iterator find( int z, bool hidden );
+
+protected:
+    void run();
+
+public:
+    SlicePrefetcher( const Matrix3D<PixelType> &volume, QObject *parent = 0 );
+    ~SlicePrefetcher();
+
+    void setCapacity( unsigned int numSlices );
+
+    // replaces the pending jobs, which are rendered in order. Slices that were
+    //  already rendered are skipped
+    void request( const std::vector<Job> &jobs );
+
+    // drops the rendered slices and the pending jobs. If waitIdle is true, it also waits
+    //  for the slice being rendered, which is needed before reallocating any volume it reads
+    void invalidate( bool waitIdle = false );
+
+    // returns a slice rendered since the last invalidate()
+    bool lookup( int z, bool hidden, QImage &base, QImage &composited );
+
+    // stops the thread, pending jobs are dropped
+    void stop();
+};
+
+#endif // SLICEPREFETCHER_H
@@ -0,0 +1,150 @@
+#include "slicerendercache.h"
+
+#include <cstring>
+
+SliceRenderCache::SliceRenderCache()
+{
+    mBaseSlice = -1;
+    mBaseHidden = false;
+    mBaseValid = false;
+}
+
+void SliceRenderCache::invalidateBase()
+{
+    mBaseValid = false;
+    invalidateOverlays();
+}
+
+void SliceRenderCache::invalidateOverlays()
+{
+    mCompositedArea = QRegion();
+}
+
+void SliceRenderCache::invalidateOverlays( const QRect &rect )
+{
+    mCompositedArea -= rect;
+}
+
+// copies rect from src to dest, both RGB32 of the same size
+static void copyRect( const QImage &src, QImage &dest, const QRect &rect )
+{
+    const QRect r = rect.intersected( dest.rect() );
+    if ( r.isEmpty() )
+        return;
+
+    const unsigned int rowBytes = r.width() * sizeof(unsigned int);
+    for (int y = r.top(); y <= r.bottom(); y++)
+        memcpy( ((unsigned int *) dest.scanLine(y)) + r.left(),
+                ((const unsigned int *) src.constScanLine(y)) + r.left(), rowBytes );
+}
+
+QRect SliceRenderCache::neededArea() const
+{
+    if ( mNeeded.isEmpty() )
+        return mBase.rect();
+
+    return mNeeded.intersected( mBase.rect() );
+}
+
+bool SliceRenderCache::needsBase( int slice, bool hidden ) const
+{
+    return !mBaseValid || (mBaseSlice != slice) || (mBaseHidden != hidden);
+}
+
+void SliceRenderCache::beginBase( int slice, bool hidden, const QSize &size )
+{
+    mBaseSlice = slice;
+    mBaseHidden = hidden;
+    mBaseValid = true;
+
+    // the previous images may be shared with the prefetcher, so they are not reused
+    mBase = QImage( size, QImage::Format_RGB32 );
+    mBaseArea = QRegion();
+
+    if ( mComposited.size() != size )
+        mComposited = QImage( size, QImage::Format_RGB32 );
+
+    invalidateOverlays();
+    mFrameArea = QRegion();
+}
+
+bool SliceRenderCache::needsBaseRects() const
+{
+    return !( QRegion( neededArea() ) - mBaseArea ).isEmpty();
+}
+
+QImage & SliceRenderCache::beginBaseRects( QVector<QRect> &rects )
+{
+    const QRegion missing = QRegion( neededArea() ) - mBaseArea;
+
+    rects = missing.rects();
+    mBaseArea += missing;
+
+    return mBase;
+}
+
+void SliceRenderCache::adopt( int slice, bool hidden, const QImage &base, const QImage &composited )
+{
+    mBase = base;
+    mBaseSlice = slice;
+    mBaseHidden = hidden;
+    mBaseValid = true;
+    mBaseArea = QRegion( mBase.rect() );
+
+    // overlays are later drawn in place, keep the given image untouched
+    mComposited = composited;
+    mComposited.detach();
+
+    mCompositedArea = QRegion( mComposited.rect() );
+    mFrameArea = QRegion();
+}
+
+bool SliceRenderCache::needsCompositedRects() const
+{
+    return !( ( QRegion( neededArea() ) & mBaseArea ) - mCompositedArea ).isEmpty();
+}
+
+QImage & SliceRenderCache::beginCompositedRects( QVector<QRect> &rects )
+{
+    const QRegion missing = ( QRegion( neededArea() ) & mBaseArea ) - mCompositedArea;
+
+    rects = missing.rects();
+    for (int i=0; i < rects.size(); i++)
+        copyRect( mBase, mComposited, rects[i] );
+
+    mCompositedArea += missing;
+    mFrameArea -= missing;
+
+    return mComposited;
+}
+
+QImage & SliceRenderCache::beginTransient()
+{
+    if ( mFrame.size() != mComposited.size() )
+    {
+        mFrame = QImage( mComposited.size(), QImage::Format_RGB32 );
+        mFrameArea = QRegion();
+        mTransientRect = QRect();
+    }
+
+    // copy the needed area where the overlays were redrawn, and restore the previous transient layer
+    const QRegion needed = QRegion( neededArea() ) & mCompositedArea;
+    const QRegion restore = ( needed - mFrameArea ) + ( QRegion( mTransientRect ) & mCompositedArea );
+
+    const QVector<QRect> rects = restore.rects();
+    for (int i=0; i < rects.size(); i++)
+        copyRect( mComposited, mFrame, rects[i] );
+
+    mFrameArea += needed;
+    mDirtyRect = restore.boundingRect();
+
+    mTransientRect = QRect();
+
+    return mFrame;
+}
+
+void SliceRenderCache::endTransient( const QRect &drawnRect )
+{
+    mTransientRect = drawnRect.intersected( mFrame.rect() );
+    mDirtyRect = mDirtyRect.united( mTransientRect );
+}
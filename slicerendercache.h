@@ -0,0 +1,84 @@
+#ifndef SLICERENDERCACHE_H
+#define SLICERENDERCACHE_H
+
+#include <QImage>
+#include <QRect>
+#include <QRegion>
+#include <QVector>
+
+/**
+ ** Layered cache of the displayed slice:
+ *   - base:        gray slice, depends only on which slice is shown (and on the volume being hidden)
+ *   - composited:  base + score image + overlays, invalidated when any of them is edited
+ *   - frame:       composited + transient layer (selection highlight; the brush cursor is a scene item)
+ *
+ *  Layers are only rendered inside the needed area (the visible part of the slice plus a margin),
+ *  every layer keeps the area it is up to date in, so panning only renders what scrolled in.
+ *
+ *  The transient layer is redrawn on every render, but only the area it covered
+ *  in the previous frame is restored from the composited layer.
+ */
+class SliceRenderCache
+{
+private:
+    QRect   mNeeded;            // area the layers have to be rendered in
+
+    QImage  mBase;
+    int     mBaseSlice;
+    bool    mBaseHidden;
+    bool    mBaseValid;         // mBase belongs to mBaseSlice
+    QRegion mBaseArea;          // area of mBase that was rendered
+
+    QImage  mComposited;
+    QRegion mCompositedArea;    // area of mComposited that is up to date
+
+    QImage  mFrame;
+    QRegion mFrameArea;         // area where mFrame == mComposited, outside of mTransientRect
+    QRect   mTransientRect;     // area covered by the transient layer in mFrame
+    QRect   mDirtyRect;         // area of mFrame changed by the last render
+
+public:
+    SliceRenderCache();
+
+    // area of the slice that has to be rendered, an empty rect means the whole slice
+    void setNeededRect( const QRect &rect ) { mNeeded = rect; }
+    const QRect &neededRect() const { return mNeeded; }
+
+    // forces a rebuild of the given layer (and the ones on top of it) on the next render
+    void invalidateBase();
+    void invalidateOverlays();
+    void invalidateOverlays( const QRect &rect );   // only rect changed
+
+    // base layer. If needsBase() is true, beginBase() starts an empty base of the given size.
+    //  slice identifies the slice for the caller (e.g. orientation and position)
+    bool needsBase( int slice, bool hidden ) const;
+    void beginBase( int slice, bool hidden, const QSize &size );
+
+    // if part of the needed area is missing in the base layer, beginBaseRects() returns it
+    //  in 'rects' and the gray slice has to be drawn there
+    bool needsBaseRects() const;
+    QImage &beginBaseRects( QVector<QRect> &rects );
+
+    // takes base and composited layers rendered elsewhere (e.g. by SlicePrefetcher) for a whole slice
+    void adopt( int slice, bool hidden, const QImage &base, const QImage &composited );
+
+    // if part of the needed area is outdated in the composited layer, beginCompositedRects() restores
+    //  it from the base layer and returns it in 'rects', overlays have to be drawn only there
+    bool needsCompositedRects() const;
+    QImage &beginCompositedRects( QVector<QRect> &rects );
+
+    // returns the frame with the previous transient layer removed, draw the new one on it
+    //  and report the area that was drawn with endTransient()
+    QImage &beginTransient();
+    void endTransient( const QRect &drawnRect );
+
+    const QImage &frame() const { return mFrame; }
+
+    // area of the frame that changed in the last render
+    const QRect &dirtyRect() const { return mDirtyRect; }
+
+private:
+    QRect neededArea() const;   // mNeeded inside the base
+};
+
+#endif // SLICERENDERCACHE_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui opengl
 
 CONFIG += console
 
@@ -23,6 +23,10 @@ SOURCES +=\
     extras/waitform.cpp \
     brush.cpp \
     overlay.cpp \
+    slicerendercache.cpp \
+    glsliceview.cpp \
+    sliceprefetcher.cpp \
+    redrawscheduler.cpp \
     main.cpp
 
 HEADERS  += annotatorwnd.h \
@@ -44,7 +48,22 @@ HEADERS  += annotatorwnd.h \
     mygraphicsview.h \
     extras/waitform.h \
     brush.h \
-    overlay.h
+    BrushKernels.h \
+    BrushStroke.h \
+    UndoJournal.h \
+    BitVolume.h \
+    FloodFill.h \
+    overlay.h \
+    SliceSpans.h \
+    BrickedSupervoxels.h \
+    OverlayCompositor.h \
+    slicerendercache.h \
+    SliceViewer.h \
+    glsliceview.h \
+    sliceprefetcher.h \
+    redrawscheduler.h \
+    OrthoSlices.h \
+    RenderStats.h
 
 FORMS    += annotatorwnd.ui \
     textinfodialog.ui \
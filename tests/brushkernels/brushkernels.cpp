@@ -0,0 +1,266 @@
+/**
+ ** Correctness checks of the label painting brushes (BrushKernels.h through brush.h
+ *  and BrushStroke.h) against voxel by voxel references.
+ *  Prints one line per check and exits with 1 if any of them fails.
+ *
+ *  Usage: brushkernels
+ */
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "CommonTypes.h"
+#include "Matrix3D.h"
+#include "brush.h"
+#include "BrushStroke.h"
+
+// deterministic, so that a failure can be reproduced
+class Lcg
+{
+private:
+    unsigned int mState;
+
+public:
+    Lcg( unsigned int seed ) : mState(seed) { }
+
+    inline unsigned int next()
+    {
+        mState = mState * 1664525u + 1013904223u;
+        return mState >> 8;
+    }
+
+    inline unsigned int next( unsigned int max ) { return next() % max; }
+};
+
+// the brushes as they painted labels before the span rasteriser, voxel by voxel
+static void voxelCubePaint( Matrix3D<LabelType> &data, int x, int y, int z, int width, int height, int depth, LabelType label )
+{
+    for (int i = x-width; i < x+width; i++)
+        for (int j = y-height; j < y+height; j++)
+            for (int k = z-depth; k < z+depth; k++)
+            {
+                if (i < 0 || j < 0 || k < 0)
+                    continue;
+                if (i >= (int)data.width() || j >= (int)data.height() || k >= (int)data.depth())
+                    continue;
+
+                data.set(i, j, k, label);
+            }
+}
+
+static void voxelSpherePaint( Matrix3D<LabelType> &data, int x, int y, int z, int width, int height, int depth, LabelType label )
+{
+    for (int i = x-width; i < x+width; i++)
+        for (int j = y-height; j < y+height; j++)
+            for (int k = z-depth; k < z+depth; k++)
+            {
+                if (i < 0 || j < 0 || k < 0)
+                    continue;
+                if (i >= (int)data.width() || j >= (int)data.height() || k >= (int)data.depth())
+                    continue;
+
+                if ( (i-x)*(i-x)/( (double)(width*width) )
+                   + (j-y)*(j-y)/( (double)(height*height) )
+                   + (k-z)*(k-z)/( (double)(depth*depth) ) <= 1)
+                    data.set(i, j, k, label);
+            }
+}
+
+// a brush position and size, partly outside the volume every now and then
+struct Stamp
+{
+    int x, y, z;
+    int w, h, d;
+};
+
+static std::vector<Stamp> randomStamps( const Matrix3D<PixelType> &vol, unsigned int num, unsigned int seed )
+{
+    Lcg rnd( seed );
+    std::vector<Stamp> stamps( num );
+
+    for (unsigned int i=0; i < num; i++)
+    {
+        Stamp &s = stamps[i];
+        s.w = 1 + rnd.next( 24 );
+        s.h = 1 + rnd.next( 24 );
+        s.d = 1 + rnd.next( 8 );
+        s.x = (int)rnd.next( vol.width() + 2 * s.w ) - s.w;
+        s.y = (int)rnd.next( vol.height() + 2 * s.h ) - s.h;
+        s.z = (int)rnd.next( vol.depth() + 2 * s.d ) - s.d;
+    }
+
+    return stamps;
+}
+
+static bool report( const char *name, bool ok )
+{
+    printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+    return ok;
+}
+
+// the span brushes paint the same voxels as the references
+static bool checkBrushes( const Matrix3D<PixelType> &vol )
+{
+    const std::vector<Stamp> stamps = randomStamps( vol, 200, 1 );
+
+    Matrix3D<LabelType> spanLabels, voxelLabels;
+    spanLabels.reallocSizeLike( vol );
+    voxelLabels.reallocSizeLike( vol );
+
+    bool ok = true;
+    for (unsigned int b=0; b < 2; b++)
+    {
+        const bool isSphere = (b == 1);
+
+        spanLabels.fill( 0 );
+        voxelLabels.fill( 0 );
+
+        for (unsigned int i=0; i < stamps.size(); i++)
+        {
+            const Stamp &s = stamps[i];
+            const LabelType label = 1 + i % 3;
+
+            if (isSphere) {
+                SphereBrush( s.w, s.h, s.d ).paint( spanLabels, s.x, s.y, s.z, label );
+                voxelSpherePaint( voxelLabels, s.x, s.y, s.z, s.w, s.h, s.d, label );
+            } else {
+                CubeBrush( s.w, s.h, s.d ).paint( spanLabels, s.x, s.y, s.z, label );
+                voxelCubePaint( voxelLabels, s.x, s.y, s.z, s.w, s.h, s.d, label );
+            }
+        }
+
+        ok = report( isSphere ? "sphere brush" : "cube brush", spanLabels == voxelLabels ) && ok;
+    }
+
+    return ok;
+}
+
+// a pixel value range and "don't overwrite labeled", evaluated by the brush kernel, match the
+//  reference masked afterwards. Erasing honours the range only
+static bool checkConstrained( const Matrix3D<PixelType> &vol )
+{
+    const std::vector<Stamp> stamps = randomStamps( vol, 50, 2 );
+
+    BrushConstraints constraints;
+    constraints.volume = vol.data();
+    constraints.pixMin = 64;
+    constraints.pixMax = 192;
+    constraints.dontOverwriteLabeled = true;
+
+    SphereBrush sphere;
+    sphere.constraints = &constraints;
+
+    Matrix3D<LabelType> labels, mask;
+    labels.reallocSizeLike( vol );
+    mask.reallocSizeLike( vol );
+
+    // some voxels are labelled already
+    for (unsigned int i=0; i < labels.numElem(); i++)
+        labels.data()[i] = (i % 7 == 0) ? 4 : 0;
+    mask.fill( 0 );
+
+    for (unsigned int i=0; i < stamps.size(); i++)
+    {
+        const Stamp &s = stamps[i];
+        sphere.setSize( s.w, s.h, s.d );
+        sphere.paint( labels, s.x, s.y, s.z, 1 );
+        voxelSpherePaint( mask, s.x, s.y, s.z, s.w, s.h, s.d, 1 );
+    }
+
+    bool paintOk = true;
+    for (unsigned int i=0; i < labels.numElem(); i++)
+    {
+        const PixelType v = vol.data()[i];
+        const bool painted = mask.data()[i] && (i % 7 != 0) && (v >= 64) && (v <= 192);
+        const LabelType expected = painted ? 1 : ( (i % 7 == 0) ? 4 : 0 );
+        if ( labels.data()[i] != expected )
+            paintOk = false;
+    }
+
+    std::vector<LabelType> before( labels.data(), labels.data() + labels.numElem() );
+
+    sphere.writeMode = BrushWriteErase;
+    for (unsigned int i=0; i < stamps.size(); i++)
+    {
+        const Stamp &s = stamps[i];
+        sphere.setSize( s.w, s.h, s.d );
+        sphere.paint( labels, s.x, s.y, s.z, 0 );
+    }
+
+    bool eraseOk = true;
+    for (unsigned int i=0; i < labels.numElem(); i++)
+    {
+        const PixelType v = vol.data()[i];
+        const bool erased = mask.data()[i] && (v >= 64) && (v <= 192);
+        if ( labels.data()[i] != (erased ? 0 : before[i]) )
+            eraseOk = false;
+    }
+
+    const bool ok = report( "constrained sphere brush", paintOk );
+    return report( "constrained erase", eraseOk ) && ok;
+}
+
+// a fast zigzag drag, with the mouse moving 1.5 brush radii between events and painted in
+//  batches of 4 events, covers every position stamped on its own
+static bool checkStroke( const Matrix3D<PixelType> &vol )
+{
+    const int r = 8, rz = 4;
+    const int step = 3 * r / 2 + 1;
+    const int eventsPerBatch = 4;
+    const int w = vol.width(), h = vol.height(), z = vol.depth() / 2;
+
+    std::vector<int> px, py;
+    for (int y = r, row = 0; y + r <= h; y += 2 * r, row++)
+        for (int i = 0; i * step < w; i++) {
+            px.push_back( (row % 2 == 0) ? i * step : w - 1 - i * step );
+            py.push_back( y );
+        }
+
+    Matrix3D<LabelType> stampLabels, strokeLabels;
+    stampLabels.reallocSizeLike( vol );
+    strokeLabels.reallocSizeLike( vol );
+    stampLabels.fill( 0 );
+    strokeLabels.fill( 0 );
+
+    SphereBrush sphere( r, r, rz );
+
+    for (unsigned int i=0; i < px.size(); i++)
+        sphere.paint( stampLabels, px[i], py[i], z, 1 );
+
+    BrushStroke stroke;
+    stroke.begin( &strokeLabels, &sphere, 1 );
+    for (unsigned int i=0; i < px.size(); i++) {
+        stroke.moveTo( px[i], py[i], z );
+        if ( (i + 1) % eventsPerBatch == 0 )
+            stroke.paintPending();
+    }
+    stroke.paintPending();
+    stroke.end();
+
+    bool covers = true;
+    for (unsigned int i=0; i < stampLabels.numElem(); i++)
+        if ( stampLabels.data()[i] && !strokeLabels.data()[i] )
+            covers = false;
+
+    return report( "stroke covers stamps", covers );
+}
+
+int main()
+{
+    // gradient plus noise, the constraints cut through it
+    Matrix3D<PixelType> vol;
+    vol.realloc( 160, 130, 40 );
+
+    Lcg rnd( 7 );
+    PixelType *p = vol.data();
+    for (unsigned int z=0; z < vol.depth(); z++)
+        for (unsigned int y=0; y < vol.height(); y++)
+            for (unsigned int x=0; x < vol.width(); x++)
+                *p++ = (PixelType)( ( (x + y + z) & 0x7F ) + rnd.next( 128 ) );
+
+    bool ok = checkBrushes( vol );
+    ok = checkConstrained( vol ) && ok;
+    ok = checkStroke( vol ) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,259 @@
+/**
+ ** Checks of the flood fill (FloodFill.h) and of BitVolume.h against naive references:
+ *  the region found with 6- and 26-connectivity, the voxel cap, fillRegion() and
+ *  BitVolume::nextSet()/nextClear() around word boundaries.
+ *  Prints one line per check and exits with 1 if any of them fails.
+ *
+ *  Usage: floodfill
+ */
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "CommonTypes.h"
+#include "Matrix3D.h"
+#include "BitVolume.h"
+#include "FloodFill.h"
+
+// deterministic, so that a failure can be reproduced
+class Lcg
+{
+private:
+    unsigned int mState;
+
+public:
+    Lcg( unsigned int seed ) : mState(seed) { }
+
+    inline unsigned int next()
+    {
+        mState = mState * 1664525u + 1013904223u;
+        return mState >> 8;
+    }
+
+    inline unsigned int next( unsigned int max ) { return next() % max; }
+};
+
+static bool report( const char *name, bool ok )
+{
+    printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+    return ok;
+}
+
+// breadth first search over the voxels in the window, one voxel at a time
+static std::vector<bool> naiveFill( const Matrix3D<PixelType> &img, int x, int y, int z, PixelType minVal, PixelType maxVal, bool connect26 )
+{
+    const int w = img.width(), h = img.height(), d = img.depth();
+    std::vector<bool> inRegion( img.numElem(), false );
+
+    const PixelType seedVal = img(x, y, z);
+    if ( (seedVal < minVal) || (seedVal > maxVal) )
+        return inRegion;
+
+    std::deque<unsigned int> queue;
+    queue.push_back( img.coordToIdx( x, y, z ) );
+    inRegion[ queue.back() ] = true;
+
+    while ( !queue.empty() )
+    {
+        const unsigned int idx = queue.front();
+        queue.pop_front();
+
+        const int cx = idx % w, cy = (idx / w) % h, cz = idx / (w * h);
+
+        for (int dz = -1; dz <= 1; dz++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    const int dist = (dx != 0) + (dy != 0) + (dz != 0);
+                    if ( (dist == 0) || (!connect26 && (dist > 1)) )
+                        continue;
+
+                    const int nx = cx + dx, ny = cy + dy, nz = cz + dz;
+                    if ( (nx < 0) || (ny < 0) || (nz < 0) || (nx >= w) || (ny >= h) || (nz >= d) )
+                        continue;
+
+                    const unsigned int nIdx = img.coordToIdx( nx, ny, nz );
+                    const PixelType v = img.data()[nIdx];
+                    if ( inRegion[nIdx] || (v < minVal) || (v > maxVal) )
+                        continue;
+
+                    inRegion[nIdx] = true;
+                    queue.push_back( nIdx );
+                }
+    }
+
+    return inRegion;
+}
+
+// a noisy volume, whose width is not a multiple of the word size, so that rows start anywhere in a word
+static void synthVolume( Matrix3D<PixelType> &img, unsigned int seed )
+{
+    img.realloc( 77, 45, 23 );
+
+    Lcg rnd( seed );
+    for (unsigned int i=0; i < img.numElem(); i++)
+        img.data()[i] = rnd.next( 256 );
+}
+
+// same voxels, count and bounding box as the naive search, from seeds inside and outside the window
+static bool checkConnectivity( bool connect26 )
+{
+    Matrix3D<PixelType> img;
+    synthVolume( img, connect26 ? 2 : 1 );
+
+    Lcg rnd( 3 );
+    BitVolume region;
+    bool ok = true;
+
+    for (unsigned int s=0; s < 40; s++)
+    {
+        const int x = rnd.next( img.width() ), y = rnd.next( img.height() ), z = rnd.next( img.depth() );
+
+        // about half of the voxels are in the window, around the percolation threshold of both connectivities
+        const int center = img(x, y, z);
+        const PixelType minVal = std::max( center - 64 - (int)rnd.next( 16 ), 0 );
+        const PixelType maxVal = std::min( center + 64 + (int)rnd.next( 16 ), 255 );
+
+        const FloodFillResult res = floodFill( img, x, y, z, minVal, maxVal, connect26, 0xFFFFFFFFu, region );
+        const std::vector<bool> ref = naiveFill( img, x, y, z, minVal, maxVal, connect26 );
+
+        unsigned int refCount = 0;
+        int x0 = img.width(), y0 = img.height(), z0 = img.depth(), x1 = -1, y1 = -1, z1 = -1;
+        for (unsigned int i=0; i < img.numElem(); i++)
+        {
+            if ( region.test( i ) != ref[i] )
+                ok = false;
+            if ( !ref[i] )
+                continue;
+
+            const int cx = i % img.width(), cy = (i / img.width()) % img.height(), cz = i / (img.width() * img.height());
+            x0 = std::min( x0, cx );    x1 = std::max( x1, cx );
+            y0 = std::min( y0, cy );    y1 = std::max( y1, cy );
+            z0 = std::min( z0, cz );    z1 = std::max( z1, cz );
+            refCount++;
+        }
+
+        ok = ok && (res.count == refCount) && !res.truncated && !res.canceled;
+        if ( refCount > 0 )
+            ok = ok && (res.x0 == x0) && (res.y0 == y0) && (res.z0 == z0) && (res.x1 == x1) && (res.y1 == y1) && (res.z1 == z1);
+    }
+
+    return report( connect26 ? "26-connected fill" : "6-connected fill", ok );
+}
+
+// the fill stops at the cap with a part of the region, whose voxels are all counted
+static bool checkCap()
+{
+    Matrix3D<PixelType> img;
+    img.realloc( 77, 45, 23 );
+    img.fill( 100 );
+
+    const std::vector<bool> ref = naiveFill( img, 10, 10, 10, 100, 100, false );
+
+    BitVolume region;
+    const unsigned int maxVoxels = 5000;
+    const FloodFillResult res = floodFill( img, 10, 10, 10, (PixelType)100, (PixelType)100, false, maxVoxels, region );
+
+    unsigned int numSet = 0;
+    bool inside = true;
+    for (unsigned int i=0; i < img.numElem(); i++)
+        if ( region.test( i ) ) {
+            numSet++;
+            inside = inside && ref[i];
+        }
+
+    // a run is added whole, so the fill stops less than a row past the cap
+    const bool ok = res.truncated && (res.count >= maxVoxels) && (res.count < maxVoxels + img.width()) && (res.count == numSet) && inside;
+    return report( "voxel cap", ok );
+}
+
+// fillRegion() writes the voxels of the region and nothing else, with a write mode too
+struct WriteOdd
+{
+    template<typename T>
+    inline void row( T *p, unsigned int idx, unsigned int n, T value ) const
+    {
+        for (unsigned int i=0; i < n; i++)
+            if ( (idx + i) % 2 == 1 )
+                p[i] = value;
+    }
+};
+
+static bool checkFillRegion()
+{
+    Matrix3D<PixelType> img;
+    synthVolume( img, 4 );
+
+    // a window around the seed value
+    const int seedVal = img(40, 20, 11);
+    const PixelType minVal = std::max( seedVal - 70, 0 ), maxVal = std::min( seedVal + 70, 255 );
+
+    BitVolume region;
+    const FloodFillResult res = floodFill( img, 40, 20, 11, minVal, maxVal, true, 0xFFFFFFFFu, region );
+
+    Matrix3D<LabelType> labels, oddLabels;
+    labels.reallocSizeLike( img );
+    oddLabels.reallocSizeLike( img );
+    labels.fill( 0 );
+    oddLabels.fill( 0 );
+
+    fillRegion( labels, region, res, (LabelType)3 );
+    fillRegion( oddLabels, region, res, (LabelType)3, WriteOdd() );
+
+    bool ok = (res.count > 0);
+    for (unsigned int i=0; i < img.numElem(); i++)
+    {
+        ok = ok && ( labels.data()[i] == (region.test( i ) ? 3 : 0) );
+        ok = ok && ( oddLabels.data()[i] == ((region.test( i ) && (i % 2 == 1)) ? 3 : 0) );
+    }
+
+    return report( "fillRegion", ok );
+}
+
+// nextSet()/nextClear() against a bit by bit search, for every start and end around the words
+//  of bits set near word boundaries, and setRange() across them
+static bool checkBitSearch()
+{
+    BitVolume bits;
+    bits.realloc( 260, 1, 1 );
+
+    const unsigned int setBits[] = { 0, 62, 63, 64, 65, 127, 128, 191, 200, 255, 256, 259 };
+    for (unsigned int i=0; i < sizeof(setBits) / sizeof(setBits[0]); i++)
+        bits.set( setBits[i] );
+    bits.setRange( 130, 190 );
+    bits.setRange( 60, 61 );
+
+    std::vector<bool> ref( 260, false );
+    for (unsigned int i=0; i < sizeof(setBits) / sizeof(setBits[0]); i++)
+        ref[ setBits[i] ] = true;
+    for (unsigned int i=130; i <= 190; i++)   ref[i] = true;
+    for (unsigned int i=60; i <= 61; i++)     ref[i] = true;
+
+    bool ok = true;
+    for (unsigned int i=0; i < 260; i++)
+        ok = ok && (bits.test( i ) == ref[i]);
+
+    for (unsigned int start=0; start <= 260; start++)
+        for (unsigned int end=start; end <= 260; end++)
+        {
+            unsigned int refSet = start, refClear = start;
+            while ( (refSet < end) && !ref[refSet] )     refSet++;
+            while ( (refClear < end) && ref[refClear] )  refClear++;
+
+            ok = ok && (bits.nextSet( start, end ) == refSet) && (bits.nextClear( start, end ) == refClear);
+        }
+
+    return report( "BitVolume nextSet/nextClear", ok );
+}
+
+int main()
+{
+    bool ok = checkConnectivity( false );
+    ok = checkConnectivity( true ) && ok;
+    ok = checkCap() && ok;
+    ok = checkFillRegion() && ok;
+    ok = checkBitSearch() && ok;
+
+    return ok ? 0 : 1;
+}
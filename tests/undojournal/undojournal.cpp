@@ -0,0 +1,265 @@
+/**
+ ** Checks of UndoJournal.h: undo/redo round trips over nested steps and bricks at the
+ *  volume border, volumes written outside of the journal or reallocated, volumes that
+ *  were empty before a step, and the memory budget.
+ *  Prints one line per check and exits with 1 if any of them fails.
+ *
+ *  Usage: undojournal
+ */
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "CommonTypes.h"
+#include "Matrix3D.h"
+#include "UndoJournal.h"
+
+typedef UndoJournal::Volume Volume;
+typedef std::vector<LabelType> Snapshot;
+
+// deterministic, so that a failure can be reproduced. Not an LCG: the budget check needs
+//  values that do not compress, also XORed with the ones of an earlier step
+class XorShift
+{
+private:
+    unsigned int mState;
+
+public:
+    XorShift( unsigned int seed ) : mState(seed) { }
+
+    inline unsigned int next()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+    inline unsigned int next( unsigned int max ) { return next() % max; }
+};
+
+static bool report( const char *name, bool ok )
+{
+    printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+    return ok;
+}
+
+static Snapshot snapshot( const Volume &vol )
+{
+    return Snapshot( vol.data(), vol.data() + vol.numElem() );
+}
+
+static bool matches( const Volume &vol, const Snapshot &s )
+{
+    return (vol.numElem() == s.size()) && std::equal( s.begin(), s.end(), vol.data() );
+}
+
+// a random box of vol, touched and then written with random values, some of them unchanged
+static void randomEdit( UndoJournal &journal, Volume &vol, XorShift &rnd, int maxSide, unsigned int numValues )
+{
+    const int x0 = rnd.next( vol.width() ), y0 = rnd.next( vol.height() ), z0 = rnd.next( vol.depth() );
+    const int x1 = std::min( (int)vol.width() - 1,  x0 + (int)rnd.next( maxSide ) );
+    const int y1 = std::min( (int)vol.height() - 1, y0 + (int)rnd.next( maxSide ) );
+    const int z1 = std::min( (int)vol.depth() - 1,  z0 + (int)rnd.next( maxSide ) );
+
+    journal.touch( &vol, x0, y0, z0, x1, y1, z1 );
+
+    for (int z=z0; z <= z1; z++)
+        for (int y=y0; y <= y1; y++)
+            for (int x=x0; x <= x1; x++)
+                if ( rnd.next( 2 ) )
+                    vol(x, y, z) = rnd.next( numValues );
+}
+
+// steps on two volumes whose sizes are not multiples of the brick size, some of them nested,
+//  are undone and redone back to the contents they had after every step
+static bool checkRoundTrip()
+{
+    XorShift rnd( 1 );
+    Volume a, b;
+    a.realloc( 100, 70, 45 );
+    b.realloc( 33, 65, 31 );
+    for (unsigned int i=0; i < a.numElem(); i++)   a.data()[i] = rnd.next( 3 );
+    b.fill( 0 );
+
+    UndoJournal journal;
+    std::vector<Snapshot> snapsA( 1, snapshot( a ) ), snapsB( 1, snapshot( b ) );
+
+    const unsigned int numSteps = 12;
+    for (unsigned int s=0; s < numSteps; s++)
+    {
+        journal.beginStep( "step" );
+        randomEdit( journal, a, rnd, 40, 8 );
+
+        // a nested step is part of the outer one
+        if ( s % 3 == 0 ) {
+            journal.beginStep( "nested" );
+            randomEdit( journal, b, rnd, 20, 4 );
+            randomEdit( journal, a, rnd, 20, 4 );
+            journal.endStep();
+        }
+
+        journal.endStep();
+
+        snapsA.push_back( snapshot( a ) );
+        snapsB.push_back( snapshot( b ) );
+    }
+
+    std::vector<UndoJournal::Change> changes;
+    bool ok = true;
+
+    for (unsigned int s=numSteps; s > 0; s--)
+        ok = ok && journal.undo( changes ) && matches( a, snapsA[s-1] ) && matches( b, snapsB[s-1] );
+    ok = ok && !journal.canUndo();
+
+    for (unsigned int s=1; s <= numSteps; s++)
+        ok = ok && journal.redo( changes ) && matches( a, snapsA[s] ) && matches( b, snapsB[s] );
+    ok = ok && !journal.canRedo();
+
+    // a step that changes nothing is not recorded
+    journal.beginStep( "nothing" );
+    journal.touch( &a );
+    ok = ok && journal.endStep() && journal.canUndo() && (journal.undoName() == "step");
+
+    return report( "undo/redo round trip", ok );
+}
+
+// a brick written outside of the journal is detected: undo fails, leaves the volume as it is
+//  and clears the journal
+static bool checkOutsideEdit()
+{
+    Volume vol;
+    vol.realloc( 64, 64, 16 );
+    vol.fill( 1 );
+
+    UndoJournal journal;
+    journal.beginStep( "edit" );
+    journal.touch( &vol, 10, 10, 2, 20, 20, 5 );
+    vol(15, 15, 3) = 7;
+    journal.endStep();
+
+    vol(12, 12, 2) = 9;     // same brick, not journaled
+    const Snapshot before = snapshot( vol );
+
+    std::vector<UndoJournal::Change> changes;
+    const bool undone = journal.undo( changes );
+
+    return report( "edit outside the journal", !undone && matches( vol, before ) && !journal.canUndo() && !journal.canRedo() );
+}
+
+// a volume reallocated with another size during a step, or after it, cannot be undone
+static bool checkSizeChange()
+{
+    Volume vol;
+    vol.realloc( 40, 40, 40 );
+    vol.fill( 0 );
+
+    UndoJournal journal;
+    journal.beginStep( "realloc" );
+    journal.touch( &vol );
+    vol.realloc( 20, 20, 20 );
+    vol.fill( 3 );
+    const bool duringOk = !journal.endStep() && !journal.canUndo();
+
+    vol.realloc( 40, 40, 40 );
+    vol.fill( 0 );
+    journal.beginStep( "edit" );
+    journal.touch( &vol, 0, 0, 0, 5, 5, 5 );
+    vol(1, 1, 1) = 2;
+    journal.endStep();
+
+    vol.realloc( 41, 40, 40 );
+    vol.fill( 0 );
+
+    std::vector<UndoJournal::Change> changes;
+    const bool afterOk = !journal.undo( changes ) && !journal.canUndo();
+
+    return report( "size changes", duringOk && afterOk );
+}
+
+// a volume touched while empty and allocated in the step is cleared back to 0 by undo
+static bool checkEmptyVolume()
+{
+    Volume vol;
+
+    UndoJournal journal;
+    journal.beginStep( "allocate" );
+    journal.touch( &vol );
+    vol.realloc( 50, 40, 35 );
+    vol.fill( 0 );
+    journal.touch( &vol, 30, 30, 30, 40, 39, 34 );
+    vol(5, 5, 5) = 3;
+    vol(35, 35, 33) = 4;
+    bool ok = journal.endStep();
+
+    const Snapshot painted = snapshot( vol );
+
+    std::vector<UndoJournal::Change> changes;
+    ok = ok && journal.undo( changes ) && (std::count( vol.data(), vol.data() + vol.numElem(), 0 ) == (long)vol.numElem());
+    ok = ok && journal.redo( changes ) && matches( vol, painted );
+
+    return report( "volume empty before the step", ok );
+}
+
+// the oldest steps are dropped to stay within the budget, the newest ones are still undone
+//  correctly. A single step that needs more than the budget clears the journal
+static bool checkBudget()
+{
+    XorShift rnd( 3 );
+    Volume vol;
+    vol.realloc( 256, 256, 32 );
+    vol.fill( 0 );
+
+    UndoJournal journal;
+    journal.setBudgetMB( 1 );
+
+    // random values do not compress, every step takes about 512 kB
+    std::vector<Snapshot> snaps( 1, snapshot( vol ) );
+    const unsigned int numSteps = 10;
+    for (unsigned int s=0; s < numSteps; s++)
+    {
+        journal.beginStep( "step" );
+        const int x0 = (s % 2) * 128, y0 = ((s / 2) % 2) * 128;
+        journal.touch( &vol, x0, y0, 0, x0 + 127, y0 + 127, 31 );
+        for (int z=0; z < 32; z++)
+            for (int y=y0; y < y0 + 128; y++)
+                for (int x=x0; x < x0 + 128; x++)
+                    vol(x, y, z) = rnd.next();
+        journal.endStep();
+
+        snaps.push_back( snapshot( vol ) );
+    }
+
+    bool ok = (journal.bytes() <= 1024 * 1024);
+
+    std::vector<UndoJournal::Change> changes;
+    unsigned int numUndone = 0;
+    while ( journal.canUndo() )
+    {
+        ok = ok && journal.undo( changes ) && matches( vol, snaps[numSteps - numUndone - 1] );
+        numUndone++;
+    }
+    ok = ok && (numUndone > 0) && (numUndone < numSteps);
+
+    // the whole volume is 2 MB of random values
+    for (unsigned int i=0; i < vol.numElem(); i++)
+        vol.data()[i] = rnd.next();
+
+    journal.beginStep( "too large" );
+    journal.touch( &vol );
+    vol.fill( 5 );
+    ok = ok && !journal.endStep() && !journal.canUndo() && !journal.canRedo() && (journal.bytes() == 0);
+
+    return report( "budget", ok );
+}
+
+int main()
+{
+    bool ok = checkRoundTrip();
+    ok = checkOutsideEdit() && ok;
+    ok = checkSizeChange() && ok;
+    ok = checkEmptyVolume() && ok;
+    ok = checkBudget() && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,632 @@
+/**
+ ** Offscreen benchmark of the slice render pipeline.
+ *  Synthesises (or loads) a volume with overlays and labels, runs every stage the
+ *  viewer goes through to show a slice over all slices of the volume, and prints
+ *  the throughput of each stage in Mpix/s as JSON, to track it over time.
+ *
+ *  Usage: renderbench [options] > result.json
+ */
+#include <QApplication>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QGraphicsScene>
+#include <QPainter>
+#include <QImage>
+
+#include <cstdio>
+#include <vector>
+
+#include "CommonTypes.h"
+#include "Matrix3D.h"
+#include "ColorLists.h"
+#include "OverlayCompositor.h"
+#include "SliceSpans.h"
+#include "MiscUtils.h"
+#include "brush.h"
+#include "BrushStroke.h"
+#include "mygraphicsview.h"
+
+static void printUsage()
+{
+    fprintf(stderr, "Usage: renderbench [options]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -size WxHxD     synthetic volume size (default 512x512x64)\n");
+    fprintf(stderr, "  -volume FILE    load the volume instead of synthesising it\n");
+    fprintf(stderr, "  -overlays N     number of overlays blended on top (default 3)\n");
+    fprintf(stderr, "  -brush N        brush cursor half size in pixels (default 10)\n");
+    fprintf(stderr, "  -selection N    radius of the selected region in voxels (default 40)\n");
+    fprintf(stderr, "  -paintbrush N   half size of the label painting brushes in voxels (default 32)\n");
+    fprintf(stderr, "  -passes N       passes over the volume per stage, the best one is reported (default 3)\n");
+    fprintf(stderr, "  -noview         skip the MyGraphicsView stages\n");
+    fprintf(stderr, "Output: JSON on stdout, throughput of every stage in Mpix/s\n");
+}
+
+// deterministic, so that results only depend on the parameters and the machine
+class Lcg
+{
+private:
+    unsigned int mState;
+
+public:
+    Lcg( unsigned int seed ) : mState(seed) { }
+
+    inline unsigned int next()
+    {
+        mState = mState * 1664525u + 1013904223u;
+        return mState >> 8;
+    }
+
+    inline unsigned int next( unsigned int max ) { return next() % max; }
+};
+
+// smooth gradient plus noise, like a low contrast EM stack
+static void synthVolume( Matrix3D<PixelType> &vol, unsigned int w, unsigned int h, unsigned int d )
+{
+    vol.realloc( w, h, d );
+
+    Lcg rnd( 1 );
+    PixelType *p = vol.data();
+    for (unsigned int z=0; z < d; z++)
+        for (unsigned int y=0; y < h; y++)
+            for (unsigned int x=0; x < w; x++)
+                *p++ = (PixelType)( ( (x + y + z) & 0x7F ) + rnd.next( 64 ) );
+}
+
+// numBlobs balls of the given value on an empty volume, mostly empty as annotation overlays are
+static void synthBlobs( Matrix3D<unsigned char> &vol, const Matrix3D<PixelType> &like, unsigned int numBlobs,
+                        unsigned int maxValue, unsigned int seed )
+{
+    vol.reallocSizeLike( like );
+    vol.fill( 0 );
+
+    Lcg rnd( seed );
+    for (unsigned int b=0; b < numBlobs; b++)
+    {
+        const int cx = rnd.next( vol.width() ), cy = rnd.next( vol.height() ), cz = rnd.next( vol.depth() );
+        const int r = 4 + rnd.next( 20 );
+        const unsigned char value = 1 + rnd.next( maxValue );
+
+        for (int z = std::max( 0, cz - r ); z <= std::min( (int)vol.depth() - 1, cz + r ); z++)
+            for (int y = std::max( 0, cy - r ); y <= std::min( (int)vol.height() - 1, cy + r ); y++)
+                for (int x = std::max( 0, cx - r ); x <= std::min( (int)vol.width() - 1, cx + r ); x++)
+                    if ( (x-cx)*(x-cx) + (y-cy)*(y-cy) + (z-cz)*(z-cz) <= r*r )
+                        vol.set( x, y, z, value );
+    }
+}
+
+// a ball of radius r in the middle of the volume, as a selected supervoxel
+static void synthSelection( PixelInfoList &pixels, const Matrix3D<PixelType> &vol, int r )
+{
+    const int cx = vol.width() / 2, cy = vol.height() / 2, cz = vol.depth() / 2;
+
+    pixels.clear();
+    for (int z = std::max( 0, cz - r ); z <= std::min( (int)vol.depth() - 1, cz + r ); z++)
+        for (int y = std::max( 0, cy - r ); y <= std::min( (int)vol.height() - 1, cy + r ); y++)
+            for (int x = std::max( 0, cx - r ); x <= std::min( (int)vol.width() - 1, cx + r ); x++)
+            {
+                if ( (x-cx)*(x-cx) + (y-cy)*(y-cy) + (z-cz)*(z-cz) > r*r )
+                    continue;
+
+                PixelInfo pix;
+                pix.coords.x = x;
+                pix.coords.y = y;
+                pix.coords.z = z;
+                pix.index = x + y * vol.width() + z * vol.width() * vol.height();
+                pixels.push_back( pix );
+            }
+}
+
+// the brushes as they painted labels before the span rasteriser, voxel by voxel, timed for comparison
+static void voxelCubePaint( Matrix3D<LabelType> &data, int x, int y, int z, int width, int height, int depth, LabelType label )
+{
+    for (int i = x-width; i < x+width; i++)
+        for (int j = y-height; j < y+height; j++)
+            for (int k = z-depth; k < z+depth; k++)
+            {
+                if (i < 0 || j < 0 || k < 0)
+                    continue;
+                if (i >= (int)data.width() || j >= (int)data.height() || k >= (int)data.depth())
+                    continue;
+
+                data.set(i, j, k, label);
+            }
+}
+
+static void voxelSpherePaint( Matrix3D<LabelType> &data, int x, int y, int z, int width, int height, int depth, LabelType label )
+{
+    for (int i = x-width; i < x+width; i++)
+        for (int j = y-height; j < y+height; j++)
+            for (int k = z-depth; k < z+depth; k++)
+            {
+                if (i < 0 || j < 0 || k < 0)
+                    continue;
+                if (i >= (int)data.width() || j >= (int)data.height() || k >= (int)data.depth())
+                    continue;
+
+                if ( (i-x)*(i-x)/( (double)(width*width) )
+                   + (j-y)*(j-y)/( (double)(height*height) )
+                   + (k-z)*(k-z)/( (double)(depth*depth) ) <= 1)
+                    data.set(i, j, k, label);
+            }
+}
+
+// timings of a stage, every pass goes over the whole volume
+struct StageResult
+{
+    const char *name;
+    double      mpixPerPass;    // pixels processed by every pass, in Mpix
+    double      bestSecs;
+    double      totalSecs;
+    int         passes;
+
+    StageResult( const char *n, double pixelsPerPass ) :
+        name(n), mpixPerPass(pixelsPerPass / 1e6), bestSecs(-1), totalSecs(0), passes(0) { }
+
+    void addPass( qint64 nsecs )
+    {
+        const double secs = nsecs / 1e9;
+        if ( (bestSecs < 0) || (secs < bestSecs) )
+            bestSecs = secs;
+        totalSecs += secs;
+        passes++;
+    }
+
+    void printJSON( bool last ) const
+    {
+        const double best = std::max( bestSecs, 1e-9 );
+        printf("    { \"name\": \"%s\", \"mpix\": %.3f, \"best_ms\": %.3f, \"mean_ms\": %.3f, \"mpix_per_s\": %.1f }%s\n",
+               name, mpixPerPass, best * 1e3, totalSecs / std::max( passes, 1 ) * 1e3, mpixPerPass / best, last ? "" : ",");
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    // Qt 5 can run the widget stages without a display
+    if ( qgetenv("QT_QPA_PLATFORM").isEmpty() )
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+
+    unsigned int w = 512, h = 512, d = 64;
+    QString volumeFile;
+    unsigned int numOverlays = 3;
+    int brushSize = 10;
+    int selectionRadius = 40;
+    int paintBrushSize = 32;
+    int numPasses = 3;
+    bool useView = true;
+
+    const QStringList args = app.arguments();
+    for (int i=1; i < args.size(); i++)
+    {
+        const QString &a = args[i];
+        const bool hasValue = (i + 1 < args.size());
+
+        if ( (a == "-size") && hasValue )
+        {
+            const QStringList dims = args[++i].split('x');
+            if ( dims.size() != 3 ) {
+                printUsage();
+                return 1;
+            }
+            w = dims[0].toUInt();
+            h = dims[1].toUInt();
+            d = dims[2].toUInt();
+        }
+        else if ( (a == "-volume") && hasValue )
+            volumeFile = args[++i];
+        else if ( (a == "-overlays") && hasValue )
+            numOverlays = args[++i].toUInt();
+        else if ( (a == "-brush") && hasValue )
+            brushSize = args[++i].toInt();
+        else if ( (a == "-selection") && hasValue )
+            selectionRadius = args[++i].toInt();
+        else if ( (a == "-paintbrush") && hasValue )
+            paintBrushSize = args[++i].toInt();
+        else if ( (a == "-passes") && hasValue )
+            numPasses = args[++i].toInt();
+        else if ( a == "-noview" )
+            useView = false;
+        else if ( (a == "-h") || (a == "--help") ) {
+            printUsage();
+            return 0;
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", a.toLocal8Bit().constData());
+            printUsage();
+            return 1;
+        }
+    }
+
+    if ( (w == 0) || (h == 0) || (d == 0) || (numPasses <= 0) || (brushSize <= 0) || (paintBrushSize <= 0) ) {
+        printUsage();
+        return 1;
+    }
+
+    Matrix3D<PixelType> volume;
+    if ( !volumeFile.isEmpty() )
+    {
+        if ( !volume.load( volumeFile.toLocal8Bit().constData() ) ) {
+            fprintf(stderr, "Could not load %s\n", volumeFile.toLocal8Bit().constData());
+            return 1;
+        }
+    }
+    else
+        synthVolume( volume, w, h, d );
+
+    w = volume.width();
+    h = volume.height();
+    d = volume.depth();
+
+    const double slicePixels = (double)w * h;
+    const double volumePixels = slicePixels * d;
+
+    std::vector< Matrix3D<OverlayType> * > overlays( numOverlays );
+    for (unsigned int i=0; i < numOverlays; i++) {
+        overlays[i] = new Matrix3D<OverlayType>();
+        synthBlobs( *overlays[i], volume, 200, 255, 100 + i );
+    }
+
+    Matrix3D<LabelType> labels;
+    synthBlobs( labels, volume, 100, 3, 99 );
+
+    OverlayColorList overlayColors;
+    LabelColorList labelColors;
+
+    std::vector<StageResult> results;
+    QImage frame;
+
+    // gray slice -> RGB32
+    {
+        StageResult res( "gray", volumePixels );
+        for (int pass=0; pass < numPasses; pass++)
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            for (unsigned int z=0; z < d; z++)
+                volume.QImageSlice( z, frame );
+
+            res.addPass( timer.nsecsElapsed() );
+        }
+        results.push_back( res );
+    }
+
+    // XZ and YZ slices, strided in memory
+    {
+        std::vector<PixelType> buf( std::max( w, h ) * d );
+
+        StageResult resXZ( "extract_xz", volumePixels );
+        StageResult resYZ( "extract_yz", volumePixels );
+        for (int pass=0; pass < numPasses; pass++)
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            for (unsigned int y=0; y < h; y++)
+                volume.extractSlice( 0, 2, y, &buf[0], w, 0, 0, w, d );
+
+            resXZ.addPass( timer.nsecsElapsed() );
+            timer.start();
+
+            for (unsigned int x=0; x < w; x++)
+                volume.extractSlice( 2, 1, x, &buf[0], d, 0, 0, d, h );
+
+            resYZ.addPass( timer.nsecsElapsed() );
+        }
+        results.push_back( resXZ );
+        results.push_back( resYZ );
+    }
+
+    // overlays + labels blended on the gray slice, layers are collected per slice as in the viewer
+    {
+        OverlayCompositor layers;
+
+        StageResult res( "composite", volumePixels );
+        for (int pass=0; pass < numPasses; pass++)
+        {
+            qint64 nsecs = 0;
+            for (unsigned int z=0; z < d; z++)
+            {
+                volume.QImageSlice( z, frame );
+                unsigned int *pixPtr = (unsigned int *) frame.bits();
+
+                QElapsedTimer timer;
+                timer.start();
+
+                layers.clear();
+                for (unsigned int i=0; i < numOverlays; i++) {
+                    const QColor &c = overlayColors.getColor( i % overlayColors.count() );
+                    layers.addLayer( overlays[i]->sliceData(z), c.red(), c.green(), c.blue(), 0.5 );
+                }
+                layers.addPaletteLayer( labels.sliceData(z), labelColors.palette(), 0.5 );
+
+                layers.composite( pixPtr, pixPtr, w * h );
+
+                nsecs += timer.nsecsElapsed();
+            }
+            res.addPass( nsecs );
+        }
+        results.push_back( res );
+    }
+
+    // selection highlight, only the runs of every slice
+    {
+        PixelInfoList pixels;
+        synthSelection( pixels, volume, selectionRadius );
+
+        SliceSpanIndex spans;
+        spans.build( pixels, w, h, d );
+
+        volume.QImageSlice( d / 2, frame );
+        unsigned int *pixPtr = (unsigned int *) frame.bits();
+        const QColor color( 255, 0, 0 );
+
+        StageResult res( "selection", pixels.size() );
+        for (int pass=0; pass < numPasses; pass++)
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            for (unsigned int z=0; z < d; z++)
+            {
+                const SliceSpan *end = spans.sliceEnd(z);
+                for (const SliceSpan *s = spans.sliceBegin(z); s != end; ++s)
+                    blendSpanRGB( pixPtr + s->y * w + s->x0, s->x1 - s->x0 + 1, color, 0.6 );
+            }
+
+            res.addPass( timer.nsecsElapsed() );
+        }
+        results.push_back( res );
+    }
+
+    // label painting: the span brushes against the previous voxel by voxel brushes, on a grid
+    //  of positions covering the middle slice. Their correctness is checked by tests/brushkernels
+    {
+        const int r = paintBrushSize;
+        const int rz = std::max( 1, r / 2 );
+        const int step = 2 * r;
+        const unsigned int numX = (w + step - 1) / step, numY = (h + step - 1) / step;
+        const double voxelsPerPass = (double)numX * numY * (2*r) * (2*r) * (2*rz);
+
+        Matrix3D<LabelType> spanLabels, voxelLabels;
+        spanLabels.reallocSizeLike( volume );
+        voxelLabels.reallocSizeLike( volume );
+
+        CubeBrush cube( r, r, rz );
+        SphereBrush sphere( r, r, rz );
+
+        for (unsigned int b=0; b < 2; b++)
+        {
+            const bool isSphere = (b == 1);
+
+            StageResult resSpan( isSphere ? "paint_sphere_span" : "paint_cube_span", voxelsPerPass );
+            StageResult resVoxel( isSphere ? "paint_sphere_voxel" : "paint_cube_voxel", voxelsPerPass );
+
+            for (int pass=0; pass < numPasses; pass++)
+            {
+                const LabelType label = 1 + pass % 3;
+                spanLabels.fill( 0 );
+                voxelLabels.fill( 0 );
+
+                QElapsedTimer timer;
+                timer.start();
+
+                for (unsigned int y=0; y < numY; y++)
+                    for (unsigned int x=0; x < numX; x++)
+                    {
+                        if (isSphere)
+                            sphere.paint( spanLabels, x * step + r, y * step + r, d / 2, label );
+                        else
+                            cube.paint( spanLabels, x * step + r, y * step + r, d / 2, label );
+                    }
+
+                resSpan.addPass( timer.nsecsElapsed() );
+                timer.start();
+
+                for (unsigned int y=0; y < numY; y++)
+                    for (unsigned int x=0; x < numX; x++)
+                    {
+                        if (isSphere)
+                            voxelSpherePaint( voxelLabels, x * step + r, y * step + r, d / 2, r, r, rz, label );
+                        else
+                            voxelCubePaint( voxelLabels, x * step + r, y * step + r, d / 2, r, r, rz, label );
+                    }
+
+                resVoxel.addPass( timer.nsecsElapsed() );
+            }
+
+            results.push_back( resSpan );
+            results.push_back( resVoxel );
+        }
+
+        // constrained painting: a pixel value range and only over unlabelled voxels, evaluated
+        //  by the brush kernel
+        BrushConstraints constraints;
+        constraints.volume = volume.data();
+        constraints.pixMin = 64;
+        constraints.pixMax = 192;
+        constraints.dontOverwriteLabeled = true;
+        sphere.constraints = &constraints;
+
+        StageResult resConstrained( "paint_sphere_constrained", voxelsPerPass );
+
+        for (int pass=0; pass < numPasses; pass++)
+        {
+            const LabelType label = 1 + pass % 3;
+
+            // some voxels are labelled already
+            for (unsigned int i=0; i < spanLabels.numElem(); i++)
+                spanLabels.data()[i] = (i % 7 == 0) ? 4 : 0;
+
+            QElapsedTimer timer;
+            timer.start();
+
+            for (unsigned int y=0; y < numY; y++)
+                for (unsigned int x=0; x < numX; x++)
+                    sphere.paint( spanLabels, x * step + r, y * step + r, d / 2, label );
+
+            resConstrained.addPass( timer.nsecsElapsed() );
+        }
+
+        sphere.constraints = 0;
+        results.push_back( resConstrained );
+    }
+
+    // label painting drags: a zigzag over the middle slice, with the mouse moving 1.5 brush radii
+    //  between events. Stamping every event (as before strokes) against the swept stroke, painted
+    //  in batches of 4 events (one per render)
+    {
+        const int r = std::max( 1, paintBrushSize / 2 );
+        const int rz = std::max( 1, r / 2 );
+        const int step = 3 * r / 2 + 1;
+        const int eventsPerBatch = 4;
+
+        std::vector<int> px, py;
+        for (int y = r, row = 0; y + r <= (int)h; y += 2 * r, row++)
+            for (int i = 0; i * step < (int)w; i++) {
+                px.push_back( (row % 2 == 0) ? i * step : (int)w - 1 - i * step );
+                py.push_back( y );
+            }
+
+        const double voxelsPerPass = (double)px.size() * (2*r) * (2*r) * (2*rz);
+
+        Matrix3D<LabelType> stampLabels, strokeLabels;
+        stampLabels.reallocSizeLike( volume );
+        strokeLabels.reallocSizeLike( volume );
+
+        SphereBrush sphere( r, r, rz );
+
+        StageResult resStamps( "stroke_stamps", voxelsPerPass );
+        StageResult resSwept( "stroke_swept", voxelsPerPass );
+
+        for (int pass=0; pass < numPasses; pass++)
+        {
+            stampLabels.fill( 0 );
+            strokeLabels.fill( 0 );
+
+            QElapsedTimer timer;
+            timer.start();
+
+            for (unsigned int i=0; i < px.size(); i++)
+                sphere.paint( stampLabels, px[i], py[i], d / 2, 1 );
+
+            resStamps.addPass( timer.nsecsElapsed() );
+            timer.start();
+
+            BrushStroke stroke;
+            stroke.begin( &strokeLabels, &sphere, 1 );
+            for (unsigned int i=0; i < px.size(); i++) {
+                stroke.moveTo( px[i], py[i], d / 2 );
+                if ( (i + 1) % eventsPerBatch == 0 )
+                    stroke.paintPending();
+            }
+            stroke.paintPending();
+            stroke.end();
+
+            resSwept.addPass( timer.nsecsElapsed() );
+        }
+
+        results.push_back( resStamps );
+        results.push_back( resSwept );
+    }
+
+    // upload to the graphics view tiles, and painting them (tiles are converted to pixmaps when painted)
+    if (useView)
+    {
+        MyGraphicsView view;
+        view.resize( w, h );
+
+        std::vector<QImage> slices( 2 );
+        volume.QImageSlice( 0, slices[0] );
+        volume.QImageSlice( d - 1, slices[1] );
+
+        view.setImage( slices[0] );
+
+        QImage target( w, h, QImage::Format_RGB32 );
+
+        StageResult resUpload( "setimage", volumePixels );
+        StageResult resPaint( "paint", volumePixels );
+        for (int pass=0; pass < numPasses; pass++)
+        {
+            qint64 uploadNsecs = 0, paintNsecs = 0;
+            for (unsigned int z=0; z < d; z++)
+            {
+                QElapsedTimer timer;
+                timer.start();
+
+                view.setImage( slices[z % 2] );
+
+                uploadNsecs += timer.nsecsElapsed();
+                timer.start();
+
+                QPainter painter( &target );
+                view.scene()->render( &painter, QRectF( 0, 0, w, h ), QRectF( 0, 0, w, h ) );
+                painter.end();
+
+                paintNsecs += timer.nsecsElapsed();
+            }
+            resUpload.addPass( uploadNsecs );
+            resPaint.addPass( paintNsecs );
+        }
+        results.push_back( resUpload );
+        results.push_back( resPaint );
+
+        // brush cursor outline moved on a grid of positions covering the slice, and the
+        //  area around it painted again, as the viewport does
+        const int step = 2 * brushSize;
+        const unsigned int numX = (w + step - 1) / step, numY = (h + step - 1) / step;
+        const char *names[] = { "cursor_cube", "cursor_sphere" };
+
+        for (unsigned int b=0; b < 2; b++)
+        {
+            StageResult res( names[b], (double)numX * numY * step * step );
+            for (int pass=0; pass < numPasses; pass++)
+            {
+                QElapsedTimer timer;
+                timer.start();
+
+                QPainter painter( &target );
+                for (unsigned int y=0; y < numY; y++)
+                    for (unsigned int x=0; x < numX; x++)
+                    {
+                        const QRect rect( x * step, y * step, step, step );
+                        view.setBrushCursor( rect, b == 1, QColor( 255, 0, 0 ) );
+
+                        const QRectF area = QRectF(rect).adjusted( -2, -2, 2, 2 );
+                        view.scene()->render( &painter, area, area );
+                    }
+                painter.end();
+
+                res.addPass( timer.nsecsElapsed() );
+            }
+            results.push_back( res );
+        }
+    }
+
+    for (unsigned int i=0; i < numOverlays; i++)
+        delete overlays[i];
+
+#ifdef __SSE2__
+    const bool sse2 = true;
+#else
+    const bool sse2 = false;
+#endif
+
+    printf("{\n");
+    printf("  \"benchmark\": \"renderbench\",\n");
+    printf("  \"volume\": { \"width\": %u, \"height\": %u, \"depth\": %u, \"source\": \"%s\" },\n",
+           w, h, d, volumeFile.isEmpty() ? "synthetic" : "file");
+    printf("  \"overlays\": %u,\n", numOverlays);
+    printf("  \"brush\": %d,\n", brushSize);
+    printf("  \"paint_brush\": %d,\n", paintBrushSize);
+    printf("  \"passes\": %d,\n", numPasses);
+    printf("  \"sse2\": %s,\n", sse2 ? "true" : "false");
+    printf("  \"stages\": [\n");
+    for (unsigned int i=0; i < results.size(); i++)
+        results[i].printJSON( i + 1 == results.size() );
+    printf("  ]\n");
+    printf("}\n");
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+#-------------------------------------------------
+#
+# Offscreen benchmark of the slice render pipeline
+#
+#-------------------------------------------------
+
+# widgets are needed for the MyGraphicsView stages. With Qt 5 they run
+#  without a display (QT_QPA_PLATFORM=offscreen, set by default)
+QT       += core gui
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = renderbench
+TEMPLATE = app
+
+INCLUDEPATH += ../../
+
+SOURCES += renderbench.cpp \
+    ../../mygraphicsview.cpp \
+    ../../brush.cpp
+
+HEADERS += ../../mygraphicsview.h \
+    ../../SliceViewer.h \
+    ../../brush.h \
+    ../../BrushKernels.h \
+    ../../BrushStroke.h \
+    ../../Matrix3D.h \
+    ../../CommonTypes.h \
+    ../../ColorLists.h \
+    ../../OverlayCompositor.h \
+    ../../SliceSpans.h \
+    ../../MiscUtils.h
+
+# same flags as the annotator, so that the numbers are comparable
+QMAKE_CXXFLAGS += -fopenmp -O3
+QMAKE_LFLAGS += -fopenmp
+
+# IMPORTANT: user should create this file to specify ITKPATH
+include(../../customUserDefs.inc)
+
+ITKPATH_BUILD = $$ITKPATH/build
+
+# Replace to point to SLIC path (headers only)
+SLICPATH = $$_PRO_FILE_PWD_/../../third-party/slic
+
+INCLUDEPATH += $$SLICPATH/../
+
+#### ITK STUFF
+
+INCLUDEPATH += $$ITKPATH/Code/Review
+INCLUDEPATH += $$ITKPATH_BUILD/Code/Review
+
+INCLUDEPATH += $$ITKPATH/Utilities/gdcm/src
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/gdcm/src
+
+INCLUDEPATH += $$ITKPATH/Utilities/gdcm
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/gdcm
+
+INCLUDEPATH += $$ITKPATH/Utilities/vxl/core
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/vxl/core
+
+INCLUDEPATH += $$ITKPATH/Utilities/vxl/vcl
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/vxl/vcl
+
+INCLUDEPATH += $$ITKPATH/Utilities/vxl/v3p/netlib
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/vxl/v3p/netlib
+
+INCLUDEPATH += $$ITKPATH/Utilities/vxl/core
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/vxl/core
+
+INCLUDEPATH += $$ITKPATH/Utilities/vxl/vcl
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/vxl/vcl
+
+INCLUDEPATH += $$ITKPATH/Utilities/vxl/v3p/netlib
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/vxl/v3p/netlib
+
+INCLUDEPATH += $$ITKPATH/Code/Numerics/Statistics
+INCLUDEPATH += $$ITKPATH_BUILD/Code/Numerics/Statistics
+
+INCLUDEPATH += $$ITKPATH/Utilities
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities
+
+INCLUDEPATH += $$ITKPATH/Utilities/itkExtHdrs
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/itkExtHdrs
+
+INCLUDEPATH += $$ITKPATH/Utilities/nifti/znzlib
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/nifti/znzlib
+
+INCLUDEPATH += $$ITKPATH/Utilities/nifti/niftilib
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/nifti/niftilib
+
+INCLUDEPATH += $$ITKPATH/Utilities/expat
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/expat
+
+INCLUDEPATH += $$ITKPATH/Utilities/DICOMParser
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/DICOMParser
+
+INCLUDEPATH += $$ITKPATH/Utilities/NrrdIO
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/NrrdIO
+
+INCLUDEPATH += $$ITKPATH/Utilities/MetaIO
+INCLUDEPATH += $$ITKPATH_BUILD/Utilities/MetaIO
+
+INCLUDEPATH += $$ITKPATH/Code/SpatialObject
+INCLUDEPATH += $$ITKPATH_BUILD/Code/SpatialObject
+
+INCLUDEPATH += $$ITKPATH/Code/Numerics/NeuralNetworks
+INCLUDEPATH += $$ITKPATH_BUILD/Code/Numerics/NeuralNetworks
+
+INCLUDEPATH += $$ITKPATH/Code/Numerics/FEM
+INCLUDEPATH += $$ITKPATH_BUILD/Code/Numerics/FEM
+
+INCLUDEPATH += $$ITKPATH/Code/IO
+INCLUDEPATH += $$ITKPATH_BUILD/Code/IO
+
+INCLUDEPATH += $$ITKPATH/Code/Numerics
+INCLUDEPATH += $$ITKPATH_BUILD/Code/Numerics
+
+INCLUDEPATH += $$ITKPATH/Code/Common
+INCLUDEPATH += $$ITKPATH_BUILD/Code/Common
+
+INCLUDEPATH += $$ITKPATH/Code/BasicFilters
+INCLUDEPATH += $$ITKPATH_BUILD/Code/BasicFilters
+
+INCLUDEPATH += $$ITKPATH/Code/Algorithms
+INCLUDEPATH += $$ITKPATH_BUILD/Code/Algorithms
+
+INCLUDEPATH += $$ITKPATH/
+INCLUDEPATH += $$ITKPATH_BUILD/
+
+LIBS += -L$$ITKPATH_BUILD/bin -lITKIO -lITKStatistics -lITKNrrdIO -litkgdcm -litkjpeg12 -litkjpeg16 -litkopenjpeg -litkpng -litktiff -litkjpeg8 -lITKSpatialObject -lITKMetaIO -lITKDICOMParser -lITKEXPAT -lITKniftiio -lITKznz -litkzlib -lITKCommon -litksys -litkvnl_inst -litkvnl_algo -litkvnl -litkvcl -litkv3p_lsqr -lpthread -lm -litkNetlibSlatec -litkv3p_netlib
+
+unix {
+ LIBS += -ldl
+}
+
+win32 {
+ LIBS += -lsnmpapi -lrpcrt4 -lws2_32 -lgdi32
+}
+
+#LIBS += -luuid
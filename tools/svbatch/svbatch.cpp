@@ -0,0 +1,277 @@
+/**
+ ** Headless supervoxel precomputation.
+ *  Runs the SuperVoxeler pipeline on a list of volumes and saves the results
+ *  in the format read by "Load global from file..." in the annotator.
+ *  With -bricks it writes out-of-core supervoxels instead ("Load global out-of-core..."),
+ *  and with -raw the volumes are read brick by brick, so they can be larger than RAM.
+ *
+ *  Usage: svbatch [options] volume1.tif [volume2.tif ...]
+ */
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFileInfo>
+#include <QDir>
+#include <QTime>
+
+#include <cstdio>
+#include <cmath>
+
+#include "CommonTypes.h"
+#include "SuperVoxeler.h"
+#include "BrickedSupervoxels.h"
+
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+static void printUsage()
+{
+    printf("Usage: svbatch [options] volume1 [volume2 ...]\n");
+    printf("Options:\n");
+    printf("  -seed N       supervoxel seed/step size (default 20)\n");
+    printf("  -cubeness N   supervoxel cubeness (default 40)\n");
+    printf("  -threads N    number of threads, 0 = all available (default 0)\n");
+    printf("  -hist         also compute and save per-supervoxel histograms and means\n");
+    printf("  -outdir DIR   output folder (default: same folder as each volume)\n");
+    printf("  -bricks N     out-of-core supervoxels, computed in bricks of N^3 voxels\n");
+    printf("  -raw WxHxD    volumes are headerless 8-bit raw files of this size, read\n");
+    printf("                brick by brick (only with -bricks)\n");
+    printf("Output: <name>_sv.nrrd (and <name>_sv_hist.txt with -hist),\n");
+    printf("        or the folder <name>_svbricks with -bricks\n");
+}
+
+// stage timer, prints elapsed time for every finished stage
+class StageTimer
+{
+private:
+    QTime mTime;
+    QTime mTotal;
+
+public:
+    StageTimer() { mTotal.start(); }
+
+    void start( const char *name )
+    {
+        printf("  %-12s ... ", name);
+        fflush(stdout);
+        mTime.start();
+    }
+
+    void stop()
+    {
+        printf("%8.2f s\n", mTime.elapsed() / 1000.0);
+        fflush(stdout);
+    }
+
+    double totalSeconds() const { return mTotal.elapsed() / 1000.0; }
+};
+
+// out-of-core supervoxels of one volume, only one brick of it is read at a time with -raw
+static bool runBricked( const QString &volume, const QString &outBase, const unsigned int rawSize[3],
+                        unsigned int brickSize, int seed, unsigned int cubeness, StageTimer &timer )
+{
+    Matrix3D<PixelType> inMemory;
+    MatrixBrickSource<PixelType> matrixSrc( inMemory );
+    RawFileBrickSource<PixelType> rawSrc;
+    BrickSource<PixelType> *src = &matrixSrc;
+
+    if ( rawSize[0] > 0 )
+    {
+        if ( !rawSrc.open( volume.toLocal8Bit().constData(), rawSize[0], rawSize[1], rawSize[2] ) ) {
+            printf("  cannot read %s as a %ux%ux%u raw volume\n", volume.toLocal8Bit().constData(), rawSize[0], rawSize[1], rawSize[2]);
+            return false;
+        }
+        src = &rawSrc;
+    }
+    else
+    {
+        timer.start("load");
+        if ( !inMemory.load( volume.toLocal8Bit().constData() ) ) {
+            printf("failed\n");
+            return false;
+        }
+        timer.stop();
+    }
+
+    printf("  %u x %u x %u voxels\n", src->width(), src->height(), src->depth());
+
+    // same restriction as the GUI, otherwise SLIC crashes
+    const unsigned int minSide = std::min( brickSize, std::min( src->width(), std::min( src->height(), src->depth() ) ) );
+    if ( seed > ceil( minSide / 1.5 ) ) {
+        printf("  seed too large for this brick size, skipping\n");
+        return false;
+    }
+
+    const QString dir = outBase + "bricks";
+    if ( !QDir().mkpath( dir ) ) {
+        printf("  cannot create %s\n", dir.toLocal8Bit().constData());
+        return false;
+    }
+
+    BrickedSupervoxels<PixelType> svox;
+
+    timer.start("supervoxels");
+    const bool ok = svox.generate( *src, brickSize, seed, cubeness, dir.toLocal8Bit().constData() );
+    timer.stop();
+
+    if (!ok) {
+        printf("  error writing %s\n", dir.toLocal8Bit().constData());
+        return false;
+    }
+
+    printf("  %u supervoxels\n", svox.numLabels());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    int seed = 20;
+    unsigned int cubeness = 40;
+    int numThreads = 0;
+    bool computeHist = false;
+    unsigned int brickSize = 0;
+    unsigned int rawSize[3] = { 0, 0, 0 };
+    QString outDir;
+    QStringList volumes;
+
+    const QStringList args = app.arguments();
+    for (int i=1; i < args.size(); i++)
+    {
+        const QString &a = args[i];
+        const bool hasValue = (i + 1 < args.size());
+
+        if ( (a == "-seed") && hasValue )
+            seed = args[++i].toInt();
+        else if ( (a == "-cubeness") && hasValue )
+            cubeness = args[++i].toUInt();
+        else if ( (a == "-threads") && hasValue )
+            numThreads = args[++i].toInt();
+        else if ( (a == "-outdir") && hasValue )
+            outDir = args[++i];
+        else if ( (a == "-bricks") && hasValue )
+            brickSize = args[++i].toUInt();
+        else if ( (a == "-raw") && hasValue ) {
+            const QStringList dims = args[++i].split('x');
+            for (int d=0; (d < 3) && (dims.size() == 3); d++)
+                rawSize[d] = dims[d].toUInt();
+
+            if ( (rawSize[0] == 0) || (rawSize[1] == 0) || (rawSize[2] == 0) ) {
+                printf("Invalid raw volume size %s\n", args[i].toLocal8Bit().constData());
+                return 1;
+            }
+        }
+        else if ( a == "-hist" )
+            computeHist = true;
+        else if ( (a == "-h") || (a == "--help") ) {
+            printUsage();
+            return 0;
+        }
+        else if ( a.startsWith("-") ) {
+            printf("Unknown option %s\n", a.toLocal8Bit().constData());
+            printUsage();
+            return 1;
+        }
+        else
+            volumes.append( a );
+    }
+
+    if ( volumes.isEmpty() || (seed <= 0) || ((rawSize[0] > 0) && (brickSize == 0)) ) {
+        printUsage();
+        return 1;
+    }
+
+#ifdef _OPENMP
+    if (numThreads <= 0)
+        numThreads = omp_get_max_threads();
+    omp_set_num_threads( numThreads );
+#else
+    numThreads = 1;
+#endif
+
+    printf("Seed %d, cubeness %u, %d thread(s)\n", seed, cubeness, numThreads);
+
+    int numFailed = 0;
+    double totalTime = 0;
+
+    for (int v=0; v < volumes.size(); v++)
+    {
+        const QFileInfo inInfo( volumes[v] );
+        const QString dir = outDir.isEmpty() ? inInfo.absolutePath() : outDir;
+        const QString outBase = QDir(dir).filePath( inInfo.completeBaseName() + "_sv" );
+
+        printf("[%d/%d] %s\n", v + 1, (int)volumes.size(), volumes[v].toLocal8Bit().constData());
+
+        StageTimer timer;
+
+        if ( brickSize > 0 )
+        {
+            if ( !runBricked( volumes[v], outBase, rawSize, brickSize, seed, cubeness, timer ) ) {
+                numFailed++;
+                continue;
+            }
+
+            printf("  total        ... %8.2f s\n", timer.totalSeconds());
+            totalTime += timer.totalSeconds();
+            continue;
+        }
+
+        Matrix3D<PixelType> volume;
+        timer.start("load");
+        if ( !volume.load( volumes[v].toLocal8Bit().constData() ) ) {
+            printf("failed\n");
+            numFailed++;
+            continue;
+        }
+        timer.stop();
+
+        printf("  %u x %u x %u voxels\n", volume.width(), volume.height(), volume.depth());
+
+        // same restriction as the GUI, otherwise SLIC crashes
+        const unsigned int minSide = std::min( volume.width(), std::min( volume.height(), volume.depth() ) );
+        if ( seed > ceil( minSide / 1.5 ) ) {
+            printf("  seed too large for this volume, skipping\n");
+            numFailed++;
+            continue;
+        }
+
+        SuperVoxeler<PixelType> svox;
+
+        timer.start("supervoxels");
+        svox.genLabels( volume, seed, cubeness, numThreads );
+        timer.stop();
+
+        printf("  %u supervoxels\n", svox.numLabels());
+
+        if (computeHist)
+        {
+            timer.start("slic map");
+            svox.computeSlicMap();
+            timer.stop();
+
+            timer.start("histograms");
+            svox.computeSingleHistogramAndMean( volume, HistogramOpts<PixelType>() );
+            timer.stop();
+        }
+
+        timer.start("save");
+        bool ok = svox.save( (outBase + ".nrrd").toLocal8Bit().constData() );
+        if (ok && computeHist)
+            ok = svox.saveHistograms( (outBase + "_hist.txt").toLocal8Bit().constData() );
+        timer.stop();
+
+        if (!ok) {
+            printf("  error saving %s\n", outBase.toLocal8Bit().constData());
+            numFailed++;
+            continue;
+        }
+
+        printf("  total        ... %8.2f s\n", timer.totalSeconds());
+        totalTime += timer.totalSeconds();
+    }
+
+    printf("Done: %d volume(s) processed, %d failed, %.2f s\n", (int)volumes.size() - numFailed, numFailed, totalTime);
+
+    return (numFailed == 0) ? 0 : 1;
+}